@@ -0,0 +1,183 @@
+/*
+ *
+ *  CPU affinity configuration for the sequencer, RT services and best-effort
+ *  threads
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#include "affinity.h"
+
+#define ISOLATED_CPUS_FILE "/sys/devices/system/cpu/isolated"
+
+// Parse a kernel style cpu list, e.g. "3", "2-3" or "0,2-3". "all" selects
+// every online CPU.
+int affinity_parse_cpulist(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    char *end;
+    long first, last, cpu;
+    int nprocs = get_nprocs();
+
+    CPU_ZERO(set);
+    if (strcmp(list, "all") == 0)
+    {
+        for (cpu = 0; cpu < nprocs; cpu++)
+            CPU_SET(cpu, set);
+        return 0;
+    }
+
+    while (*p != '\0' && *p != '\n')
+    {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0) return -1;
+        last = first;
+        p = end;
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+            p = end;
+        }
+        for (cpu = first; cpu <= last; cpu++)
+        {
+            if (cpu >= nprocs)
+            {
+                printf("CPU %ld is not online\n", cpu);
+                return -1;
+            }
+            CPU_SET(cpu, set);
+        }
+        if (*p == ',') p++;
+        else if (*p != '\0' && *p != '\n') return -1;
+    }
+
+    return (CPU_COUNT(set) > 0) ? 0 : -1;
+}
+
+int affinity_init(affinity_config_t *cfg, int num_services, const char **names, int default_rt_cpu)
+{
+    int i;
+
+    if (num_services > AFFINITY_MAX_SERVICES) return -1;
+    memset(cfg, 0, sizeof(affinity_config_t));
+    cfg->num_services = num_services;
+    for (i = 0; i < num_services; i++)
+        cfg->names[i] = names[i];
+
+    // fall back to the last CPU when the default one is not online
+    if (default_rt_cpu >= get_nprocs()) default_rt_cpu = get_nprocs() - 1;
+    CPU_ZERO(&cfg->rt_cpus);
+    CPU_SET(default_rt_cpu, &cfg->rt_cpus);
+    return 0;
+}
+
+// "<name>=<cpulist>", name is a service name or "be" for best-effort work
+int affinity_parse_service(affinity_config_t *cfg, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    size_t len;
+    int i;
+
+    if (eq == NULL) return -1;
+    len = eq - arg;
+
+    if (len == 2 && strncmp(arg, "be", len) == 0)
+    {
+        cfg->be_set = true;
+        return affinity_parse_cpulist(eq + 1, &cfg->be_cpus);
+    }
+    for (i = 0; i < cfg->num_services; i++)
+    {
+        if (strlen(cfg->names[i]) == len && strncmp(arg, cfg->names[i], len) == 0)
+        {
+            cfg->service_set[i] = true;
+            return affinity_parse_cpulist(eq + 1, &cfg->service_cpus[i]);
+        }
+    }
+    printf("Unknown service in affinity option: %s\n", arg);
+    return -1;
+}
+
+// RT services go to the isolated list, "auto" reads the isolcpus= set
+int affinity_isolate(affinity_config_t *cfg, const char *list)
+{
+    char buf[128];
+    FILE *fp;
+
+    if (strcmp(list, "auto") == 0)
+    {
+        fp = fopen(ISOLATED_CPUS_FILE, "r");
+        if (fp == NULL || fgets(buf, sizeof(buf), fp) == NULL || buf[0] == '\n')
+        {
+            if (fp != NULL) fclose(fp);
+            printf("No isolated CPUs, boot with isolcpus= or give a cpu list\n");
+            return -1;
+        }
+        fclose(fp);
+        list = buf;
+    }
+    return affinity_parse_cpulist(list, &cfg->rt_cpus);
+}
+
+// Fill in every set that was not given explicitly
+void affinity_finalize(affinity_config_t *cfg)
+{
+    cpu_set_t used;
+    int i, cpu, nprocs = get_nprocs();
+
+    CPU_ZERO(&used);
+    for (i = 0; i < cfg->num_services; i++)
+    {
+        if (!cfg->service_set[i])
+            cfg->service_cpus[i] = cfg->rt_cpus;
+        CPU_OR(&used, &used, &cfg->service_cpus[i]);
+    }
+
+    if (!cfg->be_set)
+    {
+        CPU_ZERO(&cfg->be_cpus);
+        for (cpu = 0; cpu < nprocs; cpu++)
+            if (!CPU_ISSET(cpu, &used))
+                CPU_SET(cpu, &cfg->be_cpus);
+        // single core or every core taken by RT: best effort shares them
+        if (CPU_COUNT(&cfg->be_cpus) == 0)
+            cfg->be_cpus = used;
+    }
+}
+
+void affinity_print_map(affinity_config_t *cfg)
+{
+    int i, cpu, nprocs = get_nprocs();
+    bool empty;
+
+    printf("Core map (%d CPUs online):\n", nprocs);
+    for (cpu = 0; cpu < nprocs; cpu++)
+    {
+        empty = true;
+        printf("  CPU%d:", cpu);
+        for (i = 0; i < cfg->num_services; i++)
+        {
+            if (CPU_ISSET(cpu, &cfg->service_cpus[i]))
+            {
+                printf(" %s", cfg->names[i]);
+                empty = false;
+            }
+        }
+        if (CPU_ISSET(cpu, &cfg->be_cpus))
+        {
+            printf(" best-effort");
+            empty = false;
+        }
+        if (empty) printf(" idle");
+        printf("\n");
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ *
+ *  CPU affinity configuration for the sequencer, RT services and best-effort
+ *  threads
+ *  Most added work done by Chutao
+ *
+ *  Every RT service (index 0 is the sequencer) has its own CPU set. Best-effort
+ *  work (worker pool, send, logging) shares one set, which by default is every
+ *  online CPU that no RT service is pinned to.
+ */
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdbool.h>
+#include <sched.h>
+
+#define AFFINITY_MAX_SERVICES (8)
+
+typedef struct affinity_config
+{
+    int num_services;
+    const char *names[AFFINITY_MAX_SERVICES];   // short names used on the command line
+    cpu_set_t service_cpus[AFFINITY_MAX_SERVICES];
+    bool service_set[AFFINITY_MAX_SERVICES];    // given explicitly with -a
+    cpu_set_t rt_cpus;          // isolated set, default for every RT service
+    cpu_set_t be_cpus;          // best-effort set
+    bool be_set;
+}affinity_config_t;
+
+int affinity_init(affinity_config_t *cfg, int num_services, const char **names, int default_rt_cpu);
+int affinity_parse_cpulist(const char *list, cpu_set_t *set);
+int affinity_parse_service(affinity_config_t *cfg, const char *arg);
+int affinity_isolate(affinity_config_t *cfg, const char *list);
+void affinity_finalize(affinity_config_t *cfg);
+void affinity_print_map(affinity_config_t *cfg);
+
+#endif /* AFFINITY_H */
@@ -0,0 +1,396 @@
+/*
+ *
+ *  Benchmark harness for the capture pipeline
+ *  Most added work done by Chutao
+ *
+ *  Runs the pipeline on the synthetic frame source for a set number of
+ *  frames at a set rate, one configuration at a time. Each configuration
+ *  adds one stage to the previous one:
+ *
+ *      raw       capture only, no overlay
+ *      overlay   + time/name overlay
+ *      ppm       + PPM file write
+ *      compress  + JPEG encode and write
+ *      send      + send to a loopback aesd_server sink
+ *
+ *  The summary (throughput, p50/p99/max per stage, deadline misses) is
+ *  printed as JSON so runs can be diffed and tracked between releases.
+ *  `make bench` builds it and writes bench.json.
+ *
+ *  -F runs every configuration under a fault injection scenario (fault.h),
+ *  the loop counts as service s1; each run then also reports the misses
+ *  and recovery time per fault. `make fault-bench` runs the scenarios in
+ *  faults/ one after the other.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "capture.h"
+#include "latency.h"
+#include "netsend.h"
+#include "fault.h"
+#include "platform.h"
+
+#define BENCH_FRAMES    (300)
+#define BENCH_RATE_HZ   (30)
+#define BENCH_DIR       "./bench_out"
+
+enum bench_config
+{
+    CFG_RAW = 0,
+    CFG_OVERLAY,
+    CFG_PPM,
+    CFG_COMPRESS,
+    CFG_SEND,
+    CFG_NUM
+};
+
+static const char *config_names[CFG_NUM] = {"raw", "overlay", "ppm", "compress", "send"};
+
+// Stages reported, in pipeline order; capture is measured from the release
+enum bench_stage
+{
+    ST_CAPTURE = 0,
+    ST_OVERLAY,
+    ST_FILE_WRITE,
+    ST_ENCODE,
+    ST_SEND,
+    ST_TOTAL,
+    ST_NUM
+};
+
+static const char *stage_names[ST_NUM] = {"capture", "overlay", "file_write", "encode", "send", "total"};
+static const int stage_lat[ST_TOTAL] = {LAT_DEQUEUE, LAT_OVERLAY, LAT_FILE_WRITE, LAT_ENCODE, LAT_SEND};
+
+typedef struct bench_opts
+{
+    int frames;
+    int rate_hz;                // 0 = back to back
+    double deadline_ms;         // default one period
+    int width;
+    int height;
+    const char *server;         // NULL = in-process loopback sink (netsink)
+    const char *port;
+    const char *out;            // NULL = stdout
+    const char *faults;         // scenario file, NULL = none
+    int configs[CFG_NUM];
+}bench_opts_t;
+
+typedef struct bench_result
+{
+    double elapsed_s;
+    int captured;
+    int misses;
+    long long *usec[ST_NUM];    // per frame, -1 = stage did not run
+}bench_result_t;
+
+//*****************************************************************************
+//
+// Statistics
+//
+//*****************************************************************************
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts in place; returns the number of frames the stage ran on
+static int stage_percentiles(long long *v, int n, long long *p50, long long *p99, long long *max)
+{
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        if (v[i] >= 0) v[count++] = v[i];
+    if (count == 0) return 0;
+    qsort(v, count, sizeof(long long), cmp_ll);
+    *p50 = v[(count - 1)*50/100];
+    *p99 = v[(count - 1)*99/100];
+    *max = v[count - 1];
+    return count;
+}
+
+static unsigned long long now_ns(void)
+{
+    return latency_now();
+}
+
+//*****************************************************************************
+//
+// One configuration
+//
+//*****************************************************************************
+static int bench_run(bench_opts_t *opts, int config, struct addrinfo *server, bench_result_t *r)
+{
+    unsigned long long period_ns = opts->rate_hz ? 1000000000ULL/opts->rate_hz : 0;
+    unsigned long long deadline_ns = (unsigned long long)(opts->deadline_ms*1000000.0);
+    unsigned long long start, release, finish;
+    struct timespec ts;
+    char filename[64];
+    char dst_filename[64];
+    int i, s;
+
+    memset(r, 0, sizeof(bench_result_t));
+    for (s = 0; s < ST_NUM; s++)
+    {
+        r->usec[s] = malloc(sizeof(long long)*opts->frames);
+        if (r->usec[s] == NULL) return -1;
+    }
+    capture_set_overlay(config >= CFG_OVERLAY ? CAPTURE_OVERLAY_DEFAULT : 0);
+
+    // warm-up: opens the source, sizes the pool and faults the first pages
+    capture_write(0, NULL);
+
+    fault_start();
+    start = now_ns();
+    for (i = 0; i < opts->frames; i++)
+    {
+        release = start + (unsigned long long)i*period_ns;
+        ts.tv_sec = release/1000000000ULL;
+        ts.tv_nsec = release%1000000000ULL;
+        if (period_ns) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        else release = now_ns();
+
+        fault_inject(FAULT_CPU, "s1");
+        sprintf(filename, BENCH_DIR "/cap_%06d.ppm", i);
+        capture_frame_t *frame = capture_frame(0, config >= CFG_PPM ? filename : NULL);
+        if (frame != NULL)
+        {
+            r->captured++;
+            if (config >= CFG_COMPRESS)
+            {
+                sprintf(dst_filename, BENCH_DIR "/cap_%06d.jpg", i);
+                compress_frame(frame, dst_filename);
+            }
+            if (config >= CFG_SEND)
+            {
+                capture_frame_ppm(frame);
+                if (netsend_image(server, frame->ppm, frame->ppm_len, NULL) >= 0)
+                    latency_mark(frame->lat, LAT_SEND);
+            }
+        }
+        finish = now_ns();
+
+        // each stage from the end of the latest earlier stage that ran
+        unsigned long long prev = release;
+        for (s = 0; s < ST_TOTAL; s++)
+        {
+            unsigned long long stamp = frame ? frame->lat[stage_lat[s]] : 0;
+            if (stamp == 0)
+            {
+                r->usec[s][i] = -1;
+                continue;
+            }
+            r->usec[s][i] = (long long)(stamp - prev)/1000;
+            prev = stamp;
+        }
+        r->usec[ST_TOTAL][i] = (long long)(finish - release)/1000;
+        if (finish - release > deadline_ns) r->misses++;
+        fault_record(finish - release > deadline_ns);
+
+        capture_frame_release(frame);
+    }
+    r->elapsed_s = (now_ns() - start)/1e9;
+    return 0;
+}
+
+static void bench_print(FILE *out, bench_opts_t *opts, int config, bench_result_t *r, int first)
+{
+    long long p50, p99, max;
+    int s, n, first_stage = 1;
+
+    fprintf(out, "%s    {\n", first ? "" : ",\n");
+    fprintf(out, "      \"config\": \"%s\",\n", config_names[config]);
+    fprintf(out, "      \"frames\": %d,\n", opts->frames);
+    fprintf(out, "      \"captured\": %d,\n", r->captured);
+    fprintf(out, "      \"elapsed_s\": %.3f,\n", r->elapsed_s);
+    fprintf(out, "      \"throughput_fps\": %.2f,\n", r->elapsed_s > 0 ? r->captured/r->elapsed_s : 0.0);
+    fprintf(out, "      \"deadline_misses\": %d,\n", r->misses);
+    fprintf(out, "      \"stages_us\": {");
+    for (s = 0; s < ST_NUM; s++)
+    {
+        n = stage_percentiles(r->usec[s], opts->frames, &p50, &p99, &max);
+        if (n == 0) continue;
+        fprintf(out, "%s\n        \"%s\": {\"n\": %d, \"p50\": %lld, \"p99\": %lld, \"max\": %lld}",
+                first_stage ? "" : ",", stage_names[s], n, p50, p99, max);
+        first_stage = 0;
+    }
+    fprintf(out, "\n      }");
+    if (fault_plan.count > 0)
+    {
+        fprintf(out, ",\n      \"faults\": [");
+        for (s = 0; s < fault_plan.count; s++)
+        {
+            const fault_t *ft = &fault_plan.fault[s];
+
+            fprintf(out, "%s\n        {\"fault\": \"%s\", \"site\": \"%s\", \"from_ms\": %.0f, \"to_ms\": %.0f, "
+                    "\"hits\": %llu, \"misses\": %llu, \"misses_after\": %llu, \"recovery_ms\": %.1f}",
+                    s ? "," : "", fault_kind_name(ft->kind), ft->site[0] ? ft->site : "-", ft->from_ns/1e6,
+                    ft->to_ns/1e6, ft->hits, ft->misses, ft->after, ft->recovery_ns/1e6);
+        }
+        fprintf(out, "\n      ]");
+    }
+    fprintf(out, "\n    }");
+}
+
+//*****************************************************************************
+//
+// Main
+//
+//*****************************************************************************
+static void print_usage(char *prog)
+{
+    printf("usage: %s [-c config[,config]...|all] [-n frames] [-r hz] [-D deadline_ms]\n", prog);
+    printf("          [-W width] [-H height] [-s server] [-p port] [-F scenario] [-o file.json]\n");
+    printf("  config is raw, overlay, ppm, compress or send (default all)\n");
+    printf("  -r 0 runs back to back, deadline then defaults to 1000/%d ms\n", BENCH_RATE_HZ);
+    printf("  send goes to an in-process loopback sink unless -s names a server\n");
+    printf("  -F injects the faults of a scenario file into every run, see fault.h\n");
+}
+
+static int parse_configs(bench_opts_t *opts, char *list)
+{
+    char *tok, *save;
+    int c, found;
+
+    memset(opts->configs, 0, sizeof(opts->configs));
+    for (tok = strtok_r(list, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        if (strcmp(tok, "all") == 0)
+        {
+            for (c = 0; c < CFG_NUM; c++) opts->configs[c] = 1;
+            continue;
+        }
+        found = 0;
+        for (c = 0; c < CFG_NUM; c++)
+        {
+            if (strcmp(tok, config_names[c]) == 0)
+            {
+                opts->configs[c] = 1;
+                found = 1;
+            }
+        }
+        if (!found) return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_opts_t opts;
+    bench_result_t result;
+    platform_state_t platform;
+    struct addrinfo hints, *server = NULL;
+    char sink_port[8];
+    FILE *out = stdout;
+    int opt, c, s, first = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.frames = BENCH_FRAMES;
+    opts.rate_hz = BENCH_RATE_HZ;
+    opts.width = 640;
+    opts.height = 480;
+    opts.port = "9000";
+    for (c = 0; c < CFG_NUM; c++) opts.configs[c] = 1;
+
+    while ((opt = getopt(argc, argv, "c:n:r:D:W:H:s:p:F:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (parse_configs(&opts, optarg) < 0)
+                {
+                    printf("Bad config list: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'n': opts.frames = atoi(optarg); break;
+            case 'r': opts.rate_hz = atoi(optarg); break;
+            case 'D': opts.deadline_ms = atof(optarg); break;
+            case 'W': opts.width = atoi(optarg); break;
+            case 'H': opts.height = atoi(optarg); break;
+            case 's': opts.server = optarg; break;
+            case 'p': opts.port = optarg; break;
+            case 'F': opts.faults = optarg; break;
+            case 'o': opts.out = optarg; break;
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (opts.frames <= 0) opts.frames = 1;
+    if (opts.deadline_ms <= 0)
+        opts.deadline_ms = 1000.0/(opts.rate_hz ? opts.rate_hz : BENCH_RATE_HZ);
+    if (opts.faults != NULL && fault_load(opts.faults) < 0) exit(-1);
+
+    capture_set_backend(CAPTURE_BACKEND_SYNTHETIC);
+    capture_set_size(opts.width, opts.height);
+    mkdir(BENCH_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
+
+    if (opts.configs[CFG_SEND])
+    {
+        if (opts.server == NULL)
+        {
+            if (netsink_start(sink_port, sizeof(sink_port)) < 0)
+            {
+                printf("Cannot start the loopback sink\n");
+                exit(-1);
+            }
+            opts.port = sink_port;
+        }
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(opts.server ? opts.server : "127.0.0.1", opts.port, &hints, &server) != 0)
+        {
+            printf("Cannot resolve %s:%s\n", opts.server, opts.port);
+            exit(-1);
+        }
+    }
+
+    if (opts.out != NULL && (out = fopen(opts.out, "w")) == NULL)
+    {
+        perror(opts.out);
+        exit(-1);
+    }
+
+    fprintf(out, "{\n  \"source\": \"synthetic\",\n  \"width\": %d,\n  \"height\": %d,\n", opts.width, opts.height);
+    fprintf(out, "  \"rate_hz\": %d,\n  \"deadline_ms\": %.3f,\n", opts.rate_hz, opts.deadline_ms);
+    // the conditions the numbers were taken under
+    platform_probe(&platform, NULL, 0);
+    fprintf(out, "  \"platform\": ");
+    platform_print_json(out, &platform);
+    fprintf(out, ",\n");
+    if (opts.faults != NULL) fprintf(out, "  \"scenario\": \"%s\",\n", opts.faults);
+    fprintf(out, "  \"runs\": [\n");
+    for (c = 0; c < CFG_NUM; c++)
+    {
+        if (!opts.configs[c]) continue;
+        fprintf(stderr, "bench: %s, %d frames\n", config_names[c], opts.frames);
+        if (bench_run(&opts, c, server, &result) < 0)
+        {
+            printf("Benchmark %s failed\n", config_names[c]);
+            exit(-1);
+        }
+        bench_print(out, &opts, c, &result, first);
+        first = 0;
+        for (s = 0; s < ST_NUM; s++) free(result.usec[s]);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    if (server != NULL) freeaddrinfo(server);
+    return 0;
+}
@@ -24,274 +24,780 @@
 
 // Time related
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+// Directory related
+#include <sys/stat.h>
+
 // name related
 #include <sys/utsname.h>
 
-//#define CAPTURE_APP
-#define PPM_HEADER_SIZE 3
-#define BUF_SIZE 925696
-#define NUM_CPU_CORES 1
-#define DATE_TIME
-#define SEC_MSEC_TIME
-#define NAME
+// V4L2 pixel formats
+#include <linux/videodev2.h>
+
+#include "capture.h"
+#include "framepool.h"
+#include "v4l2cap.h"
+#include "fault.h"
+#include "rtlog.h"
+
+#define JPEG_QUALITY 90
+
+// Frame size asked from a V4L2 device (the driver may pick the closest)
+// and made by the synthetic source, see capture_set_size()
+#define CAPTURE_WIDTH 640
+#define CAPTURE_HEIGHT 480
 
-#define COMMENT_IN_IMAGE
+// Streaming timelapse: MJPG in AVI is built into OpenCV, no ffmpeg needed
+#define TIMELAPSE_RING 4
+#define TIMELAPSE_FPS 30.0
+#define TIMELAPSE_FOURCC 'M','J','P','G'
+#define TIMELAPSE_EXT "avi"
 
 using namespace cv;
-extern "C" int capture_write(int dev, char * filename);
-int capture_write(int dev, char * filename)
+
+//*****************************************************************************
+//
+// Capture session and frame pool
+//
+// Pool buffer layout, every pixel area starts on a page boundary:
+//
+//   | capture_frame_t ... PPM header | RGB pixels (PPM) | BGR pixels |
+//
+// The PPM header is written right-aligned against the RGB pixels.
+//
+//*****************************************************************************
+#define FRAME_PAGE 4096
+#define FRAME_ROUND(size) (((size) + FRAME_PAGE - 1) & ~((size_t)FRAME_PAGE - 1))
+#define FRAME_META_SIZE FRAME_ROUND(sizeof(capture_frame_t) + CAPTURE_PPM_HEADER_MAX)
+
+// The device stays open between captures: opening it allocates and faults
+// far more than a frame grab does. Only the first call (warm-up) pays for it.
+static VideoCapture cap;
+static int cap_dev = -1;
+static int capture_backend = CAPTURE_BACKEND_OPENCV;
+static v4l2cap_t v4l2 = { -1 };
+static unsigned long long capture_v4l2_copied = 0;
+static unsigned long long capture_v4l2_lost = 0;
+static unsigned int capture_v4l2_next_seq = 0;
+static int capture_req_width = CAPTURE_WIDTH;
+static int capture_req_height = CAPTURE_HEIGHT;
+static int capture_overlay_fields = CAPTURE_OVERLAY_DEFAULT;
+static Mat synthetic_base;
+
+static framepool_t capture_pool;
+static bool capture_pool_ready = false;
+static int capture_width = 0;
+static int capture_height = 0;
+static unsigned long long capture_count = 0;
+static unsigned long long capture_dropped = 0;
+
+extern "C" int capture_set_backend(int backend)
 {
-    VideoCapture cap(dev); // open the default camera
-    if(!cap.isOpened())  // check if we succeeded
+    if(backend != CAPTURE_BACKEND_OPENCV && backend != CAPTURE_BACKEND_V4L2 &&
+       backend != CAPTURE_BACKEND_SYNTHETIC)
     {
-        printf("Device is not opened\n");
         return -1;
     }
+    capture_backend = backend;
+    return 0;
+}
 
-    Mat frame;
-    Mat frame_resized;
-    cap >> frame; // get a new frame from camera
+extern "C" void capture_set_size(int width, int height)
+{
+    capture_req_width = width;
+    capture_req_height = height;
+}
 
+extern "C" int capture_set_overlay(int fields)
+{
+    if(fields & ~CAPTURE_OVERLAY_ALL)
+    {
+        return -1;
+    }
+    capture_overlay_fields = fields;
+    return 0;
+}
 
-    bool retval = false; 
-    // resize image down to 320x240
-    // resize(frame, frame_resized, Size(320,240), 0.5, 0.5,INTER_LINEAR);
+// "date,sec,name,comment", "all" or "none"
+extern "C" int capture_parse_overlay(const char *list)
+{
+    static const struct { const char *name; int field; } names[] =
+    {
+        {"date", CAPTURE_OVERLAY_DATE_TIME},
+        {"sec", CAPTURE_OVERLAY_SEC_MSEC},
+        {"name", CAPTURE_OVERLAY_NAME},
+        {"comment", CAPTURE_OVERLAY_COMMENT},
+        {"all", CAPTURE_OVERLAY_ALL},
+        {"none", 0},
+    };
+    int fields = 0;
+    const char *p = list;
+
+    while(*p != '\0')
+    {
+        size_t len = strcspn(p, ",");
+        size_t i;
+        for(i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+        {
+            if(strlen(names[i].name) == len && strncmp(p, names[i].name, len) == 0)
+            {
+                fields |= names[i].field;
+                break;
+            }
+        }
+        if(i == sizeof(names)/sizeof(names[0]))
+        {
+            return -1;
+        }
+        p += len;
+        if(*p == ',') p++;
+    }
+    return fields;
+}
 
-    /* Add timestamp directly in image */
-    struct tm *tmp ;
-    char MY_TIME[128];
-    char MY_SUB_TIME[40];
-    char MY_NAME_BUF[128];
-    struct timeval current_time_val;
-    gettimeofday(&current_time_val, (struct timezone *)0);
+static int capture_pool_init(void)
+{
+    if(capture_pool_ready)
+    {
+        return 0;
+    }
+    size_t pixels = FRAME_ROUND((size_t)capture_width*capture_height*3);
+    if(framepool_init(&capture_pool, CAPTURE_POOL_FRAMES, FRAME_META_SIZE + 2*pixels) < 0)
+    {
+        return -1;
+    }
+    capture_pool_ready = true;
+    return 0;
+}
 
+static int capture_open_v4l2(int dev)
+{
+    if(v4l2.fd >= 0 && cap_dev == dev)
+    {
+        return 0;
+    }
+    v4l2cap_close(&v4l2);
+    if(v4l2cap_open(&v4l2, dev, capture_req_width, capture_req_height) < 0)
+    {
+        printf("Device is not opened\n");
+        return -1;
+    }
+    if(capture_pool_ready && (v4l2.width != capture_width || v4l2.height != capture_height))
+    {
+        // the pool buffers are sized for the old geometry, do not stream into them
+        printf("Frame size changed\n");
+        v4l2cap_close(&v4l2);
+        cap_dev = -1;
+        return -1;
+    }
+    cap_dev = dev;
+    capture_width = v4l2.width;
+    capture_height = v4l2.height;
+    return capture_pool_init();
+}
 
+// Synthetic source for benchmarks and machines without a camera: a fixed
+// noisy gradient, made once, with a bar that moves every frame so encoders
+// and frame differences see changing content
+static int capture_open_synthetic(void)
+{
+    if(!synthetic_base.empty())
+    {
+        return 0;
+    }
+    capture_width = capture_req_width;
+    capture_height = capture_req_height;
+    synthetic_base.create(capture_height, capture_width, CV_8UC3);
+    for(int y = 0; y < capture_height; y++)
+    {
+        Vec3b *row = synthetic_base.ptr<Vec3b>(y);
+        for(int x = 0; x < capture_width; x++)
+        {
+            row[x] = Vec3b(x*255/capture_width, y*255/capture_height, 128);
+        }
+    }
+    Mat noise(capture_height, capture_width, CV_8UC3);
+    randu(noise, Scalar::all(0), Scalar::all(32));
+    synthetic_base += noise;
+    return capture_pool_init();
+}
 
+static void capture_grab_synthetic(capture_frame_t *f)
+{
+    Mat frame(f->height, f->width, CV_8UC3, f->bgr);
+    synthetic_base.copyTo(frame);
+    int bar = f->width/16;
+    int x = (int)((capture_count*8) % (unsigned long long)(f->width - bar));
+    rectangle(frame, Rect(x, 0, bar, f->height), Scalar(0, 0, 255), FILLED);
+}
 
-#ifdef DATE_TIME
-    tmp = localtime( &(current_time_val.tv_sec));
-    // using strftime to display time
-    strftime(MY_TIME, sizeof(MY_TIME), "#timestamp:%a, %d %b %Y %T %z \n", tmp);
-    size_t str_size = strlen(MY_TIME);
-    putText(frame,MY_TIME,Point(10, 40),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);  
-#endif
+static int capture_open(int dev)
+{
+    if(capture_backend == CAPTURE_BACKEND_V4L2)
+    {
+        return capture_open_v4l2(dev);
+    }
+    if(capture_backend == CAPTURE_BACKEND_SYNTHETIC)
+    {
+        return capture_open_synthetic();
+    }
+    if(cap.isOpened() && cap_dev == dev)
+    {
+        return 0;
+    }
+    cap.release();
+    cap.open(dev); // open the default camera
+    if(!cap.isOpened())  // check if we succeeded
+    {
+        printf("Device is not opened\n");
+        return -1;
+    }
+    // keep the driver queue short so a grab is never several frames old
+    cap.set(CAP_PROP_BUFFERSIZE, 1);
+    cap_dev = dev;
 
+    if(capture_pool_ready == false)
+    {
+        // one grab to learn the frame size, then size the pool for it
+        Mat probe;
+        cap >> probe;
+        if(probe.empty())
+        {
+            printf("Cannot grab a first frame\n");
+            // no pool yet, the next call must not take the early return
+            cap.release();
+            cap_dev = -1;
+            return -1;
+        }
+        capture_width = probe.cols;
+        capture_height = probe.rows;
+        return capture_pool_init();
+    }
+    return 0;
+}
+
+static capture_frame_t *frame_alloc(void)
+{
+    char *buf = (char *)framepool_get(&capture_pool);
+    if(buf == NULL)
+    {
+        return NULL;
+    }
+    size_t pixels = FRAME_ROUND((size_t)capture_width*capture_height*3);
+    capture_frame_t *f = (capture_frame_t *)buf;
+    f->width = capture_width;
+    f->height = capture_height;
+    f->rgb = (unsigned char *)buf + FRAME_META_SIZE;
+    f->bgr = f->rgb + pixels;
+    f->ppm = NULL;
+    f->ppm_len = 0;
+    f->buf_index = -1;
+    // not a frame until capture_frame() stamps it, see capture_frame_release()
+    f->seq = ~0ULL;
+    timerclear(&f->time);
+    timerclear(&f->driver_time);
+    f->driver_seq = 0;
+    memset(f->lat, 0, sizeof(f->lat));
+    f->release = 0;
+    f->deadline = 0;
+    return f;
+}
 
-#ifdef SEC_MSEC_TIME
-    // using strftime to display time
-    sprintf(MY_SUB_TIME, "# sec=%d, msec=%d\n",(int)current_time_val.tv_sec,(int)current_time_val.tv_usec/1000);
-    size_t str_sub_size = strlen(MY_SUB_TIME);
-    putText(frame,MY_SUB_TIME,Point(10, 80),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);  
-#endif
+extern "C" void capture_frame_ref(capture_frame_t *frame)
+{
+    framepool_ref(&capture_pool, frame);
+}
 
-#ifdef NAME
-    struct utsname MY_NAME;
-    uname(&MY_NAME);
-    sprintf(MY_NAME_BUF, "# %s \n",MY_NAME.nodename);
-    size_t str_name_size = strlen(MY_NAME_BUF);
-    putText(frame,MY_NAME_BUF,Point(10, 120),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);  
-#endif
+extern "C" void capture_frame_release(capture_frame_t *frame)
+{
+    if(frame == NULL)
+    {
+        return;
+    }
+    // read before the put, the pool buffer may be reused right after it;
+    // only the holder whose put drops the count to 0 commits the stamps
+    int buf_index = frame->buf_index;
+    unsigned long long seq = frame->seq, release = frame->release, deadline = frame->deadline;
+    struct timeval time = frame->time;
+    unsigned long long lat[LAT_NUM_STAGES];
+    memcpy(lat, frame->lat, sizeof(lat));
+    if(framepool_put(&capture_pool, frame) == 0)
+    {
+        // a buffer given back before the dequeue stamp (failed grab, size
+        // change, dropped frame) has the seq of no frame, its row is left alone
+        if(lat[LAT_DEQUEUE] != 0)
+            latency_commit(seq, time.tv_sec, time.tv_usec, lat, release, deadline);
+        if(buf_index >= 0)
+        {
+            // last user of a zero-copy frame, the driver can fill it again
+            v4l2cap_queue(&v4l2, buf_index);
+        }
+    }
+}
 
+extern "C" void capture_print_stats(void)
+{
+    printf("Capture: %llu frames, %llu dropped (no free buffer or an injected drop fault)\n",
+           capture_count, capture_dropped);
+    if(capture_backend == CAPTURE_BACKEND_V4L2)
+    {
+        printf("V4L2: %llu frames copied out to keep the driver queue full, %llu lost by the driver\n",
+               capture_v4l2_copied, capture_v4l2_lost);
+    }
+    if(capture_pool_ready)
+    {
+        framepool_print_stats(&capture_pool, "Frame");
+    }
+}
 
+//*****************************************************************************
+//
+// PPM writer: the header (with the comment lines) is already in front of the
+// pixel area, so building the file is one colour swap and saving it is one
+// write(), no imwrite plus read-back and rewrite.
+//
+//*****************************************************************************
+extern "C" void capture_ppm_header(capture_frame_t *f, const char *comments)
+{
+    char header[CAPTURE_PPM_HEADER_MAX];
+    int len = snprintf(header, sizeof(header), "P6\n%s%d %d\n255\n",
+                       comments, f->width, f->height);
+    if(len >= (int)sizeof(header))
+    {
+        // comments too long for the reserved space, keep the image valid
+        len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", f->width, f->height);
+    }
+    f->ppm = (char *)f->rgb - len;
+    memcpy(f->ppm, header, len);
+}
 
-    // write image to file
-    retval = imwrite(filename, frame);// save image to file
-    if (retval == false)
+extern "C" int capture_frame_ppm(capture_frame_t *frame)
+{
+    if(frame->ppm_len != 0)
     {
-        //printf("Save image failed\n");
-        return -1;
+        return 0;
     }
-    //printf("Resized image saved \n");
+    Mat bgr(frame->height, frame->width, CV_8UC3, frame->bgr);
+    Mat rgb(frame->height, frame->width, CV_8UC3, frame->rgb);
+    cvtColor(bgr, rgb, COLOR_BGR2RGB);
+    frame->ppm_len = ((char *)frame->rgb - frame->ppm) + (size_t)frame->width*frame->height*3;
+    return 0;
+}
 
-    /* Add timestamp directly as a comment in image */
-             
-#ifdef COMMENT_IN_IMAGE
-    /* open cap.ppm */
+extern "C" int capture_ppm_write(capture_frame_t *frame, const char * filename)
+{
+    fault_inject(FAULT_IO, "write");
     int fd = open(filename,
-            O_RDONLY/*|O_APPEND*/,
+            O_WRONLY|O_CREAT|O_TRUNC,
             S_IRWXU|S_IRWXG|S_IRWXO);
     if (fd < 0)
     {
         perror("Cannot open file");
-    }
-    // create a buffer for reading message
-    void * local_buf = malloc(BUF_SIZE);
-    if (local_buf == NULL)
-    {
-        perror("cannot malloc this much memory");
+        return -1;
     }
 
-    /* Read from /var/tmp/cap.ppm */
-    int num_read = 1;
-    bool EOF_flag = false;
-    ssize_t read_size;
-    ssize_t total_read_size;// assume ssize_t never overflow
-    while(EOF_flag==false)
+    size_t written = 0;
+    while(written < frame->ppm_len)
     {
-        // receive
-        read_size = read(fd, (((char *)local_buf)+(num_read-1)*BUF_SIZE), (size_t) BUF_SIZE);
-        // update total_size
-        total_read_size = ((num_read-1)*BUF_SIZE)+read_size;
-        // check if read '\n'
-        if(read_size < BUF_SIZE)
+        ssize_t write_size = write(fd, frame->ppm + written, frame->ppm_len - written);
+        if(write_size <= 0)
         {
-            EOF_flag = true;
-        }
-        else
-        {
-            num_read++;
-            local_buf = realloc(local_buf,num_read*BUF_SIZE);
-            if (local_buf == NULL)
-            {
-                perror("cannot realloc this much memory");
-            }
+            // Use errno to print error
+            perror("ppm write error");
+            close(fd);
+            return -1;
         }
+        written += write_size;
     }
-    //local_buf = realloc(local_buf,total_read_size);
-    //ERROR_CHECK_NULL(local_buf);
+
     int error_code = close(fd);
     if (error_code != 0)
     {
         perror("close file error");
     }
+    return 0;
+}
 
-    /* open image file at /var/tmp/cap_stamped.ppm */
-    fd = open(filename,
-            O_WRONLY|O_CREAT/*|O_APPEND*/,
-            S_IRWXU|S_IRWXG|S_IRWXO);
-    if (fd < 0)
+//*****************************************************************************
+//
+// Capture
+//
+//*****************************************************************************
+
+// Driver timestamps are CLOCK_MONOTONIC, move them onto the wall clock used
+// for the overlay and the logs
+static void v4l2_wall_time(const struct timeval *driver, struct timeval *wall)
+{
+    struct timespec mono;
+    struct timeval now, mono_now, age;
+
+    if(!v4l2.ts_monotonic)
     {
-        perror("Cannot open file");
+        *wall = *driver;
+        return;
     }
+    gettimeofday(&now, (struct timezone *)0);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    mono_now.tv_sec = mono.tv_sec;
+    mono_now.tv_usec = mono.tv_nsec/1000;
+    timersub(&mono_now, driver, &age);
+    timersub(&now, &age, wall);
+}
 
-    ssize_t write_size;
-    // write to /var/tmp/cap_stamped.ppm
-    write_size = write(fd, local_buf, (size_t) PPM_HEADER_SIZE);
-    // Check for error
-    if (write_size != PPM_HEADER_SIZE)
+// Grab from the V4L2 ring. A BGR24 frame is used in place and its driver
+// buffer stays out until the last reference to the frame is dropped, unless
+// that would leave the driver short of buffers. Anything else is converted
+// into the pool buffer and requeued at once.
+static int capture_grab_v4l2(capture_frame_t *f)
+{
+    v4l2cap_buf_t buf;
+
+    if(v4l2cap_dequeue(&v4l2, &buf) < 0)
+    {
+        return -1;
+    }
+    if(buf.sequence != capture_v4l2_next_seq && capture_count != 0)
     {
-        // Use errno to print error
-        perror("PPM Header write error");
+        capture_v4l2_lost += buf.sequence - capture_v4l2_next_seq;
     }
-#ifdef DATE_TIME
-    // using strftime to display time
-    write_size = write(fd, MY_TIME, (size_t) str_size);
-    // Check for error
-    if (write_size != str_size)
+    capture_v4l2_next_seq = buf.sequence + 1;
+    f->driver_time = buf.timestamp;
+    f->driver_seq = buf.sequence;
+    if(v4l2.ts_monotonic)
     {
-        // Use errno to print error
-        perror("timestamp write error");
-        //exit(1);
+        f->lat[LAT_DRIVER] = (unsigned long long)buf.timestamp.tv_sec*1000000000ULL + buf.timestamp.tv_usec*1000ULL;
     }
-#endif
 
-#ifdef SEC_MSEC_TIME
-    // using strftime to display sub time
-    write_size = write(fd, MY_SUB_TIME, (size_t) str_sub_size);
-    // Check for error
-    if (write_size != str_sub_size)
+    Mat bgr(f->height, f->width, CV_8UC3, f->bgr);
+    switch(v4l2.pixelformat)
     {
-        // Use errno to print error
-        perror("timestamp write error");
-        //exit(1);
+        case V4L2_PIX_FMT_BGR24:
+            if(v4l2.queued >= V4L2CAP_MIN_QUEUED && v4l2.bytesperline == (unsigned int)f->width*3)
+            {
+                f->bgr = buf.data;
+                f->buf_index = buf.index;
+                return 0;
+            }
+            capture_v4l2_copied++;
+            Mat(f->height, f->width, CV_8UC3, buf.data, v4l2.bytesperline).copyTo(bgr);
+            break;
+        case V4L2_PIX_FMT_RGB24:
+            cvtColor(Mat(f->height, f->width, CV_8UC3, buf.data, v4l2.bytesperline), bgr, COLOR_RGB2BGR);
+            break;
+        case V4L2_PIX_FMT_YUYV:
+            cvtColor(Mat(f->height, f->width, CV_8UC2, buf.data, v4l2.bytesperline), bgr, COLOR_YUV2BGR_YUYV);
+            break;
     }
-#endif
+    return v4l2cap_queue(&v4l2, buf.index);
+}
 
-#ifdef NAME
-    // using strftime to display sub time
-    write_size = write(fd, MY_NAME_BUF, str_name_size);
-    // Check for error
-    if (write_size != str_name_size)
+//*****************************************************************************
+//
+// Overlay: one kernel per field set. Fields is a template constant, so every
+// test on it folds away and each specialization only contains the work of
+// its own fields, like the old DATE_TIME/SEC_MSEC_TIME/NAME/COMMENT_IN_IMAGE
+// builds, while the field set is still chosen at startup.
+//
+//*****************************************************************************
+typedef void (*stamp_overlay_fn)(Mat &frame, const struct timeval *current_time_val, char *comments);
+
+// Host name line, read once: it does not change while we run
+static const char *overlay_name(void)
+{
+    static char MY_NAME_BUF[128];
+    if(MY_NAME_BUF[0] == '\0')
     {
-        // Use errno to print error
-        perror("timestamp write error");
-        //exit(1);
+        struct utsname MY_NAME;
+        uname(&MY_NAME);
+        snprintf(MY_NAME_BUF, sizeof(MY_NAME_BUF), "# %s \n", MY_NAME.nodename);
     }
-#endif
+    return MY_NAME_BUF;
+}
 
+// Stamp the time and host name on the frame, and collect the same text as
+// PPM comment lines
+template <int Fields>
+static void stamp_overlay(Mat &frame, const struct timeval *current_time_val, char *comments)
+{
+    const bool comment = (Fields & CAPTURE_OVERLAY_COMMENT) != 0;
+    char *end = comments;
 
-    write_size = write(fd, ((char *)local_buf)+PPM_HEADER_SIZE, (size_t) total_read_size-PPM_HEADER_SIZE);
-    // Check for error
-    if (write_size < total_read_size-PPM_HEADER_SIZE)
+    if(Fields & CAPTURE_OVERLAY_DATE_TIME)
     {
-        // Use errno to print error
-        perror("ppm write error");
-        //exit(1);
+        char MY_TIME[128];
+        struct tm tmp;
+        localtime_r(&current_time_val->tv_sec, &tmp);
+        // using strftime to display time
+        size_t len = strftime(MY_TIME, sizeof(MY_TIME), "#timestamp:%a, %d %b %Y %T %z \n", &tmp);
+        putText(frame,MY_TIME,Point(10, 40),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);
+        if(comment)
+        {
+            memcpy(end, MY_TIME, len + 1);
+            end += len;
+        }
     }
 
+    if(Fields & CAPTURE_OVERLAY_SEC_MSEC)
+    {
+        char MY_SUB_TIME[40];
+        int len = sprintf(MY_SUB_TIME, "# sec=%d, msec=%d\n",(int)current_time_val->tv_sec,(int)current_time_val->tv_usec/1000);
+        putText(frame,MY_SUB_TIME,Point(10, 80),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);
+        if(comment)
+        {
+            memcpy(end, MY_SUB_TIME, len + 1);
+            end += len;
+        }
+    }
 
+    if(Fields & CAPTURE_OVERLAY_NAME)
+    {
+        const char *MY_NAME_BUF = overlay_name();
+        size_t len = strlen(MY_NAME_BUF);
+        putText(frame,MY_NAME_BUF,Point(10, 120),FONT_HERSHEY_SIMPLEX,0.8,Scalar(255, 255, 255),2);
+        if(comment)
+        {
+            memcpy(end, MY_NAME_BUF, len + 1);
+            end += len;
+        }
+    }
+}
 
+// Every field set, indexed by its bit mask
+static const stamp_overlay_fn stamp_overlay_table[CAPTURE_OVERLAY_ALL + 1] =
+{
+    stamp_overlay<0>,  stamp_overlay<1>,  stamp_overlay<2>,  stamp_overlay<3>,
+    stamp_overlay<4>,  stamp_overlay<5>,  stamp_overlay<6>,  stamp_overlay<7>,
+    stamp_overlay<8>,  stamp_overlay<9>,  stamp_overlay<10>, stamp_overlay<11>,
+    stamp_overlay<12>, stamp_overlay<13>, stamp_overlay<14>, stamp_overlay<15>,
+};
+static_assert(CAPTURE_OVERLAY_ALL == 15, "stamp_overlay_table covers 4 fields");
+
+// Capture and stamp one frame into a pool buffer, and save it as PPM when a
+// filename is given. The caller owns one reference to the returned frame.
+extern "C" capture_frame_t *capture_frame(int dev, char * filename)
+{
+    if(capture_open(dev) < 0)
+    {
+        return NULL;
+    }
 
+    capture_frame_t *f = frame_alloc();
+    if(f == NULL)
+    {
+        capture_dropped++;
+        rtlog(LOG_ERR, "Frame pool exhausted, frame dropped");
+        return NULL;
+    }
 
-    error_code = close(fd);
-    if (error_code != 0)
+    struct timeval current_time_val;
+    if(capture_backend == CAPTURE_BACKEND_V4L2)
     {
-        perror("close file error");
+        if(capture_grab_v4l2(f) < 0)
+        {
+            capture_frame_release(f);
+            return NULL;
+        }
+        // stamp the exposure time, not the time the frame reached us
+        v4l2_wall_time(&f->driver_time, &current_time_val);
+    }
+    else if(capture_backend == CAPTURE_BACKEND_SYNTHETIC)
+    {
+        capture_grab_synthetic(f);
+        gettimeofday(&current_time_val, (struct timezone *)0);
     }
-#endif
+    else
+    {
+        // the Mat header wraps pooled memory, a grab of the same size fills it in place
+        Mat grab(f->height, f->width, CV_8UC3, f->bgr);
+        cap >> grab; // get a new frame from camera
+        if(grab.data != f->bgr)
+        {
+            printf("Frame size changed, frame dropped\n");
+            capture_frame_release(f);
+            return NULL;
+        }
+        gettimeofday(&current_time_val, (struct timezone *)0);
+    }
+    if(fault_inject(FAULT_DROP, "capture"))
+    {
+        // counted here and in the fault's hits only: not dequeued yet, so the
+        // release commits no latency row for it
+        capture_dropped++;
+        capture_frame_release(f);
+        return NULL;
+    }
+    latency_mark(f->lat, LAT_DEQUEUE);
+    Mat frame(f->height, f->width, CV_8UC3, f->bgr);
+
+    char comments[CAPTURE_PPM_HEADER_MAX];
+    f->time = current_time_val;
+    f->seq = capture_count++;
+    comments[0] = '\0';
+    stamp_overlay_table[capture_overlay_fields](frame, &current_time_val, comments);
+
+    /* Add timestamp directly as a comment in image */
+    capture_ppm_header(f, comments);
+    latency_mark(f->lat, LAT_OVERLAY);
+
+    if (filename != NULL)
+    {
+        // write image to file
+        capture_frame_ppm(f);
+        if (capture_ppm_write(f, filename) < 0)
+        {
+            capture_frame_release(f);
+            return NULL;
+        }
+        latency_mark(f->lat, LAT_FILE_WRITE);
+    }
+
+    return f;
+}
 
-    // the camera will be deinitialized automatically in VideoCapture destructor
+extern "C" int capture_write(int dev, char * filename);
+int capture_write(int dev, char * filename)
+{
+    capture_frame_t *f = capture_frame(dev, filename);
+    if (f == NULL)
+    {
+        return -1;
+    }
+    capture_frame_release(f);
     return 0;
 }
 
+/* Encode a captured frame as JPEG, runs on the compression worker pool */
+extern "C" int compress_frame(capture_frame_t * f, char * dst_filename)
+{
+    Mat frame(f->height, f->width, CV_8UC3, f->bgr);
+
+    std::vector<int> params;
+    params.push_back(IMWRITE_JPEG_QUALITY);
+    params.push_back(JPEG_QUALITY);
+    if(imwrite(dst_filename, frame, params) == false)
+    {
+        printf("Cannot write %s\n", dst_filename);
+        return -1;
+    }
+    latency_mark(f->lat, LAT_ENCODE);
+    return 0;
+}
 
-void print_scheduler(void);
+//*****************************************************************************
+//
+// Streaming timelapse writer
+//
+// The RT capture only takes a reference on the frame and parks it in a ring
+// slot; the worker pool appends slots to the video in capture order. A new
+// file is started at each local day boundary, so the daily video needs no
+// post-processing pass.
+//
+//*****************************************************************************
+typedef struct timelapse_slot
+{
+    capture_frame_t *frame;
+    volatile bool busy;
+}timelapse_slot_t;
+
+static timelapse_slot_t timelapse_ring[TIMELAPSE_RING];
+static unsigned int timelapse_next = 0;
+static VideoWriter timelapse_writer;
+static char timelapse_dir[64];
+static int timelapse_yday = -1;
+static bool timelapse_enabled = false;
+static unsigned long long timelapse_frames = 0;
+
+extern "C" int timelapse_open(const char * dir)
+{
+    if (mkdir(dir, S_IRWXU|S_IRWXG|S_IRWXO) != 0 && errno != EEXIST)
+    {
+        perror("Cannot create timelapse directory");
+        return -1;
+    }
+    strncpy(timelapse_dir, dir, sizeof(timelapse_dir)-1);
+    timelapse_enabled = true;
+    // the file itself is opened on the first frame, once the size is known
+    return 0;
+}
 
-#ifdef CAPTURE_APP
-int main( int argc, char** argv )
+/* Called from the RT service right after the capture, returns the slot */
+extern "C" int timelapse_stage(capture_frame_t *frame)
 {
-    int dev=0;
+    if (timelapse_enabled == false || frame == NULL)
+    {
+        return -1;
+    }
 
-    if(argc > 1)
+    timelapse_slot_t *slot = &timelapse_ring[timelapse_next];
+    if (slot->busy)
     {
-        // use /dev/video<#>
-        sscanf(argv[1], "%d", &dev);
-        printf("using %s\n", argv[1]);
+        // encoder is a full ring behind, drop this frame
+        return -1;
     }
-    else if(argc == 1)
-        // use default /dev/video0
-        printf("using default\n");
+    capture_frame_ref(frame);
+    slot->frame = frame;
+    slot->busy = true;
 
-    else
+    int idx = timelapse_next;
+    timelapse_next = (timelapse_next + 1) % TIMELAPSE_RING;
+    return idx;
+}
+
+static int timelapse_roll(time_t sec, Size size)
+{
+    struct tm tm_now;
+    char name[128];
+
+    localtime_r(&sec, &tm_now);
+    if (timelapse_writer.isOpened() && tm_now.tm_yday == timelapse_yday)
     {
-        // specific usage
-        printf("usage: capture [dev]\n");
-        exit(-1);
+        return 0;
     }
-    printf("Start Capture and write\n");
-    int retval = -1;
-    char filename[] = "cap.ppm";
-    retval = capture_write(dev, filename);
-    if (retval < 0)
+    timelapse_writer.release();
+
+    // time of day in the name so a restart never overwrites the day so far
+    snprintf(name, sizeof(name), "%s/timelapse_%04d%02d%02d_%02d%02d%02d.%s",
+            timelapse_dir, tm_now.tm_year+1900, tm_now.tm_mon+1, tm_now.tm_mday,
+            tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec, TIMELAPSE_EXT);
+    if (!timelapse_writer.open(name, VideoWriter::fourcc(TIMELAPSE_FOURCC), TIMELAPSE_FPS, size, true))
     {
-        printf("error in capture_write function\n");
+        printf("Cannot open timelapse %s\n", name);
         return -1;
     }
-    // the camera will be deinitialized automatically in VideoCapture destructor
+    timelapse_yday = tm_now.tm_yday;
+    syslog(LOG_USER, "Timelapse started: %s", name);
     return 0;
 }
-#endif
 
-void print_scheduler(void)
+/* Encode one staged frame, must be called in capture order */
+extern "C" void timelapse_append(int slot)
 {
-   int schedType;
-
-   schedType = sched_getscheduler(getpid());
-
-   switch(schedType)
-   {
-       case SCHED_FIFO:
-           printf("Pthread Policy is SCHED_FIFO\n");
-           break;
-       case SCHED_OTHER:
-           printf("Pthread Policy is SCHED_OTHER\n"); exit(-1);
-         break;
-       case SCHED_RR:
-           printf("Pthread Policy is SCHED_RR\n"); exit(-1);
-           break;
-       default:
-           printf("Pthread Policy is UNKNOWN\n"); exit(-1);
-   }
+    timelapse_slot_t *s = &timelapse_ring[slot];
+    capture_frame_t *f = s->frame;
+    Mat frame(f->height, f->width, CV_8UC3, f->bgr);
+
+    if (timelapse_roll(f->time.tv_sec, frame.size()) == 0)
+    {
+        timelapse_writer.write(frame);
+        timelapse_frames++;
+    }
+    timelapse_drop(slot);
 }
+
+extern "C" void timelapse_drop(int slot)
+{
+    capture_frame_release(timelapse_ring[slot].frame);
+    timelapse_ring[slot].frame = NULL;
+    __sync_synchronize();
+    timelapse_ring[slot].busy = false;
+}
+
+extern "C" void timelapse_close(void)
+{
+    timelapse_writer.release();
+    timelapse_enabled = false;
+    printf("Timelapse: %llu frames written\n", timelapse_frames);
+}
+
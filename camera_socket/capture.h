@@ -0,0 +1,86 @@
+/*
+ *
+ *  C interface of the capture library (capture.cpp)
+ *  Most added work done by Chutao
+ *
+ *  Frames live in a reference counted buffer pool. Each pool buffer holds
+ *  the frame description below, the BGR pixels (wrapped by a cv::Mat header
+ *  inside the library) and room for the PPM file image, whose header is
+ *  written right in front of its RGB pixels so the whole file is one
+ *  contiguous block for write() and send().
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "latency.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_POOL_FRAMES (16)
+#define CAPTURE_PPM_HEADER_MAX (512)    // "P6\n", comments and "<w> <h>\n255\n", room in front of rgb
+
+// capture_set_backend(), call before the first capture
+#define CAPTURE_BACKEND_OPENCV  (0)     // cv::VideoCapture
+#define CAPTURE_BACKEND_V4L2    (1)     // native V4L2 mmap streaming, see v4l2cap.h
+#define CAPTURE_BACKEND_SYNTHETIC (2)   // generated frames, no camera needed
+
+// Overlay fields, capture_set_overlay(), call before the first capture
+#define CAPTURE_OVERLAY_DATE_TIME   (1<<0)  // "#timestamp:<date>" line
+#define CAPTURE_OVERLAY_SEC_MSEC    (1<<1)  // "# sec=, msec=" line
+#define CAPTURE_OVERLAY_NAME        (1<<2)  // host name line
+#define CAPTURE_OVERLAY_COMMENT     (1<<3)  // same lines as PPM comments
+#define CAPTURE_OVERLAY_ALL         (0xF)
+#define CAPTURE_OVERLAY_DEFAULT     CAPTURE_OVERLAY_ALL
+
+typedef struct capture_frame
+{
+    unsigned long long seq;     // frame number, capture count unless the caller sets it
+    struct timeval time;        // time stamped on the frame, exposure time with V4L2
+    struct timeval driver_time; // raw V4L2 timestamp (CLOCK_MONOTONIC), 0 with OpenCV
+    unsigned int driver_seq;    // V4L2 frame counter
+    int width;
+    int height;
+    unsigned char *bgr;         // pixels as captured and stamped
+    unsigned char *rgb;         // PPM pixel area
+    char *ppm;                  // start of the PPM file image
+    size_t ppm_len;             // 0 until the PPM image is built
+    int buf_index;              // V4L2 buffer bgr points into, -1 when bgr is in the pool
+    unsigned long long lat[LAT_NUM_STAGES];   // stage stamps, see latency.h
+    unsigned long long release; // CLOCK_MONOTONIC ns of the job that captured it, 0 = none
+    unsigned long long deadline;// end-to-end deadline, same clock, set with release
+}capture_frame_t;
+
+int capture_set_backend(int backend);
+void capture_set_size(int width, int height);   // V4L2 and synthetic, default 640x480
+int capture_set_overlay(int fields);            // CAPTURE_OVERLAY_* mask
+int capture_parse_overlay(const char *list);    // "date,sec,name,comment|all|none" to a mask
+capture_frame_t *capture_frame(int dev, char * filename);
+int capture_frame_ppm(capture_frame_t *frame);
+// The PPM writer capture_frame() uses, also for frames outside the pool (the
+// benchmarks): the header goes in the CAPTURE_PPM_HEADER_MAX bytes in front
+// of rgb, capture_frame_ppm() fills the pixels, the write is one block
+void capture_ppm_header(capture_frame_t *frame, const char *comments);
+int capture_ppm_write(capture_frame_t *frame, const char * filename);
+void capture_frame_ref(capture_frame_t *frame);
+void capture_frame_release(capture_frame_t *frame);
+void capture_print_stats(void);
+
+int capture_write(int dev, char * filename);
+int compress_frame(capture_frame_t *frame, char * dst_filename);
+
+int timelapse_open(const char * dir);
+int timelapse_stage(capture_frame_t *frame);
+void timelapse_append(int slot);
+void timelapse_drop(int slot);
+void timelapse_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,337 @@
+/*
+ *
+ *  capture: command line front end of the capture library
+ *  Most added work done by Chutao
+ *
+ *  Replaces the CAPTURE_APP mains that camera/, simple_camera/ and test_c/
+ *  each carried in their own copy of capture.cpp. Every directory now
+ *  builds this file against the one library in camera_socket/ through the
+ *  C interface in capture.h, so it gets the persistent session, the frame
+ *  pool and the fast PPM writer like the sequencer does.
+ *
+ *  capture [dev] still grabs one frame from /dev/video<dev> into cap.ppm.
+ *
+ *  capture -s streams instead: frames are grabbed back to back, so at the
+ *  camera's own rate, with no sequencer in between. Every k-th frame (-k) is
+ *  kept in a small ring of held frames, like a pipeline consumer would hold
+ *  them, and saved when -o is given; the rest go back to the pool at once.
+ *  The run reports the achieved frame rate and the frames lost on the way,
+ *  which is the throughput ceiling of the sensor and capture path alone.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "capture.h"
+#include "latency.h"
+
+#define CAPTURE_APP_FILE "cap.ppm"
+#define STREAM_SECONDS 10           // default length of a -s run
+#define STREAM_RING 4               // kept frames held at once, less than the pool
+#define STREAM_MAX_INTERVALS 65536  // frame intervals kept for the statistics
+
+typedef struct capture_opts
+{
+    int dev;
+    int backend;
+    int width;
+    int height;
+    int frames;
+    const char *out;        // PPM file, numbered when more than one frame
+    const char *jpeg;       // also encode each frame as JPEG, numbered likewise
+    int stream;             // free running capture, see capture_stream()
+    int seconds;            // stream length when no frame count is given
+    int decimate;           // keep one frame in decimate
+    int save;               // -o given, streams only write files when asked
+}capture_opts_t;
+
+static volatile sig_atomic_t stream_stop = 0;
+
+static void print_usage(char *prog)
+{
+    printf("usage: %s [-b opencv|v4l2|synthetic] [-W width] [-H height] [-O fields]\n", prog);
+    printf("          [-n frames] [-o file.ppm] [-j file.jpg] [dev]\n");
+    printf("  dev is the /dev/video<dev> number (default 0)\n");
+    printf("  -O is date,sec,name,comment, all or none (default all)\n");
+    printf("  with -n above 1 the files are numbered, cap.ppm becomes cap_000000.ppm ...\n");
+    printf("       %s -s [-t seconds] [-k keep_every] [options above]\n", prog);
+    printf("  streams at the camera rate for -n frames or -t seconds (default %d),\n", STREAM_SECONDS);
+    printf("  keeps one frame in k and saves it only with -o, reports fps and lost frames\n");
+}
+
+static int parse_backend(const char *name)
+{
+    if (strcmp(name, "opencv") == 0) return CAPTURE_BACKEND_OPENCV;
+    if (strcmp(name, "v4l2") == 0) return CAPTURE_BACKEND_V4L2;
+    if (strcmp(name, "synthetic") == 0) return CAPTURE_BACKEND_SYNTHETIC;
+    return -1;
+}
+
+// "dir/cap.ppm", 12 -> "dir/cap_000012.ppm"
+static void numbered_name(char *dst, size_t len, const char *name, unsigned long long seq)
+{
+    const char *slash = strrchr(name, '/');
+    const char *dot = strrchr(name, '.');
+
+    if (dot == NULL || (slash != NULL && dot < slash))
+        dot = name + strlen(name);
+    snprintf(dst, len, "%.*s_%06llu%s", (int)(dot - name), name, seq, dot);
+}
+
+static int capture_run(const capture_opts_t *opts)
+{
+    char filename[256], jpeg_name[256];
+    capture_frame_t *f;
+    int i, failed = 0;
+
+    for (i = 0; i < opts->frames; i++)
+    {
+        if (opts->frames == 1)
+            snprintf(filename, sizeof(filename), "%s", opts->out);
+        else
+            numbered_name(filename, sizeof(filename), opts->out, i);
+
+        f = capture_frame(opts->dev, filename);
+        if (f == NULL)
+        {
+            failed++;
+            continue;
+        }
+        if (opts->jpeg != NULL)
+        {
+            if (opts->frames == 1)
+                snprintf(jpeg_name, sizeof(jpeg_name), "%s", opts->jpeg);
+            else
+                numbered_name(jpeg_name, sizeof(jpeg_name), opts->jpeg, i);
+            if (compress_frame(f, jpeg_name) < 0) failed++;
+        }
+        capture_frame_release(f);
+    }
+    return failed;
+}
+
+//*****************************************************************************
+//
+// Streaming
+//
+//*****************************************************************************
+static void stream_sigint(int sig)
+{
+    (void)sig;
+    stream_stop = 1;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Exposure time when the driver gives one, else the time the frame reached us
+static unsigned long long frame_stamp(const capture_frame_t *f)
+{
+    return f->lat[LAT_DRIVER] ? f->lat[LAT_DRIVER] : f->lat[LAT_DEQUEUE];
+}
+
+static int capture_stream(const capture_opts_t *opts)
+{
+    capture_frame_t *ring[STREAM_RING] = { NULL };
+    unsigned long long *intervals;
+    unsigned long long first = 0, last = 0, now, stop, period;
+    unsigned long long frames = 0, kept = 0, failed = 0, lost = 0, estimated = 0;
+    unsigned long long count = 0, idx;
+    unsigned int next_seq = 0;
+    char filename[256], jpeg_name[256];
+    double elapsed;
+    capture_frame_t *f;
+    int slot = 0, keep, i;
+
+    intervals = malloc(STREAM_MAX_INTERVALS*sizeof(*intervals));
+    if (intervals == NULL)
+    {
+        perror("stream intervals");
+        return -1;
+    }
+    signal(SIGINT, stream_sigint);
+    stop = latency_now() + (unsigned long long)opts->seconds*1000000000ULL;
+
+    while (!stream_stop)
+    {
+        now = latency_now();
+        if (opts->frames > 0 ? frames >= (unsigned long long)opts->frames : now >= stop)
+            break;
+
+        idx = frames++;
+        keep = (idx % opts->decimate) == 0;
+        if (keep && opts->save)
+            numbered_name(filename, sizeof(filename), opts->out, idx);
+        f = capture_frame(opts->dev, keep && opts->save ? filename : NULL);
+        if (f == NULL)
+        {
+            failed++;
+            continue;
+        }
+
+        now = frame_stamp(f);
+        if (count == 0)
+        {
+            first = now;
+        }
+        else
+        {
+            if (count - 1 < STREAM_MAX_INTERVALS)
+                intervals[count - 1] = now - last;
+            // the driver numbers every frame it sees, a gap is a lost frame
+            if (f->lat[LAT_DRIVER] != 0 && f->driver_seq != next_seq)
+                lost += f->driver_seq - next_seq;
+        }
+        next_seq = f->driver_seq + 1;
+        last = now;
+        count++;
+
+        if (!keep)
+        {
+            capture_frame_release(f);
+            continue;
+        }
+        if (opts->jpeg != NULL)
+        {
+            numbered_name(jpeg_name, sizeof(jpeg_name), opts->jpeg, idx);
+            if (compress_frame(f, jpeg_name) < 0) failed++;
+        }
+        // hold the frame until the ring comes round to it again
+        capture_frame_release(ring[slot]);
+        ring[slot] = f;
+        slot = (slot + 1) % STREAM_RING;
+        kept++;
+    }
+    signal(SIGINT, SIG_DFL);
+    for (i = 0; i < STREAM_RING; i++)
+        capture_frame_release(ring[i]);
+
+    printf("Stream: %llu frames, %llu kept (1 in %d), %llu failed\n",
+           count, kept, opts->decimate, failed);
+    if (count < 2)
+    {
+        free(intervals);
+        return failed > 0 ? -1 : 0;
+    }
+
+    elapsed = (last - first)/1e9;
+    unsigned long long n = count - 1 < STREAM_MAX_INTERVALS ? count - 1 : STREAM_MAX_INTERVALS;
+    qsort(intervals, n, sizeof(*intervals), cmp_ull);
+    // the camera period is the typical interval, a longer one hides lost frames
+    period = intervals[n/2];
+    for (i = 0; (unsigned long long)i < n; i++)
+    {
+        if (period > 0 && intervals[i] >= period + period/2)
+            estimated += (intervals[i] + period/2)/period - 1;
+    }
+    printf("Stream: %.2f fps achieved over %.3f s, camera period %.3f ms (%.2f fps)\n",
+           (count - 1)/elapsed, elapsed, period/1e6, period > 0 ? 1e9/period : 0.0);
+    printf("Stream: interval min %.3f p50 %.3f p99 %.3f max %.3f ms\n",
+           intervals[0]/1e6, intervals[n/2]/1e6, intervals[(n*99)/100]/1e6, intervals[n - 1]/1e6);
+    printf("Stream: %llu frames dropped by the driver, %llu missing from the intervals\n",
+           lost, estimated);
+    free(intervals);
+    return failed > 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    capture_opts_t opts;
+    struct timeval start_timeval, end_timeval;
+    int opt, fields, failed;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.backend = CAPTURE_BACKEND_OPENCV;
+    opts.out = CAPTURE_APP_FILE;
+    opts.seconds = STREAM_SECONDS;
+    opts.decimate = 1;
+
+    while ((opt = getopt(argc, argv, "b:W:H:O:n:o:j:st:k:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                if ((opts.backend = parse_backend(optarg)) < 0)
+                {
+                    printf("Unknown capture backend: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'W': opts.width = atoi(optarg); break;
+            case 'H': opts.height = atoi(optarg); break;
+            case 'O':
+                if ((fields = capture_parse_overlay(optarg)) < 0)
+                {
+                    printf("Bad overlay field list: %s\n", optarg);
+                    exit(-1);
+                }
+                capture_set_overlay(fields);
+                break;
+            case 'n': opts.frames = atoi(optarg); break;
+            case 'o': opts.out = optarg; opts.save = 1; break;
+            case 'j': opts.jpeg = optarg; break;
+            case 's': opts.stream = 1; break;
+            case 't': opts.seconds = atoi(optarg); break;
+            case 'k': opts.decimate = atoi(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (optind < argc)
+    {
+        // use /dev/video<#>
+        if (sscanf(argv[optind], "%d", &opts.dev) != 1 || optind + 1 < argc)
+        {
+            print_usage(argv[0]);
+            exit(-1);
+        }
+        printf("using /dev/video%d\n", opts.dev);
+    }
+    else
+    {
+        printf("using default\n");
+    }
+    // one frame by default, a stream runs for its time unless -n is given
+    if (opts.frames <= 0) opts.frames = opts.stream ? 0 : 1;
+    if (opts.decimate <= 0) opts.decimate = 1;
+    if (opts.seconds <= 0) opts.seconds = STREAM_SECONDS;
+
+    capture_set_backend(opts.backend);
+    if (opts.width > 0 && opts.height > 0)
+        capture_set_size(opts.width, opts.height);
+
+    printf("Start Capture and write\n");
+    gettimeofday(&start_timeval, (struct timezone *)0);
+    if (opts.stream)
+        failed = capture_stream(&opts) < 0;
+    else
+        failed = capture_run(&opts);
+    gettimeofday(&end_timeval, (struct timezone *)0);
+
+    syslog(LOG_CRIT, "Cap sta time @ sec=%d, msec=%d\n", (int)start_timeval.tv_sec, (int)start_timeval.tv_usec/1000);
+    syslog(LOG_CRIT, "Cap end time @ sec=%d, msec=%d\n", (int)end_timeval.tv_sec, (int)end_timeval.tv_usec/1000);
+
+    if (opts.stream || opts.frames > 1)
+    {
+        capture_print_stats();
+        latency_print_summary();
+    }
+    if (failed > 0)
+    {
+        if (opts.stream)
+            printf("error in capture: stream had failed frames\n");
+        else
+            printf("error in capture: %d of %d frames failed\n", failed, opts.frames);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+# Name: capture_app.mk
+# Description: capture app and library build shared by camera/, simple_camera/
+#              and test_c/, whose makefiles only include this file. Paths are
+#              relative to the including directory.
+# Toolchain: gcc compiler version 7.4.0
+
+
+CROSS_COMPILE =# Cross compile option for arm-unknown-linux-gnueabi-
+
+include ../profiles.mk
+
+ifeq ($(CC),)
+	CC = $(CROSS_COMPILE)gcc
+endif
+
+ifeq ($(LD),)
+	LD = ld  # Linker
+endif
+
+ifeq ($(CCFLAGS),)
+	CCFLAGS = -Wall -Werror $(PROFILE_LDFLAGS)
+endif
+
+# compile flags of the build profile, see profiles.mk
+CFLAGS += -Wall -Werror $(PROFILE_CFLAGS)
+CXXFLAGS += -Wall -Werror $(PROFILE_CFLAGS)
+
+ifeq ($(LDFLAGS),)
+	LDFLAGS = -pthread -lrt
+endif
+
+# The capture app and library sources live in camera_socket/, the including
+# directory only builds them, see camera_socket/capture_app.c. The object list
+# is CAPTURE_LIB_OBJ of camera_socket/makefile plus the app
+CAPTURE_DIR = ../camera_socket
+VPATH = $(CAPTURE_DIR)
+
+DEPS = capture.h framepool.h v4l2cap.h latency.h rtlock.h fault.h rttrace.h rtlog.h # header files
+OBJ = capture_app.o capture.o framepool.o v4l2cap.o latency.o rtlock.o fault.o rttrace.o rtlog.o
+CPPLIBS= -lopencv_core -lopencv_flann -lopencv_video
+TARGET = capture
+
+
+all: $(TARGET)
+
+
+capture: $(OBJ)
+	$(CC) $(CCFLAGS) -o $@ $^ $(LDFLAGS) -lstdc++ `pkg-config --libs opencv` $(CPPLIBS) 
+
+# every object is rebuilt when one of the headers changes
+%.o: %.c $(DEPS)
+	$(CC) $(CFLAGS) -c -o $@ $<
+
+%.o: %.cpp $(DEPS)
+	$(CXX) $(CXXFLAGS) -c -o $@ $<
+
+clean:
+	-rm -f capture  *.o *.s *.d
+
+#.c.o:
+#	$(CC) $(CCFLAGS) -c $<
+
+#.cpp.o:
+#	$(CC) $(CCFLAGS) -lstdc++ -c $<
@@ -0,0 +1,184 @@
+/*
+ *
+ *  Cyclic executive, see cyclic.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cyclic.h"
+#include "latency.h"
+#include "rtlog.h"
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0)
+    {
+        unsigned int t = a % b;
+
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void cyclic_init(cyclic_t *c)
+{
+    memset(c, 0, sizeof(cyclic_t));
+}
+
+// in rate monotonic order, the shortest period first
+int cyclic_add(cyclic_t *c, const char *name, unsigned int period_ms, cyclic_fn fn, rtsched_stats_t *stats)
+{
+    cyclic_service_t *s;
+
+    if (c->count == CYCLIC_MAX_SERVICES || period_ms == 0) return -1;
+    s = &c->svc[c->count++];
+    s->name = name;
+    s->period_ms = period_ms;
+    s->fn = fn;
+    s->stats = stats;
+    return 0;
+}
+
+int cyclic_build(cyclic_t *c)
+{
+    unsigned long long major;
+    int i, f;
+
+    if (c->count == 0) return -1;
+    c->minor_ms = c->svc[0].period_ms;
+    major = c->svc[0].period_ms;
+    for (i = 1; i < c->count; i++)
+    {
+        c->minor_ms = gcd(c->minor_ms, c->svc[i].period_ms);
+        major = major/gcd(major, c->svc[i].period_ms)*c->svc[i].period_ms;
+        if (major/c->minor_ms > CYCLIC_MAX_FRAMES) break;
+    }
+    if (major/c->minor_ms > CYCLIC_MAX_FRAMES)
+    {
+        printf("cyclic: major frame needs more than %d minor frames\n", CYCLIC_MAX_FRAMES);
+        return -1;
+    }
+    c->major_ms = (unsigned int)major;
+    c->frames = (int)(major/c->minor_ms);
+
+    for (f = 0; f < c->frames; f++)
+    {
+        c->table_len[f] = 0;
+        for (i = 0; i < c->count; i++)
+            if ((f*c->minor_ms) % c->svc[i].period_ms == 0)
+                c->table[f][c->table_len[f]++] = (unsigned char)i;
+    }
+    return 0;
+}
+
+void cyclic_print_table(const cyclic_t *c)
+{
+    int f, k;
+
+    printf("Cyclic executive: minor frame %u ms, major frame %u ms (%d frames)\n", c->minor_ms, c->major_ms, c->frames);
+    for (f = 0; f < c->frames; f++)
+    {
+        if (c->table_len[f] == 0) continue;
+        printf("  %4u ms:", f*c->minor_ms);
+        for (k = 0; k < c->table_len[f]; k++) printf(" %s", c->svc[c->table[f][k]].name);
+        printf("\n");
+    }
+}
+
+//*****************************************************************************
+//
+// Executive
+//
+//*****************************************************************************
+static void timespec_add_ns(struct timespec *t, unsigned long long ns)
+{
+    t->tv_sec += ns/1000000000ULL;
+    t->tv_nsec += ns%1000000000ULL;
+    if (t->tv_nsec >= 1000000000L)
+    {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+static void cyclic_skip(cyclic_t *c, unsigned long long frame, unsigned long long count, rtsched_stats_t *frame_stats)
+{
+    unsigned long long f;
+    int k;
+
+    for (f = frame; f < frame + count; f++)
+    {
+        int slot = (int)(f % c->frames);
+
+        for (k = 0; k < c->table_len[slot]; k++)
+        {
+            cyclic_service_t *s = &c->svc[c->table[slot][k]];
+
+            s->skipped++;
+            if (s->stats != NULL) rtsched_stats_skip(s->stats, 1);
+        }
+    }
+    if (frame_stats != NULL) rtsched_stats_skip(frame_stats, count);
+    c->frames_skipped += count;
+}
+
+void cyclic_run(cyclic_t *c, unsigned long long count, volatile int *stop, rtsched_stats_t *frame_stats)
+{
+    unsigned long long minor_ns = c->minor_ms*1000000ULL;
+    unsigned long long f, start, now;
+    struct timespec next;
+    int k;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    start = latency_now();
+    for (f = 0; f < count && !*stop; f++)
+    {
+        int slot = (int)(f % c->frames);
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        if (frame_stats != NULL) rtsched_stats_begin(frame_stats);
+        for (k = 0; k < c->table_len[slot]; k++)
+        {
+            cyclic_service_t *s = &c->svc[c->table[slot][k]];
+
+            s->fn(s->jobs++);
+        }
+        if (frame_stats != NULL) rtsched_stats_end(frame_stats);
+        c->frames_run++;
+
+        // frame f+1 starts at start + (f+1)*minor
+        timespec_add_ns(&next, minor_ns);
+        now = latency_now();
+        if (now > start + (f + 1)*minor_ns)
+        {
+            // windows that have already closed are skipped, the current one runs late
+            unsigned long long behind = (now - start)/minor_ns - (f + 1);
+
+            c->frame_overruns++;
+            if (behind > 0)
+            {
+                if (behind > count - f - 1) behind = count - f - 1;
+                rtlog(LOG_WARNING, "cyclic: frame %llu overran, %llu frame(s) skipped", f, behind);
+                cyclic_skip(c, f + 1, behind, frame_stats);
+                timespec_add_ns(&next, behind*minor_ns);
+                f += behind;
+            }
+            else
+                rtlog(LOG_WARNING, "cyclic: frame %llu overran into the next", f);
+        }
+    }
+}
+
+void cyclic_print_stats(const cyclic_t *c)
+{
+    int i;
+
+    printf("Cyclic executive: %llu minor frames run, %llu overran, %llu skipped\n", c->frames_run,
+           c->frame_overruns, c->frames_skipped);
+    for (i = 0; i < c->count; i++)
+        printf("  %-4s T %u ms  jobs %llu  skipped %llu\n", c->svc[i].name, c->svc[i].period_ms,
+               c->svc[i].jobs, c->svc[i].skipped);
+}
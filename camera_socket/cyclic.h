@@ -0,0 +1,71 @@
+/*
+ *
+ *  Cyclic executive
+ *  Most added work done by Chutao
+ *
+ *  The thread per service design pays a semaphore post, a wake up and a
+ *  context switch for every release. For light services at high rates the
+ *  whole set can instead run in one pinned RT thread from a static table:
+ *
+ *      minor frame  gcd of the service periods, the executive sleeps to the
+ *                   start of each one (clock_nanosleep, TIMER_ABSTIME)
+ *      major frame  lcm of the periods, the table repeats after it
+ *
+ *  Frame k lists every service whose period divides k*minor, in the order
+ *  they were added (rate monotonic order, so the same order the priorities
+ *  give). Each call is timed with the same rtsched statistics the threaded
+ *  modes use. A frame that runs into the next one starts the next late; a
+ *  frame whose whole window has already passed is skipped rather than run
+ *  back to back, and its releases are counted as skipped.
+ */
+#ifndef CYCLIC_H
+#define CYCLIC_H
+
+#include "rtsched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CYCLIC_MAX_SERVICES (8)
+#define CYCLIC_MAX_FRAMES   (256)   // minor frames in a major frame
+
+typedef void (*cyclic_fn)(unsigned long long job);
+
+typedef struct cyclic_service
+{
+    const char *name;
+    unsigned int period_ms;
+    cyclic_fn fn;
+    rtsched_stats_t *stats;         // may be NULL
+    unsigned long long jobs;        // calls so far, handed to fn
+    unsigned long long skipped;
+}cyclic_service_t;
+
+typedef struct cyclic
+{
+    cyclic_service_t svc[CYCLIC_MAX_SERVICES];
+    int count;
+    unsigned int minor_ms;
+    unsigned int major_ms;
+    int frames;
+    unsigned char table[CYCLIC_MAX_FRAMES][CYCLIC_MAX_SERVICES];
+    int table_len[CYCLIC_MAX_FRAMES];
+    unsigned long long frames_run;
+    unsigned long long frame_overruns;  // frames that ran into the next one
+    unsigned long long frames_skipped;
+}cyclic_t;
+
+void cyclic_init(cyclic_t *c);
+int cyclic_add(cyclic_t *c, const char *name, unsigned int period_ms, cyclic_fn fn, rtsched_stats_t *stats);
+int cyclic_build(cyclic_t *c);
+void cyclic_print_table(const cyclic_t *c);
+// runs minor frames until count or *stop, frame_stats times each minor frame
+void cyclic_run(cyclic_t *c, unsigned long long count, volatile int *stop, rtsched_stats_t *frame_stats);
+void cyclic_print_stats(const cyclic_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CYCLIC_H */
@@ -0,0 +1,697 @@
+/*
+ *
+ *  Asynchronous frame storage, see diskwriter.h
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DISKWRITER_HAVE_URING
+#endif
+#endif
+
+#include "diskwriter.h"
+#include "latency.h"
+#include "fault.h"
+
+#define DISKWRITER_ALIGN (4096)     // O_DIRECT buffer, offset and length alignment
+#define PREOPEN_EMPTY (-1)         // preopen_fd of a free slot
+#define PREOPEN_TAKEN (-2)         // preopen_fd while its frame is being written
+#define DISKWRITER_ROUND(size) (((size) + DISKWRITER_ALIGN - 1) & ~((size_t)DISKWRITER_ALIGN - 1))
+
+//*****************************************************************************
+//
+// Job ring: one producer (the RT service), any number of consumers
+//
+//*****************************************************************************
+
+// Never blocks and never allocates, safe from an RT thread
+int diskwriter_submit(diskwriter_t *w, unsigned long long seq, const void *data, size_t len, void *arg)
+{
+    unsigned int tail = w->tail;
+    unsigned int head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+    diskwriter_job_t *job;
+
+    if (tail - head >= DISKWRITER_QUEUE)
+    {
+        __atomic_fetch_add(&w->stats.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    job = &w->jobs[tail % DISKWRITER_QUEUE];
+    job->seq = seq;
+    job->data = data;
+    job->len = len;
+    job->arg = arg;
+    job->queued = latency_now();
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&w->stats.submitted, 1, __ATOMIC_RELAXED);
+    if (tail + 1 - head > w->stats.max_queued)
+        w->stats.max_queued = tail + 1 - head;
+    sem_post(&w->work_sem);
+    return 0;
+}
+
+// Takes the oldest job, 0 when the ring is empty. Call after a work_sem count.
+static int job_take(diskwriter_t *w, diskwriter_job_t *job)
+{
+    unsigned int head;
+
+    pthread_mutex_lock(&w->head_lock);
+    head = w->head;
+    if (head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&w->head_lock);
+        return 0;
+    }
+    *job = w->jobs[head % DISKWRITER_QUEUE];
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&w->head_lock);
+    return 1;
+}
+
+static void job_finish(diskwriter_t *w, diskwriter_job_t *job, int err)
+{
+    unsigned long long lat = latency_now() - job->queued;
+
+    pthread_mutex_lock(&w->stats_lock);
+    if (err == 0)
+    {
+        w->stats.written++;
+        w->stats.bytes += job->len;
+    }
+    else
+    {
+        w->stats.failed++;
+    }
+    w->stats.lat_sum_ns += lat;
+    if (lat > w->stats.lat_max_ns) w->stats.lat_max_ns = lat;
+    pthread_mutex_unlock(&w->stats_lock);
+
+    if (err != 0)
+        syslog(LOG_ERR, "diskwriter: frame %llu not saved: %s", job->seq, strerror(err));
+    if (w->done != NULL) w->done(job->arg, err);
+}
+
+//*****************************************************************************
+//
+// Files, opened ahead of the frames that will need them
+//
+//*****************************************************************************
+static int file_open_now(diskwriter_t *w, unsigned long long seq)
+{
+    char path[DISKWRITER_PATH_MAX + 32];
+    int flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+    int fd;
+
+    snprintf(path, sizeof(path), w->pattern, seq);
+    if (w->flags & DISKWRITER_DIRECT) flags |= O_DIRECT;
+    fd = open(path, flags, S_IRWXU|S_IRWXG|S_IRWXO);
+    if (fd < 0 && errno == EINVAL && (w->flags & DISKWRITER_DIRECT))
+    {
+        // tmpfs and a few others refuse O_DIRECT, the page cache it is
+        syslog(LOG_WARNING, "diskwriter: O_DIRECT not supported for %s, writing buffered", path);
+        w->flags &= ~DISKWRITER_DIRECT;
+        fd = open(path, flags & ~O_DIRECT, S_IRWXU|S_IRWXG|S_IRWXO);
+    }
+    return fd;
+}
+
+// A file opened ahead for a frame that never came is empty, remove it
+static void file_discard(diskwriter_t *w, unsigned long long seq, int fd)
+{
+    char path[DISKWRITER_PATH_MAX + 32];
+
+    close(fd);
+    snprintf(path, sizeof(path), w->pattern, seq);
+    unlink(path);
+}
+
+// Open the files of the frames after seq, dropping any left behind. A slot
+// whose file is being written (PREOPEN_TAKEN) must not be opened again, the
+// O_TRUNC would cut the frame short.
+static void preopen_fill(diskwriter_t *w, unsigned long long seq)
+{
+    unsigned long long s;
+    int slot;
+
+    pthread_mutex_lock(&w->preopen_lock);
+    for (s = seq + 1; s <= seq + DISKWRITER_PREOPEN; s++)
+    {
+        slot = s % DISKWRITER_PREOPEN;
+        if (w->preopen_fd[slot] != PREOPEN_EMPTY && w->preopen_seq[slot] >= s) continue;
+        if (w->preopen_fd[slot] >= 0)
+            file_discard(w, w->preopen_seq[slot], w->preopen_fd[slot]);
+        w->preopen_fd[slot] = file_open_now(w, s);
+        w->preopen_seq[slot] = s;
+        if (w->preopen_fd[slot] < 0) w->preopen_fd[slot] = PREOPEN_EMPTY;
+    }
+    pthread_mutex_unlock(&w->preopen_lock);
+}
+
+static int file_open(diskwriter_t *w, unsigned long long seq)
+{
+    int slot = seq % DISKWRITER_PREOPEN;
+    int fd = PREOPEN_EMPTY;
+
+    // a stalled card holds up the writer, not the service that queued the frame
+    fault_inject(FAULT_IO, "write");
+    pthread_mutex_lock(&w->preopen_lock);
+    if (w->preopen_fd[slot] >= 0 && w->preopen_seq[slot] == seq)
+    {
+        fd = w->preopen_fd[slot];
+        w->preopen_fd[slot] = PREOPEN_TAKEN;
+    }
+    else if (w->preopen_fd[slot] == PREOPEN_EMPTY || w->preopen_seq[slot] < seq)
+    {
+        // frames were skipped, what the slot holds is older than this one
+        if (w->preopen_fd[slot] >= 0)
+            file_discard(w, w->preopen_seq[slot], w->preopen_fd[slot]);
+        w->preopen_fd[slot] = PREOPEN_TAKEN;
+        w->preopen_seq[slot] = seq;
+    }
+    pthread_mutex_unlock(&w->preopen_lock);
+
+    if (fd >= 0)
+    {
+        pthread_mutex_lock(&w->stats_lock);
+        w->stats.preopened++;
+        pthread_mutex_unlock(&w->stats_lock);
+        return fd;
+    }
+    return file_open_now(w, seq);
+}
+
+// Where the write comes from: the caller's buffer, or the staging buffer
+// with O_DIRECT. Returns the length to write.
+static size_t job_buffer(diskwriter_t *w, int fd, diskwriter_job_t *job, unsigned char *stage,
+                         const void **buf)
+{
+    int fl;
+
+    if (!(w->flags & DISKWRITER_DIRECT) || (fl = fcntl(fd, F_GETFL)) < 0 || !(fl & O_DIRECT))
+    {
+        *buf = job->data;
+        return job->len;
+    }
+    if (DISKWRITER_ROUND(job->len) > DISKWRITER_STAGE_SIZE)
+    {
+        // larger than the staging buffer, this one goes through the page cache
+        fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+        *buf = job->data;
+        return job->len;
+    }
+    memcpy(stage, job->data, job->len);
+    memset(stage + job->len, 0, DISKWRITER_ROUND(job->len) - job->len);
+    *buf = stage;
+    return DISKWRITER_ROUND(job->len);
+}
+
+// Padding written for O_DIRECT is cut off, then sync and close
+static int file_close(int fd, diskwriter_job_t *job, size_t written, int err, int sync)
+{
+    if (err == 0 && written != job->len && ftruncate(fd, job->len) < 0) err = errno;
+    if (err == 0 && sync && fsync(fd) < 0) err = errno;
+    if (close(fd) < 0 && err == 0) err = errno;
+    return err;
+}
+
+//*****************************************************************************
+//
+// Thread engine: blocking pwrite(), one job per thread at a time
+//
+//*****************************************************************************
+static void *pool_thread(void *arg)
+{
+    diskwriter_t *w = ((diskwriter_thread_t *)arg)->w;
+    unsigned char *stage = w->stage[((diskwriter_thread_t *)arg)->idx];
+    diskwriter_job_t job;
+    const void *buf;
+    size_t len, done;
+    ssize_t n;
+    int fd, err;
+
+    for (;;)
+    {
+        sem_wait(&w->work_sem);
+        if (!job_take(w, &job))
+        {
+            if (w->stop) break;
+            continue;
+        }
+        err = 0;
+        done = 0;
+        len = 0;
+        if ((fd = file_open(w, job.seq)) < 0)
+        {
+            job_finish(w, &job, errno);
+            continue;
+        }
+        len = job_buffer(w, fd, &job, stage, &buf);
+        while (done < len)
+        {
+            n = pwrite(fd, (const char *)buf + done, len - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+            {
+                err = n < 0 ? errno : EIO;
+                break;
+            }
+            done += n;
+        }
+        err = file_close(fd, &job, done, err, w->flags & DISKWRITER_SYNC);
+        job_finish(w, &job, err);
+        preopen_fill(w, job.seq);
+    }
+    return NULL;
+}
+
+//*****************************************************************************
+//
+// io_uring engine: one thread keeps DISKWRITER_INFLIGHT writes going, the
+// next buffer is staged while the previous one is on its way to the disk.
+// Raw syscalls, no liburing on the target.
+//
+//*****************************************************************************
+#ifdef DISKWRITER_HAVE_URING
+struct diskwriter_uring
+{
+    int fd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned int to_submit;
+};
+
+typedef struct uring_slot
+{
+    int busy;
+    int syncing;                // the write is done, the fsync is in flight
+    int fd;
+    diskwriter_job_t job;
+    const void *buf;
+    size_t len;
+    size_t done;
+}uring_slot_t;
+
+static int uring_setup(struct diskwriter_uring *u, unsigned int entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) return -1;
+    // IORING_OP_WRITE came with 5.6, the same release as this feature bit
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(u->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    u->sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned int);
+    u->cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+        u->cq_len = u->sq_len;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) goto fail_fd;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ptr = u->sq_ptr;
+    else
+    {
+        u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) goto fail_sq;
+    }
+    u->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) goto fail_cq;
+
+    u->sq_head = (unsigned int *)((char *)u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+    u->to_submit = 0;
+    return 0;
+
+fail_cq:
+    if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+fail_sq:
+    munmap(u->sq_ptr, u->sq_len);
+fail_fd:
+    close(u->fd);
+    return -1;
+}
+
+static void uring_teardown(struct diskwriter_uring *u)
+{
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+    munmap(u->sq_ptr, u->sq_len);
+    close(u->fd);
+}
+
+// The ring has room: there are never more entries out than slots
+static void uring_queue(struct diskwriter_uring *u, int op, int slot, uring_slot_t *s)
+{
+    unsigned int tail = *u->sq_tail;
+    unsigned int idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = s->fd;
+    if (op == IORING_OP_WRITE)
+    {
+        sqe->addr = (unsigned long)((const char *)s->buf + s->done);
+        sqe->len = s->len - s->done;
+        sqe->off = s->done;
+    }
+    sqe->user_data = slot;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+static int uring_enter(struct diskwriter_uring *u, unsigned int wait)
+{
+    int ret = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0) return errno == EINTR ? 0 : -1;
+    u->to_submit -= ret;
+    return 0;
+}
+
+static void uring_slot_done(diskwriter_t *w, uring_slot_t *s, int err)
+{
+    // the fsync, when asked for, already went through the ring
+    err = file_close(s->fd, &s->job, s->done, err, 0);
+    job_finish(w, &s->job, err);
+    preopen_fill(w, s->job.seq);
+    s->busy = 0;
+}
+
+static void *uring_thread(void *arg)
+{
+    diskwriter_t *w = (diskwriter_t *)arg;
+    struct diskwriter_uring *u = w->uring;
+    uring_slot_t slots[DISKWRITER_INFLIGHT];
+    int i, busy = 0, free_slot, stopping = 0;
+
+    memset(slots, 0, sizeof(slots));
+    for (;;)
+    {
+        // stage and queue new writes while a slot is free
+        for (;;)
+        {
+            for (free_slot = -1, i = 0; i < DISKWRITER_INFLIGHT; i++)
+                if (!slots[i].busy) { free_slot = i; break; }
+            if (free_slot < 0) break;
+            if (busy > 0 || stopping ? sem_trywait(&w->work_sem) < 0 : sem_wait(&w->work_sem) < 0)
+                break;
+
+            uring_slot_t *s = &slots[free_slot];
+            if (!job_take(w, &s->job))
+            {
+                // only the stop wake-up finds the ring empty
+                if (w->stop) stopping = 1;
+                continue;
+            }
+            if ((s->fd = file_open(w, s->job.seq)) < 0)
+            {
+                job_finish(w, &s->job, errno);
+                continue;
+            }
+            s->len = job_buffer(w, s->fd, &s->job, w->stage[free_slot], &s->buf);
+            s->done = 0;
+            s->syncing = 0;
+            s->busy = 1;
+            busy++;
+            uring_queue(u, IORING_OP_WRITE, free_slot, s);
+        }
+        if (busy == 0)
+        {
+            if (stopping) break;
+            continue;
+        }
+
+        // wait for one completion, taking whatever else is ready
+        if (uring_enter(u, 1) < 0)
+        {
+            syslog(LOG_ERR, "diskwriter: io_uring_enter: %s", strerror(errno));
+            continue;
+        }
+        unsigned int head = *u->cq_head;
+        while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            uring_slot_t *s = &slots[cqe->user_data];
+            int res = cqe->res;
+            head++;
+            __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+            if (res < 0)
+            {
+                uring_slot_done(w, s, -res);
+                busy--;
+            }
+            else if (s->syncing)
+            {
+                uring_slot_done(w, s, 0);
+                busy--;
+            }
+            else
+            {
+                s->done += res;
+                if (res > 0 && s->done < s->len)
+                    uring_queue(u, IORING_OP_WRITE, cqe->user_data, s);      // short write
+                else if (res == 0)
+                {
+                    uring_slot_done(w, s, EIO);
+                    busy--;
+                }
+                else if (w->flags & DISKWRITER_SYNC)
+                {
+                    s->syncing = 1;
+                    uring_queue(u, IORING_OP_FSYNC, cqe->user_data, s);
+                }
+                else
+                {
+                    uring_slot_done(w, s, 0);
+                    busy--;
+                }
+            }
+        }
+        if (u->to_submit > 0) uring_enter(u, 0);
+    }
+    return NULL;
+}
+#endif
+
+//*****************************************************************************
+//
+// Setup
+//
+//*****************************************************************************
+int diskwriter_init(diskwriter_t *w, const char *pattern, int engine, int flags,
+                    diskwriter_done_fn done, cpu_set_t *cpus)
+{
+    struct sched_param param;
+    pthread_attr_t attr;
+    int i, n, rc = 0;
+
+    memset(w, 0, sizeof(diskwriter_t));
+    snprintf(w->pattern, sizeof(w->pattern), "%s", pattern);
+    w->flags = flags;
+    w->done = done;
+    pthread_mutex_init(&w->head_lock, NULL);
+    pthread_mutex_init(&w->preopen_lock, NULL);
+    pthread_mutex_init(&w->stats_lock, NULL);
+    sem_init(&w->work_sem, 0, 0);
+    for (i = 0; i < DISKWRITER_PREOPEN; i++)
+        w->preopen_fd[i] = PREOPEN_EMPTY;
+
+    n = sizeof(w->stage)/sizeof(w->stage[0]);
+    for (i = 0; i < n && (flags & DISKWRITER_DIRECT); i++)
+    {
+        if (posix_memalign((void **)&w->stage[i], DISKWRITER_ALIGN, DISKWRITER_STAGE_SIZE) != 0)
+            return -1;
+        // fault the staging buffers in now, not on the first frame
+        memset(w->stage[i], 0, DISKWRITER_STAGE_SIZE);
+    }
+
+#ifdef DISKWRITER_HAVE_URING
+    if (engine != DISKWRITER_POOL)
+    {
+        w->uring = malloc(sizeof(struct diskwriter_uring));
+        if (w->uring != NULL && uring_setup(w->uring, DISKWRITER_INFLIGHT*2) == 0)
+        {
+            w->engine = DISKWRITER_URING;
+        }
+        else
+        {
+            if (engine == DISKWRITER_URING)
+                printf("diskwriter: io_uring unavailable (%s), using threads\n", strerror(errno));
+            free(w->uring);
+            w->uring = NULL;
+        }
+    }
+#else
+    if (engine == DISKWRITER_URING)
+        printf("diskwriter: built without io_uring, using threads\n");
+#endif
+    if (w->engine == 0) w->engine = DISKWRITER_POOL;
+
+    // the first frames find their files already open
+    preopen_fill(w, (unsigned long long)-1);
+
+    // storage is best effort like the worker pool: off the RT cores, SCHED_OTHER
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    if (cpus != NULL && CPU_COUNT(cpus) > 0)
+    {
+        rc = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+        if (rc != 0) printf("diskwriter: cannot set affinity (%s)\n", strerror(rc));
+    }
+
+#ifdef DISKWRITER_HAVE_URING
+    if (w->engine == DISKWRITER_URING)
+    {
+        rc = pthread_create(&w->threads[0], &attr, uring_thread, w);
+        w->num_threads = rc == 0 ? 1 : 0;
+    }
+    else
+#endif
+    for (i = 0; i < DISKWRITER_THREADS; i++)
+    {
+        w->thread_args[i].w = w;
+        w->thread_args[i].idx = i;
+        rc = pthread_create(&w->threads[i], &attr, pool_thread, &w->thread_args[i]);
+        if (rc != 0) break;
+        w->num_threads = i + 1;
+    }
+    pthread_attr_destroy(&attr);
+    if (rc != 0) printf("diskwriter: pthread_create failed (%s)\n", strerror(rc));
+    return w->num_threads > 0 ? 0 : -1;
+}
+
+// "auto", "uring" or "threads", plus "direct" and "fsync"
+int diskwriter_parse(const char *list, int *engine, int *flags)
+{
+    static const struct { const char *name; int engine; int flag; } names[] =
+    {
+        {"auto", DISKWRITER_AUTO, 0},
+        {"uring", DISKWRITER_URING, 0},
+        {"threads", DISKWRITER_POOL, 0},
+        {"direct", -1, DISKWRITER_DIRECT},
+        {"fsync", -1, DISKWRITER_SYNC},
+    };
+    const char *p = list;
+    size_t i, len;
+
+    *engine = DISKWRITER_AUTO;
+    *flags = 0;
+    while (*p != '\0')
+    {
+        len = strcspn(p, ",");
+        for (i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+        {
+            if (strlen(names[i].name) == len && strncmp(p, names[i].name, len) == 0)
+            {
+                if (names[i].engine >= 0) *engine = names[i].engine;
+                *flags |= names[i].flag;
+                break;
+            }
+        }
+        if (i == sizeof(names)/sizeof(names[0])) return -1;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+void diskwriter_close(diskwriter_t *w)
+{
+    int i;
+
+    w->stop = 1;
+    for (i = 0; i < w->num_threads; i++)
+        sem_post(&w->work_sem);
+    for (i = 0; i < w->num_threads; i++)
+        pthread_join(w->threads[i], NULL);
+    w->num_threads = 0;
+
+    for (i = 0; i < DISKWRITER_PREOPEN; i++)
+    {
+        if (w->preopen_fd[i] >= 0) file_discard(w, w->preopen_seq[i], w->preopen_fd[i]);
+        w->preopen_fd[i] = PREOPEN_EMPTY;
+    }
+#ifdef DISKWRITER_HAVE_URING
+    if (w->uring != NULL)
+    {
+        uring_teardown(w->uring);
+        free(w->uring);
+        w->uring = NULL;
+    }
+#endif
+    for (i = 0; i < (int)(sizeof(w->stage)/sizeof(w->stage[0])); i++)
+    {
+        free(w->stage[i]);
+        w->stage[i] = NULL;
+    }
+    sem_destroy(&w->work_sem);
+}
+
+void diskwriter_get_stats(diskwriter_t *w, diskwriter_stats_t *stats)
+{
+    pthread_mutex_lock(&w->stats_lock);
+    *stats = w->stats;
+    pthread_mutex_unlock(&w->stats_lock);
+}
+
+const char *diskwriter_engine_name(const diskwriter_t *w)
+{
+    return w->engine == DISKWRITER_URING ? "io_uring" : "threads";
+}
+
+void diskwriter_print_stats(diskwriter_t *w)
+{
+    diskwriter_stats_t st;
+
+    diskwriter_get_stats(w, &st);
+    printf("Disk writer (%s%s%s): %llu submitted, %llu written, %llu failed, %llu dropped, %.1f MB\n",
+           diskwriter_engine_name(w), (w->flags & DISKWRITER_DIRECT) ? ", O_DIRECT" : "",
+           (w->flags & DISKWRITER_SYNC) ? ", fsync" : "",
+           st.submitted, st.written, st.failed, st.dropped, st.bytes/1e6);
+    printf("Disk writer: queue depth max %llu of %d, %llu files opened ahead, latency avg %.3f max %.3f ms\n",
+           st.max_queued, DISKWRITER_QUEUE, st.preopened,
+           (st.written + st.failed) ? st.lat_sum_ns/1e6/(st.written + st.failed) : 0.0,
+           st.lat_max_ns/1e6);
+}
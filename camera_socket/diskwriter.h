@@ -0,0 +1,136 @@
+/*
+ *
+ *  Asynchronous frame storage
+ *  Most added work done by Chutao
+ *
+ *  The RT capture service hands a finished buffer to diskwriter_submit(),
+ *  which only puts it in a single producer ring and returns; open, write,
+ *  fsync and close all happen on the storage side, so a page cache or disk
+ *  stall costs the writer time, not a capture deadline.
+ *
+ *  Two engines:
+ *
+ *      io_uring   one thread, up to DISKWRITER_INFLIGHT writes in flight
+ *                 (double buffered), through the raw io_uring syscalls
+ *      threads    DISKWRITER_THREADS threads doing blocking pwrite(), used
+ *                 when io_uring is missing or not allowed (seccomp, old kernel)
+ *
+ *  File names come from a printf pattern of the frame number, so the files of
+ *  the next frames are opened ahead of time (DISKWRITER_PREOPEN) and a write
+ *  never waits on a directory lookup. With DISKWRITER_DIRECT the files are
+ *  opened O_DIRECT: the buffer is copied into a page aligned staging buffer,
+ *  written padded to the block size and the file is cut back to its size.
+ *
+ *  The done callback runs on a storage thread once the buffer is no longer
+ *  needed, the caller releases its frame there.
+ */
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISKWRITER_QUEUE        (8)     // queued buffers, power of two, well under the frame pool
+#define DISKWRITER_INFLIGHT     (2)     // io_uring writes in flight, one per staging buffer
+#define DISKWRITER_THREADS      (2)     // threads of the fallback engine
+#define DISKWRITER_PREOPEN      (4)     // files opened ahead of the next frame number
+#define DISKWRITER_PATH_MAX     (128)
+#define DISKWRITER_STAGE_SIZE   (4*1024*1024)   // O_DIRECT staging buffer, largest frame
+
+// engine, diskwriter_init()
+#define DISKWRITER_AUTO         (0)     // io_uring when the kernel lets us, else threads
+#define DISKWRITER_URING        (1)
+#define DISKWRITER_POOL         (2)
+
+// flags, diskwriter_init()
+#define DISKWRITER_DIRECT       (1<<0)  // O_DIRECT through aligned staging buffers
+#define DISKWRITER_SYNC         (1<<1)  // fsync every file before it is closed
+
+// err is 0 or an errno value
+typedef void (*diskwriter_done_fn)(void *arg, int err);
+
+typedef struct diskwriter_job
+{
+    unsigned long long seq;     // frame number, names the file
+    const void *data;
+    size_t len;
+    void *arg;                  // handed to the done callback
+    unsigned long long queued;  // latency_now() at submit
+}diskwriter_job_t;
+
+typedef struct diskwriter_stats
+{
+    unsigned long long submitted;
+    unsigned long long written;
+    unsigned long long failed;
+    unsigned long long dropped;     // ring full at submit
+    unsigned long long bytes;
+    unsigned long long preopened;   // writes that found their file already open
+    unsigned long long max_queued;  // deepest the ring has been
+    unsigned long long lat_sum_ns;  // submit to done
+    unsigned long long lat_max_ns;
+}diskwriter_stats_t;
+
+struct diskwriter_uring;
+struct diskwriter;
+
+typedef struct diskwriter_thread
+{
+    struct diskwriter *w;
+    int idx;                            // staging buffer
+}diskwriter_thread_t;
+
+typedef struct diskwriter
+{
+    char pattern[DISKWRITER_PATH_MAX];  // printf pattern with one %llu
+    int flags;
+    int engine;                         // DISKWRITER_URING or DISKWRITER_POOL once running
+    diskwriter_done_fn done;
+
+    // single producer ring, the producer only moves tail, the consumers head
+    diskwriter_job_t jobs[DISKWRITER_QUEUE];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    pthread_mutex_t head_lock;          // consumers, the fallback engine has several
+    sem_t work_sem;                     // one count per queued job
+    volatile int stop;
+
+    // files opened ahead, slot seq % DISKWRITER_PREOPEN
+    pthread_mutex_t preopen_lock;
+    int preopen_fd[DISKWRITER_PREOPEN];
+    unsigned long long preopen_seq[DISKWRITER_PREOPEN];
+
+    int num_threads;
+    pthread_t threads[DISKWRITER_THREADS];
+    diskwriter_thread_t thread_args[DISKWRITER_THREADS];
+    unsigned char *stage[DISKWRITER_THREADS > DISKWRITER_INFLIGHT ? DISKWRITER_THREADS : DISKWRITER_INFLIGHT];
+    struct diskwriter_uring *uring;
+
+    pthread_mutex_t stats_lock;
+    diskwriter_stats_t stats;
+}diskwriter_t;
+
+// cpus NULL keeps the caller's affinity; the threads are SCHED_OTHER either way
+int diskwriter_init(diskwriter_t *w, const char *pattern, int engine, int flags,
+                    diskwriter_done_fn done, cpu_set_t *cpus);
+int diskwriter_parse(const char *list, int *engine, int *flags);  // "uring,direct,fsync" ...
+int diskwriter_submit(diskwriter_t *w, unsigned long long seq, const void *data, size_t len, void *arg);
+void diskwriter_close(diskwriter_t *w);     // writes what is queued, then stops
+void diskwriter_get_stats(diskwriter_t *w, diskwriter_stats_t *stats);
+void diskwriter_print_stats(diskwriter_t *w);
+const char *diskwriter_engine_name(const diskwriter_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISKWRITER_H */
@@ -0,0 +1,187 @@
+/*
+ *
+ *  Fault injection for overload tests, see fault.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fault.h"
+#include "latency.h"
+#include "rtlog.h"
+
+static const char *fault_names[FAULT_KINDS] = {"cpu", "io", "net", "drop"};
+
+fault_plan_t fault_plan;
+
+//*****************************************************************************
+//
+// Scenario
+//
+//*****************************************************************************
+const char *fault_kind_name(int kind)
+{
+    return fault_names[kind];
+}
+
+int fault_load(const char *path)
+{
+    char line[256], kind[16], amount[16], site[FAULT_SITE_MAX];
+    double from, to, ms;
+    unsigned int every;
+    int i, lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    memset(&fault_plan, 0, sizeof(fault_plan));
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        fault_t *ft = &fault_plan.fault[fault_plan.count];
+
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') continue;
+        if (sscanf(line, "%lf %lf %15s %15s %15s %u", &from, &to, kind, amount, site, &every) != 6
+            || from < 0 || to <= from || every == 0 || fault_plan.count == FAULT_MAX)
+        {
+            printf("%s:%d: expected from_ms to_ms fault amount_ms site every\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        for (i = 0; i < FAULT_KINDS && strcmp(kind, fault_names[i]) != 0; i++);
+        ms = 0.0;
+        if (i == FAULT_KINDS || (i != FAULT_DROP && sscanf(amount, "%lf", &ms) != 1) || ms < 0)
+        {
+            printf("%s:%d: bad fault or amount\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        ft->kind = i;
+        strcpy(ft->site, strcmp(site, "-") == 0 ? "" : site);
+        ft->from_ns = (unsigned long long)(from*1000000.0);
+        ft->to_ns = (unsigned long long)(to*1000000.0);
+        ft->amount_ns = (unsigned long long)(ms*1000000.0);
+        ft->every = every;
+        fault_plan.count++;
+    }
+    fclose(f);
+    return 0;
+}
+
+void fault_start(void)
+{
+    int i;
+
+    for (i = 0; i < fault_plan.count; i++)
+    {
+        fault_t *ft = &fault_plan.fault[i];
+
+        ft->calls = ft->hits = ft->misses = ft->after = ft->recovery_ns = 0;
+    }
+    fault_plan.jobs = fault_plan.misses = 0;
+    fault_plan.start = latency_now();
+}
+
+//*****************************************************************************
+//
+// Hooks
+//
+//*****************************************************************************
+static void fault_burn(unsigned long long ns)
+{
+    unsigned long long end = latency_now() + ns;
+
+    while (latency_now() < end);
+}
+
+static void fault_sleep(unsigned long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns/1000000000ULL;
+    ts.tv_nsec = ns%1000000000ULL;
+    while (nanosleep(&ts, &ts) != 0);
+}
+
+int fault_inject(int kind, const char *site)
+{
+    unsigned long long t;
+    int i, drop = 0;
+
+    if (fault_plan.count == 0 || fault_plan.start == 0) return 0;
+    t = latency_now() - fault_plan.start;
+    for (i = 0; i < fault_plan.count; i++)
+    {
+        fault_t *ft = &fault_plan.fault[i];
+
+        if (ft->kind != kind || t < ft->from_ns || t >= ft->to_ns) continue;
+        if (ft->site[0] != '\0' && strcmp(ft->site, site) != 0) continue;
+        if (__atomic_fetch_add(&ft->calls, 1, __ATOMIC_RELAXED) % ft->every != 0) continue;
+        __atomic_add_fetch(&ft->hits, 1, __ATOMIC_RELAXED);
+        switch (kind)
+        {
+            case FAULT_CPU: fault_burn(ft->amount_ns); break;
+            case FAULT_IO:
+            case FAULT_NET: fault_sleep(ft->amount_ns); break;
+            case FAULT_DROP: drop = 1; break;
+        }
+    }
+    return drop;
+}
+
+void fault_record(int missed)
+{
+    unsigned long long t, recovery, old;
+    int i, last = -1, inside = 0;
+
+    if (fault_plan.count == 0 || fault_plan.start == 0) return;
+    __atomic_add_fetch(&fault_plan.jobs, 1, __ATOMIC_RELAXED);
+    if (!missed) return;
+    __atomic_add_fetch(&fault_plan.misses, 1, __ATOMIC_RELAXED);
+
+    t = latency_now() - fault_plan.start;
+    for (i = 0; i < fault_plan.count; i++)
+    {
+        fault_t *ft = &fault_plan.fault[i];
+
+        if (t >= ft->from_ns && t < ft->to_ns)
+        {
+            __atomic_add_fetch(&ft->misses, 1, __ATOMIC_RELAXED);
+            inside = 1;
+        }
+        else if (t >= ft->to_ns && (last < 0 || ft->to_ns > fault_plan.fault[last].to_ns))
+            last = i;
+    }
+    if (inside || last < 0) return;
+
+    // a miss after the window still belongs to the last fault that ended
+    fault_t *ft = &fault_plan.fault[last];
+    __atomic_add_fetch(&ft->after, 1, __ATOMIC_RELAXED);
+    recovery = t - ft->to_ns;
+    old = __atomic_load_n(&ft->recovery_ns, __ATOMIC_RELAXED);
+    while (recovery > old &&
+           !__atomic_compare_exchange_n(&ft->recovery_ns, &old, recovery, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    rtlog(LOG_WARNING, "fault: deadline miss %.1f ms after %s fault %d ended", recovery/1e6,
+          fault_names[ft->kind], last);
+}
+
+void fault_print(void)
+{
+    int i;
+
+    if (fault_plan.count == 0) return;
+    printf("Faults: %llu jobs, %llu deadline misses\n", fault_plan.jobs, fault_plan.misses);
+    for (i = 0; i < fault_plan.count; i++)
+    {
+        const fault_t *ft = &fault_plan.fault[i];
+
+        printf("  %-4s %-7s %8.0f-%-8.0f ms  amount %7.1f ms  hits %6llu  misses %5llu  after %5llu"
+               "  recovery %8.1f ms\n", fault_names[ft->kind], ft->site[0] ? ft->site : "-",
+               ft->from_ns/1e6, ft->to_ns/1e6, ft->amount_ns/1e6, ft->hits, ft->misses, ft->after,
+               ft->recovery_ns/1e6);
+    }
+}
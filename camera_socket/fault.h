@@ -0,0 +1,85 @@
+/*
+ *
+ *  Fault injection for overload tests
+ *  Most added work done by Chutao
+ *
+ *  A scenario file lists faults with the time window they are active in,
+ *  counted from fault_start(), one per line:
+ *
+ *      from_ms  to_ms  fault  amount_ms  site  every
+ *
+ *      cpu   burn amount_ms of CPU in the service named by site (seq, s1, s2)
+ *      io    stall each frame write for amount_ms (site write)
+ *      net   hold each image amount_ms before it is sent (site send)
+ *      drop  throw the captured frame away (site capture), amount is -
+ *
+ *  site - matches every site of that fault, every N hits one call in N. The
+ *  hooks sit in the services, the frame writers (capture.cpp, diskwriter.c),
+ *  netsend_image() and capture_frame(); with no scenario loaded they return
+ *  at once.
+ *
+ *  The services report every job to fault_record(), so the end of run report
+ *  has per fault the deadline misses inside its window, the misses after it
+ *  and the recovery time: from the end of the window to the last miss that
+ *  still followed it, before the next fault began.
+ */
+#ifndef FAULT_H
+#define FAULT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAULT_MAX       (32)
+#define FAULT_SITE_MAX  (16)
+
+#define FAULT_CPU   (0)
+#define FAULT_IO    (1)
+#define FAULT_NET   (2)
+#define FAULT_DROP  (3)
+#define FAULT_KINDS (4)
+
+typedef struct fault
+{
+    int kind;
+    char site[FAULT_SITE_MAX];          // "" = any
+    unsigned long long from_ns;         // window, from fault_start()
+    unsigned long long to_ns;
+    unsigned long long amount_ns;
+    unsigned int every;
+    unsigned long long calls;           // hook calls inside the window
+    unsigned long long hits;            // injected
+    unsigned long long misses;          // deadline misses inside the window
+    unsigned long long after;           // misses after it, before the next fault
+    unsigned long long recovery_ns;     // end of window to the last of those
+}fault_t;
+
+typedef struct fault_plan
+{
+    fault_t fault[FAULT_MAX];
+    int count;
+    unsigned long long start;           // 0 until fault_start()
+    unsigned long long jobs;
+    unsigned long long misses;
+}fault_plan_t;
+
+extern fault_plan_t fault_plan;
+
+// 0, or -1 after printing what was wrong with the file
+int fault_load(const char *path);
+const char *fault_kind_name(int kind);
+// starts the clock and clears the counters, every bench run starts over
+void fault_start(void);
+
+// at a hook: burns or sleeps as the plan says, 1 when the frame is dropped
+int fault_inject(int kind, const char *site);
+// at the end of every job
+void fault_record(int missed);
+
+void fault_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAULT_H */
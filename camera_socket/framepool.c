@@ -0,0 +1,101 @@
+/*
+ *
+ *  Fixed-size, reference counted buffer pool for frames and I/O buffers
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framepool.h"
+
+static int framepool_index(framepool_t *pool, void *buf)
+{
+    size_t offset = (char *)buf - pool->arena;
+    return (int)(offset / pool->buf_size);
+}
+
+int framepool_init(framepool_t *pool, int num_bufs, size_t buf_size)
+{
+    int i;
+
+    if (num_bufs > FRAMEPOOL_MAX_BUFS) num_bufs = FRAMEPOOL_MAX_BUFS;
+    memset(pool, 0, sizeof(framepool_t));
+    pool->buf_size = (buf_size + FRAMEPOOL_ALIGN - 1) & ~((size_t)FRAMEPOOL_ALIGN - 1);
+    pool->num_bufs = num_bufs;
+
+    // page aligned so buffers can also be used for O_DIRECT writes
+    if (posix_memalign((void **)&pool->arena, FRAMEPOOL_ALIGN, pool->buf_size*num_bufs) != 0)
+    {
+        printf("Cannot allocate %d frame buffers of %zu bytes\n", num_bufs, pool->buf_size);
+        return -1;
+    }
+    // touch every page now instead of on first use in an RT thread
+    memset(pool->arena, 0, pool->buf_size*num_bufs);
+
+    for (i = 0; i < num_bufs; i++)
+        pool->free_list[i] = num_bufs - 1 - i;
+    pool->free_count = num_bufs;
+    pool->min_free = num_bufs;
+    rtlock_init(&pool->lock, "framepool");
+    return 0;
+}
+
+// Returns a buffer holding one reference, or NULL when every buffer is in use
+void *framepool_get(framepool_t *pool)
+{
+    int idx;
+
+    rtlock_lock(&pool->lock);
+    if (pool->free_count == 0)
+    {
+        pool->exhausted++;
+        rtlock_unlock(&pool->lock);
+        return NULL;
+    }
+    idx = pool->free_list[--pool->free_count];
+    if (pool->free_count < pool->min_free) pool->min_free = pool->free_count;
+    pool->refcnt[idx] = 1;
+    rtlock_unlock(&pool->lock);
+
+    return pool->arena + (size_t)idx*pool->buf_size;
+}
+
+void framepool_ref(framepool_t *pool, void *buf)
+{
+    __sync_fetch_and_add(&pool->refcnt[framepool_index(pool, buf)], 1);
+}
+
+// Returns the references left, 0 when the buffer went back to the free list
+int framepool_put(framepool_t *pool, void *buf)
+{
+    int idx, left;
+
+    if (buf == NULL) return -1;
+    idx = framepool_index(pool, buf);
+    left = __sync_sub_and_fetch(&pool->refcnt[idx], 1);
+    if (left == 0)
+    {
+        rtlock_lock(&pool->lock);
+        pool->free_list[pool->free_count++] = idx;
+        rtlock_unlock(&pool->lock);
+    }
+    return left;
+}
+
+void framepool_destroy(framepool_t *pool)
+{
+    rtlock_destroy(&pool->lock);
+    free(pool->arena);
+    pool->arena = NULL;
+}
+
+void framepool_print_stats(framepool_t *pool, const char *name)
+{
+    printf("%s pool: %d x %zu bytes, %d never used, %llu times exhausted\n",
+           name, pool->num_bufs, pool->buf_size, pool->min_free, pool->exhausted);
+}
@@ -0,0 +1,50 @@
+/*
+ *
+ *  Fixed-size, reference counted buffer pool for frames and I/O buffers
+ *  Most added work done by Chutao
+ *
+ *  All buffers come from one page aligned arena allocated (and pre-faulted)
+ *  at init, so steady state never touches the heap. A buffer goes back to
+ *  the free list when its last reference is dropped, which lets capture,
+ *  encode and network share one frame without copying it.
+ */
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "rtlock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMEPOOL_MAX_BUFS  (32)
+#define FRAMEPOOL_ALIGN     (4096)
+
+typedef struct framepool
+{
+    char *arena;
+    size_t buf_size;            // rounded up to FRAMEPOOL_ALIGN
+    int num_bufs;
+    int free_list[FRAMEPOOL_MAX_BUFS];
+    int free_count;
+    int min_free;               // low-water mark, to size the pool
+    volatile int refcnt[FRAMEPOOL_MAX_BUFS];
+    unsigned long long exhausted;
+    rtlock_t lock;              // shared with best-effort threads, priority inheriting
+}framepool_t;
+
+int framepool_init(framepool_t *pool, int num_bufs, size_t buf_size);
+void *framepool_get(framepool_t *pool);
+void framepool_ref(framepool_t *pool, void *buf);
+int framepool_put(framepool_t *pool, void *buf);
+void framepool_destroy(framepool_t *pool);
+void framepool_print_stats(framepool_t *pool, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAMEPOOL_H */
@@ -0,0 +1,251 @@
+/*
+ *
+ *  Per-frame latency probes, from exposure to disk and network
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "latency.h"
+
+typedef struct latency_row
+{
+    unsigned long long frame;
+    long capture_sec;               // join key with the server log
+    long capture_usec;
+    unsigned long long stamps[LAT_NUM_STAGES];
+    unsigned long long release;     // 0 = no deadline
+    unsigned long long deadline;
+    volatile int valid;
+}latency_row_t;
+
+static const char *lat_stage_names[LAT_NUM_STAGES] =
+{
+    "driver", "dequeue", "overlay", "file_write", "encode", "send"
+};
+
+static int lat_stage_budget_pct[LAT_NUM_STAGES] = LATENCY_BUDGET_PCT;
+
+static latency_row_t latency_rows[LATENCY_FRAMES];
+
+// "stage overlay" marker at the stamp
+void latency_trace_stage(lat_stage_t stage)
+{
+    rttrace_mark("stage %s", lat_stage_names[stage]);
+}
+
+// Each stage on its own track, from the latest earlier stamp before its own
+// (the encode can finish after the send) or the release
+static void latency_trace_frame(const latency_row_t *row)
+{
+    unsigned long long begin;
+    int stage, i;
+
+    for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+    {
+        if (row->stamps[stage] == 0) continue;
+        begin = row->release <= row->stamps[stage] ? row->release : 0;
+        for (i = 0; i < stage; i++)
+            if (row->stamps[i] > begin && row->stamps[i] <= row->stamps[stage]) begin = row->stamps[i];
+        if (begin != 0)
+            rttrace_slice(lat_stage_names[stage], lat_stage_names[stage], begin, row->stamps[stage], row->frame);
+    }
+}
+
+int latency_set_budget(const char *list)
+{
+    int pct[LAT_NUM_STAGES];
+    const char *p = list;
+    char *end;
+    int stage;
+
+    for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+    {
+        pct[stage] = (int)strtol(p, &end, 10);
+        if (end == p || pct[stage] < 0 || pct[stage] > 100) return -1;
+        if (stage > 0 && pct[stage] < pct[stage - 1]) return -1;
+        if (*end != (stage == LAT_NUM_STAGES - 1 ? '\0' : ',')) return -1;
+        p = end + 1;
+    }
+    memcpy(lat_stage_budget_pct, pct, sizeof(pct));
+    return 0;
+}
+
+// Called once per frame by whoever drops the last reference
+void latency_commit(unsigned long long frame, long capture_sec, long capture_usec,
+                    const unsigned long long *stamps, unsigned long long release,
+                    unsigned long long deadline)
+{
+    latency_row_t *row = &latency_rows[frame % LATENCY_FRAMES];
+
+    // never dequeued, committing it would wipe the row of a real frame
+    if (stamps[LAT_DEQUEUE] == 0) return;
+    row->valid = 0;
+    row->frame = frame;
+    row->capture_sec = capture_sec;
+    row->capture_usec = capture_usec;
+    memcpy(row->stamps, stamps, sizeof(row->stamps));
+    row->release = release;
+    row->deadline = deadline;
+    row->valid = 1;
+    latency_trace_frame(row);
+}
+
+// 1 when the stage ran after its share of the deadline, -1 when there is
+// nothing to check
+static int latency_stage_missed(const latency_row_t *row, int stage)
+{
+    unsigned long long due;
+
+    if (row->release == 0 || row->stamps[stage] == 0 || stage == LAT_DRIVER) return -1;
+    due = row->release + (row->deadline - row->release)*lat_stage_budget_pct[stage]/100;
+    return row->stamps[stage] > due;
+}
+
+// last local stage against the deadline, negative is slack
+static long long latency_lateness_usec(const latency_row_t *row)
+{
+    unsigned long long last = 0;
+    int i;
+
+    for (i = 0; i < LAT_NUM_STAGES; i++)
+        if (row->stamps[i] > last) last = row->stamps[i];
+    return ((long long)last - (long long)row->deadline)/1000;
+}
+
+// Time spent in a stage is measured from the latest earlier stage that ran
+static long long latency_stage_usec(const latency_row_t *row, int stage)
+{
+    int prev;
+
+    if (row->stamps[stage] == 0) return -1;
+    for (prev = stage - 1; prev >= 0; prev--)
+    {
+        if (row->stamps[prev] != 0)
+            return (long long)(row->stamps[stage] - row->stamps[prev])/1000;
+    }
+    return 0;
+}
+
+static long long latency_total_usec(const latency_row_t *row)
+{
+    int first = -1, last = -1, i;
+
+    for (i = 0; i < LAT_NUM_STAGES; i++)
+    {
+        if (row->stamps[i] == 0) continue;
+        if (first < 0) first = i;
+        last = i;
+    }
+    if (first < 0) return -1;
+    return (long long)(row->stamps[last] - row->stamps[first])/1000;
+}
+
+void latency_print_summary(void)
+{
+    int i, stage;
+    unsigned long long count[LAT_NUM_STAGES] = {0};
+    long long sum[LAT_NUM_STAGES] = {0};
+    long long worst[LAT_NUM_STAGES] = {0};
+    unsigned long long met[LAT_NUM_STAGES] = {0}, missed[LAT_NUM_STAGES] = {0};
+    unsigned long long tracked = 0, late = 0;
+    long long usec, late_max = 0;
+
+    for (i = 0; i < LATENCY_FRAMES; i++)
+    {
+        if (!latency_rows[i].valid) continue;
+        for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+        {
+            usec = latency_stage_usec(&latency_rows[i], stage);
+            if (usec < 0) continue;
+            count[stage]++;
+            sum[stage] += usec;
+            if (usec > worst[stage]) worst[stage] = usec;
+            switch (latency_stage_missed(&latency_rows[i], stage))
+            {
+                case 0: met[stage]++; break;
+                case 1: missed[stage]++; break;
+            }
+        }
+        if (latency_rows[i].release != 0)
+        {
+            tracked++;
+            usec = latency_lateness_usec(&latency_rows[i]);
+            if (usec > 0) late++;
+            if (tracked == 1 || usec > late_max) late_max = usec;
+        }
+    }
+
+    printf("Frame latency per stage (usec):\n");
+    for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+    {
+        if (count[stage] == 0) continue;
+        printf("  %-10s frames %6llu  avg %8lld  max %8lld", lat_stage_names[stage],
+               count[stage], sum[stage]/(long long)count[stage], worst[stage]);
+        if (met[stage] + missed[stage] > 0)
+            printf("  budget %2d%% met %6llu missed %6llu", lat_stage_budget_pct[stage], met[stage], missed[stage]);
+        printf("\n");
+    }
+    if (tracked > 0)
+        printf("  deadline   frames %6llu  late before leaving %llu, worst lateness %lld usec\n",
+               tracked, late, late_max);
+}
+
+// One row per frame: capture time, then the usec spent in each stage
+// (-1 = stage did not run), the total from the first to the last stage and,
+// for frames with a deadline, the deadline, the stages that missed their
+// share and the lateness of the last stage (negative = slack)
+void latency_print_to_csv(const char *path)
+{
+    int i, stage;
+    char my_buf[512];
+    int len, sep;
+    latency_row_t *row;
+
+    int fd = open(path,
+            O_WRONLY|O_CREAT|O_TRUNC,
+            S_IRWXU|S_IRWXG|S_IRWXO);
+    if (fd < 0)
+    {
+        perror("Cannot open latency file");
+        return;
+    }
+
+    len = sprintf(my_buf, "Frame, Capture Sec, Capture Usec");
+    for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+        len += sprintf(my_buf + len, ", %s", lat_stage_names[stage]);
+    len += sprintf(my_buf + len, ", total, deadline, missed, lateness\n");
+    if (write(fd, my_buf, len) != len) perror("latency write error");
+
+    for (i = 0; i < LATENCY_FRAMES; i++)
+    {
+        row = &latency_rows[i];
+        if (!row->valid) continue;
+        len = sprintf(my_buf, "%llu, %ld, %ld", row->frame, row->capture_sec, row->capture_usec);
+        for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+            len += sprintf(my_buf + len, ", %lld", latency_stage_usec(row, stage));
+        len += sprintf(my_buf + len, ", %lld", latency_total_usec(row));
+        if (row->release == 0)
+        {
+            len += sprintf(my_buf + len, ", -1, -, 0\n");
+        }
+        else
+        {
+            len += sprintf(my_buf + len, ", %lld, ", (long long)(row->deadline - row->release)/1000);
+            sep = 0;
+            for (stage = 0; stage < LAT_NUM_STAGES; stage++)
+            {
+                if (latency_stage_missed(row, stage) != 1) continue;
+                len += sprintf(my_buf + len, "%s%s", sep ? "|" : "", lat_stage_names[stage]);
+                sep = 1;
+            }
+            len += sprintf(my_buf + len, "%s, %lld\n", sep ? "" : "-", latency_lateness_usec(row));
+        }
+        if (write(fd, my_buf, len) != len) perror("latency write error");
+    }
+    close(fd);
+}
@@ -0,0 +1,97 @@
+/*
+ *
+ *  Per-frame latency probes, from exposure to disk and network
+ *  Most added work done by Chutao
+ *
+ *  Every frame carries one CLOCK_MONOTONIC stamp per pipeline stage, taken
+ *  with latency_mark() when that stage is done (0 = stage did not run).
+ *  When the last reference to a frame is dropped its stamps are copied to
+ *  a table, which latency_print_to_csv() dumps with the time spent in each
+ *  stage, so a slower pipeline can be pinned on one stage. The server side
+ *  (receive, fsync) is logged by aesd_server and joins on the capture time.
+ *
+ *  A frame captured by an RT service also carries its release time and its
+ *  end-to-end deadline. Each stage owns a share of that budget: it should be
+ *  done by release + its share of the deadline (LATENCY_BUDGET_PCT, seqgen -B),
+ *  and the table counts which stages met their share. The deadline itself is
+ *  checked where the frame ends up, by aesd_server after the fsync (see
+ *  netsend.h).
+ *
+ *  With rttrace on, every stamp is also an ftrace marker and every committed
+ *  frame a row of stage slices in the JSON timeline (see rttrace.h).
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <time.h>
+
+#include "rttrace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LATENCY_FRAMES (2000)   // table rows, frame number modulo this
+
+// In pipeline order
+typedef enum lat_stage
+{
+    LAT_DRIVER = 0,     // exposure, V4L2 driver timestamp only
+    LAT_DEQUEUE,        // frame handed to us by the driver / VideoCapture
+    LAT_OVERLAY,        // text stamped on the frame
+    LAT_FILE_WRITE,     // PPM saved
+    LAT_ENCODE,         // JPEG saved by the worker pool
+    LAT_SEND,           // sent to the aesd_server
+    LAT_NUM_STAGES
+}lat_stage_t;
+
+static inline unsigned long long latency_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void latency_trace_stage(lat_stage_t stage);
+
+// stamps is the frame's array of LAT_NUM_STAGES entries
+static inline void latency_mark(unsigned long long *stamps, lat_stage_t stage)
+{
+    stamps[stage] = latency_now();
+    if (rttrace_marker_fd >= 0) latency_trace_stage(stage);
+}
+
+// "done by" share of the end-to-end deadline per stage, in stage order,
+// cumulative from the release. The default is an allocation, not a
+// measurement, sized for the default deadline of one S1 period:
+//
+//   driver      5   exposure, the camera's own; never checked
+//   dequeue    10   Service_1 has the frame, RT work
+//   overlay    20   stamped, the end of Service_1's RT work
+//   file_write 70   best-effort PPM write, the slowest stage (SD card), half
+//                   of the budget
+//   encode     80   JPEG on the worker pool, mostly in parallel with the write
+//   send       90   handed to the network
+//
+// and the network hop and the server's fsync have the last 10%. Replace it
+// (seqgen -B) with shares taken from the per-stage avg/max that
+// latency_print_summary() prints for a run on the target.
+#define LATENCY_BUDGET_PCT { 5, 10, 20, 70, 80, 90 }
+
+// "5,10,20,70,80,90": LAT_NUM_STAGES non-decreasing percentages, -1 when the
+// list is not that
+int latency_set_budget(const char *list);
+
+// release and deadline are CLOCK_MONOTONIC ns, 0 when the frame has none
+void latency_commit(unsigned long long frame, long capture_sec, long capture_usec,
+                    const unsigned long long *stamps, unsigned long long release,
+                    unsigned long long deadline);
+void latency_print_summary(void);
+void latency_print_to_csv(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_H */
@@ -0,0 +1,505 @@
+/*
+ *
+ *  Micro-benchmarks for the image kernels and I/O primitives of the pipeline
+ *  Most added work done by Chutao
+ *
+ *  Every kernel runs on a synthetic frame at 640x480 and 1280x720 (or the
+ *  size given with -W/-H) and reports min/p50/p99/mean per call, so a change
+ *  can be judged on the kernel it touches instead of on a noisy full run.
+ *  Where the pipeline replaced an older way of doing the same thing, both
+ *  are measured side by side:
+ *
+ *      ppm_rewrite_old   imwrite, read back, rewrite with the comment header
+ *      ppm_write_fast    header in front of the pixels, one write(), the
+ *                        capture library's writer (capture_ppm_*)
+ *      send_read_old     read the file into a realloc'd buffer, then send
+ *      send_sendmsg      sendmsg straight from memory (netsend.c)
+ *      recv_realloc_old  aesd_recv malloc/realloc growth loop
+ *      recv_pool         receive into one preallocated buffer
+ *
+ *  `make microbench` builds and runs it and writes microbench.json.
+ */
+
+// std related
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <vector>
+
+// File related
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Thread, time and network related
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+// Opencv Related
+#include "opencv2/opencv.hpp"
+
+#include "latency.h"
+#include "capture.h"
+#include "netsend.h"
+#include "platform.h"
+
+#define MB_ITERATIONS   (50)
+#define MB_WARMUP       (3)
+#define MB_DIR          "./bench_out"
+#define OLD_BUF_SIZE    925696      // BUF_SIZE of the old capture/send/recv code
+#define RECV_BUF_SIZE   (4*1024*1024)
+#define RECV_CHUNK      (64*1024)   // writer side of the recv benchmark
+
+using namespace cv;
+
+typedef struct mb_result
+{
+    const char *kernel;
+    int width;
+    int height;
+    double min_us, p50_us, p99_us, mean_us;
+}mb_result_t;
+
+static std::vector<mb_result_t> results;
+static int iterations = MB_ITERATIONS;
+
+//*****************************************************************************
+//
+// Timing
+//
+//*****************************************************************************
+
+// Times fn(ctx) per call and keeps the summary
+template <typename Fn>
+static void measure(const char *kernel, int width, int height, Fn fn)
+{
+    std::vector<double> us;
+    int i;
+
+    for(i = 0; i < MB_WARMUP; i++)
+    {
+        fn();
+    }
+    us.reserve(iterations);
+    for(i = 0; i < iterations; i++)
+    {
+        unsigned long long t0 = latency_now();
+        fn();
+        us.push_back((latency_now() - t0)/1000.0);
+    }
+    std::sort(us.begin(), us.end());
+
+    mb_result_t r;
+    r.kernel = kernel;
+    r.width = width;
+    r.height = height;
+    r.min_us = us.front();
+    r.p50_us = us[(us.size() - 1)*50/100];
+    r.p99_us = us[(us.size() - 1)*99/100];
+    r.mean_us = 0;
+    for(double v : us) r.mean_us += v;
+    r.mean_us /= us.size();
+    results.push_back(r);
+
+    printf("%-18s %4dx%-4d  min %9.1f  p50 %9.1f  p99 %9.1f  mean %9.1f us\n",
+           kernel, width, height, r.min_us, r.p50_us, r.p99_us, r.mean_us);
+}
+
+//*****************************************************************************
+//
+// Synthetic frames and the overlay text used by capture.cpp
+//
+//*****************************************************************************
+static Mat synthetic_frame(int width, int height, int shift)
+{
+    Mat frame(height, width, CV_8UC3);
+    for(int y = 0; y < height; y++)
+    {
+        Vec3b *row = frame.ptr<Vec3b>(y);
+        for(int x = 0; x < width; x++)
+        {
+            row[x] = Vec3b((x + shift)*255/width, y*255/height, 128);
+        }
+    }
+    Mat noise(height, width, CV_8UC3);
+    randu(noise, Scalar::all(0), Scalar::all(32));
+    frame += noise;
+    return frame;
+}
+
+static void overlay_text(char *time_buf, char *sub_buf, char *name_buf)
+{
+    struct timeval now;
+    gettimeofday(&now, (struct timezone *)0);
+    strftime(time_buf, 128, "#timestamp:%a, %d %b %Y %T %z \n", localtime(&now.tv_sec));
+    sprintf(sub_buf, "# sec=%d, msec=%d\n", (int)now.tv_sec, (int)now.tv_usec/1000);
+    gethostname(name_buf + 2, 120);
+    name_buf[0] = '#';
+    name_buf[1] = ' ';
+    strcat(name_buf, " \n");
+}
+
+//*****************************************************************************
+//
+// File and socket helpers for the old code paths
+//
+//*****************************************************************************
+
+// Read a whole file the way the old capture_write/send_thread did
+static void *read_realloc(const char *filename, ssize_t *size, size_t extra)
+{
+    int fd = open(filename, O_RDONLY);
+    void *local_buf = malloc(OLD_BUF_SIZE);
+    int num_read = 1;
+    ssize_t read_size, total_read_size = 0;
+
+    while(true)
+    {
+        read_size = read(fd, (char *)local_buf + (num_read - 1)*OLD_BUF_SIZE, OLD_BUF_SIZE);
+        total_read_size = (num_read - 1)*OLD_BUF_SIZE + (read_size > 0 ? read_size : 0);
+        if(read_size < OLD_BUF_SIZE)
+        {
+            break;
+        }
+        num_read++;
+        local_buf = realloc(local_buf, num_read*OLD_BUF_SIZE);
+    }
+    close(fd);
+    if(extra)
+    {
+        local_buf = realloc(local_buf, total_read_size + extra);
+    }
+    *size = total_read_size;
+    return local_buf;
+}
+
+static void write_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    while(done < len)
+    {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if(n <= 0)
+        {
+            perror("microbench write");
+            return;
+        }
+        done += n;
+    }
+}
+
+static void send_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    while(done < len)
+    {
+        ssize_t n = send(fd, (const char *)buf + done, len - done, MSG_NOSIGNAL);
+        if(n <= 0)
+        {
+            return;
+        }
+        done += n;
+    }
+}
+
+// Writer side of the recv benchmarks: one image plus trailer per request
+typedef struct recv_feed
+{
+    int fd;
+    const char *image;
+    size_t len;
+    sem_t go;
+    sem_t done;
+    volatile bool stop;
+}recv_feed_t;
+
+static void *recv_feed_thread(void *arg)
+{
+    recv_feed_t *feed = (recv_feed_t *)arg;
+    static const char trailer[NETSEND_TRAILER_LEN] = {'\n', '#', 0x4};
+
+    while(true)
+    {
+        sem_wait(&feed->go);
+        if(feed->stop)
+        {
+            break;
+        }
+        for(size_t off = 0; off < feed->len; off += RECV_CHUNK)
+        {
+            send_all(feed->fd, feed->image + off, std::min((size_t)RECV_CHUNK, feed->len - off));
+        }
+        send_all(feed->fd, trailer, sizeof(trailer));
+        sem_wait(&feed->done);
+    }
+    return NULL;
+}
+
+//*****************************************************************************
+//
+// Benchmarks at one frame size
+//
+//*****************************************************************************
+static void run_size(int width, int height, const struct addrinfo *sink)
+{
+    Mat frame = synthetic_frame(width, height, 0);
+    Mat previous = synthetic_frame(width, height, 8);
+    Mat work, rgb, gray, diff;
+    char time_buf[128], sub_buf[40], name_buf[128];
+    char ppm_name[64], png_name[64], jpg_name[64];
+    std::vector<int> jpeg_params;
+    jpeg_params.push_back(IMWRITE_JPEG_QUALITY);
+    jpeg_params.push_back(90);
+
+    sprintf(ppm_name, MB_DIR "/mb_%dx%d.ppm", width, height);
+    sprintf(png_name, MB_DIR "/mb_%dx%d.png", width, height);
+    sprintf(jpg_name, MB_DIR "/mb_%dx%d.jpg", width, height);
+    overlay_text(time_buf, sub_buf, name_buf);
+
+    // putText overlay, the three lines stamped on every frame
+    measure("puttext_overlay", width, height, [&]() {
+        frame.copyTo(work);
+        putText(work, time_buf, Point(10, 40), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255, 255, 255), 2);
+        putText(work, sub_buf, Point(10, 80), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255, 255, 255), 2);
+        putText(work, name_buf, Point(10, 120), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255, 255, 255), 2);
+    });
+
+    // colour conversions
+    measure("cvt_bgr2rgb", width, height, [&]() { cvtColor(frame, rgb, COLOR_BGR2RGB); });
+    measure("cvt_bgr2gray", width, height, [&]() { cvtColor(frame, gray, COLOR_BGR2GRAY); });
+    Mat yuyv(height, width, CV_8UC2);
+    randu(yuyv, Scalar::all(0), Scalar::all(255));
+    measure("cvt_yuyv2bgr", width, height, [&]() { cvtColor(yuyv, work, COLOR_YUV2BGR_YUYV); });
+
+    // frame difference, as a motion check would do it
+    measure("frame_diff", width, height, [&]() {
+        absdiff(frame, previous, diff);
+        cvtColor(diff, gray, COLOR_BGR2GRAY);
+        threshold(gray, gray, 25, 255, THRESH_BINARY);
+        volatile int changed = countNonZero(gray);
+        (void)changed;
+    });
+
+    // encoders
+    measure("imwrite_ppm", width, height, [&]() { imwrite(ppm_name, frame); });
+    measure("imwrite_png", width, height, [&]() { imwrite(png_name, frame); });
+    measure("imwrite_jpg", width, height, [&]() { imwrite(jpg_name, frame, jpeg_params); });
+
+    // PPM with the comment header: old rewrite pass vs header in place
+    measure("ppm_rewrite_old", width, height, [&]() {
+        imwrite(ppm_name, frame);
+        ssize_t size;
+        char *buf = (char *)read_realloc(ppm_name, &size, 0);
+        int fd = open(ppm_name, O_WRONLY|O_CREAT, S_IRWXU|S_IRWXG|S_IRWXO);
+        write_all(fd, buf, 3);
+        write_all(fd, time_buf, strlen(time_buf));
+        write_all(fd, sub_buf, strlen(sub_buf));
+        write_all(fd, name_buf, strlen(name_buf));
+        write_all(fd, buf + 3, size - 3);
+        close(fd);
+        free(buf);
+    });
+    size_t pixels = (size_t)width*height*3;
+    char *ppm_buf = (char *)malloc(CAPTURE_PPM_HEADER_MAX + pixels);
+    char comments[CAPTURE_PPM_HEADER_MAX];
+    snprintf(comments, sizeof(comments), "%s%s%s", time_buf, sub_buf, name_buf);
+    // a frame outside the pool, laid out the way the pool lays it out
+    capture_frame_t ppm_frame;
+    memset(&ppm_frame, 0, sizeof(ppm_frame));
+    ppm_frame.width = width;
+    ppm_frame.height = height;
+    ppm_frame.bgr = frame.data;
+    ppm_frame.rgb = (unsigned char *)ppm_buf + CAPTURE_PPM_HEADER_MAX;
+    measure("ppm_write_fast", width, height, [&]() {
+        ppm_frame.ppm_len = 0;
+        capture_ppm_header(&ppm_frame, comments);
+        capture_frame_ppm(&ppm_frame);
+        capture_ppm_write(&ppm_frame, ppm_name);
+    });
+
+    // send path: old read+realloc+send vs sendmsg from memory
+    if(sink != NULL)
+    {
+        measure("send_read_old", width, height, [&]() {
+            ssize_t size;
+            char *buf = (char *)read_realloc(ppm_name, &size, NETSEND_TRAILER_LEN);
+            buf[size] = '\n';
+            buf[size + 1] = '#';
+            buf[size + 2] = 0x4;
+            int fd = socket(sink->ai_family, sink->ai_socktype, sink->ai_protocol);
+            if(connect(fd, sink->ai_addr, sink->ai_addrlen) == 0)
+            {
+                send_all(fd, buf, size + NETSEND_TRAILER_LEN);
+            }
+            close(fd);
+            free(buf);
+        });
+        measure("send_sendmsg", width, height, [&]() {
+            netsend_image(sink, ppm_frame.ppm, ppm_frame.ppm_len, NULL);
+        });
+    }
+
+    // receive path: aesd_recv realloc loop vs one pooled buffer
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0)
+    {
+        recv_feed_t feed;
+        pthread_t tid;
+        feed.fd = sv[1];
+        feed.image = ppm_frame.ppm;
+        feed.len = ppm_frame.ppm_len;
+        feed.stop = false;
+        sem_init(&feed.go, 0, 0);
+        sem_init(&feed.done, 0, 0);
+        pthread_create(&tid, NULL, recv_feed_thread, &feed);
+
+        measure("recv_realloc_old", width, height, [&]() {
+            sem_post(&feed.go);
+            void *local_buf = malloc(OLD_BUF_SIZE);
+            int num_receive = 1;
+            ssize_t recv_size, total_recv_size = 0;
+            while(true)
+            {
+                recv_size = recv(sv[0], (char *)local_buf + (num_receive - 1)*OLD_BUF_SIZE, OLD_BUF_SIZE, 0);
+                if(recv_size <= 0)
+                {
+                    break;
+                }
+                total_recv_size = (num_receive - 1)*OLD_BUF_SIZE + recv_size;
+                if(((char *)local_buf)[total_recv_size - 1] == 0x4)
+                {
+                    break;
+                }
+                num_receive++;
+                local_buf = realloc(local_buf, num_receive*OLD_BUF_SIZE);
+            }
+            local_buf = realloc(local_buf, total_recv_size - NETSEND_TRAILER_LEN);
+            free(local_buf);
+            sem_post(&feed.done);
+        });
+
+        char *pool_buf = (char *)malloc(RECV_BUF_SIZE);
+        memset(pool_buf, 0, RECV_BUF_SIZE);
+        measure("recv_pool", width, height, [&]() {
+            sem_post(&feed.go);
+            ssize_t recv_size, total_recv_size = 0;
+            while(total_recv_size < RECV_BUF_SIZE)
+            {
+                recv_size = recv(sv[0], pool_buf + total_recv_size, RECV_BUF_SIZE - total_recv_size, 0);
+                if(recv_size <= 0)
+                {
+                    break;
+                }
+                total_recv_size += recv_size;
+                if(pool_buf[total_recv_size - 1] == 0x4)
+                {
+                    break;
+                }
+            }
+            sem_post(&feed.done);
+        });
+
+        feed.stop = true;
+        sem_post(&feed.go);
+        pthread_join(tid, NULL);
+        free(pool_buf);
+        close(sv[0]);
+        close(sv[1]);
+    }
+    free(ppm_buf);
+}
+
+//*****************************************************************************
+//
+// Main
+//
+//*****************************************************************************
+static void print_json(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+    {
+        perror(path);
+        return;
+    }
+    platform_state_t platform;
+    platform_probe(&platform, NULL, 0);
+    fprintf(out, "{\n  \"iterations\": %d,\n  \"platform\": ", iterations);
+    platform_print_json(out, &platform);
+    fprintf(out, ",\n  \"kernels\": [");
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        mb_result_t *r = &results[i];
+        fprintf(out, "%s\n    {\"kernel\": \"%s\", \"width\": %d, \"height\": %d, "
+                "\"min_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"mean_us\": %.1f}",
+                i ? "," : "", r->kernel, r->width, r->height,
+                r->min_us, r->p50_us, r->p99_us, r->mean_us);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, width = 0, height = 0;
+    const char *json = NULL;
+    char sink_port[8];
+    struct addrinfo hints, *sink = NULL;
+
+    while((opt = getopt(argc, argv, "n:W:H:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': iterations = atoi(optarg); break;
+            case 'W': width = atoi(optarg); break;
+            case 'H': height = atoi(optarg); break;
+            case 'o': json = optarg; break;
+            default:
+                printf("usage: %s [-n iterations] [-W width -H height] [-o file.json]\n", argv[0]);
+                printf("  default sizes are 640x480 and 1280x720\n");
+                exit(-1);
+        }
+    }
+    if(iterations <= 0)
+    {
+        iterations = 1;
+    }
+    mkdir(MB_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(netsink_start(sink_port, sizeof(sink_port)) < 0 ||
+       getaddrinfo("127.0.0.1", sink_port, &hints, &sink) != 0)
+    {
+        printf("No loopback sink, send benchmarks skipped\n");
+        sink = NULL;
+    }
+
+    if(width > 0 && height > 0)
+    {
+        run_size(width, height, sink);
+    }
+    else
+    {
+        run_size(640, 480, sink);
+        run_size(1280, 720, sink);
+    }
+
+    if(json != NULL)
+    {
+        print_json(json);
+    }
+    if(sink != NULL)
+    {
+        freeaddrinfo(sink);
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ *
+ *  Client side of the aesd_server image protocol
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "netsend.h"
+#include "fault.h"
+
+#define NETSINK_BUF (64*1024)
+
+// The image, the deadline line and the trailer go out through one sendmsg
+// straight from the caller's buffer, nothing is copied. Returns the bytes
+// sent, trailer included, or -1.
+ssize_t netsend_image(const struct addrinfo *addr, const void *image, size_t len,
+                      const netsend_e2e_t *e2e)
+{
+    static const char trailer[NETSEND_TRAILER_LEN] = {'\n', '#', 0x4};
+    char e2e_line[NETSEND_E2E_MAX];
+    struct iovec iov[3];
+    struct msghdr msg;
+    ssize_t sent = 0, send_size;
+    int sockfd;
+
+    fault_inject(FAULT_NET, "send");
+    /* check NULL */
+    if (addr == NULL)
+    {
+        syslog(LOG_ERR, "client: no server address");
+        return -1;
+    }
+
+    if ((sockfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol)) == -1)
+    {
+        perror("client: socket");
+        return -1;
+    }
+
+    /* Connect to Target ip else just dont send anything*/
+    if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) == -1)
+    {
+        perror("client: connection failed");
+        close(sockfd);
+        return -1;
+    }
+
+    iov[0].iov_base = (void *)image;
+    iov[0].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    if (e2e != NULL)
+    {
+        iov[1].iov_base = e2e_line;
+        iov[1].iov_len = snprintf(e2e_line, sizeof(e2e_line), "\n#E2E frame=%llu release=%lld deadline=%lld",
+                                  e2e->frame, e2e->release_us, e2e->deadline_us);
+        msg.msg_iovlen++;
+    }
+    iov[msg.msg_iovlen].iov_base = (void *)trailer;
+    iov[msg.msg_iovlen].iov_len = sizeof(trailer);
+    msg.msg_iovlen++;
+
+    // a signal can cut a large send short, carry on from where it stopped
+    while (msg.msg_iovlen > 0)
+    {
+        send_size = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (send_size < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("client: send");
+            close(sockfd);
+            return -1;
+        }
+        sent += send_size;
+        while (msg.msg_iovlen > 0 && (size_t)send_size >= msg.msg_iov->iov_len)
+        {
+            send_size -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + send_size;
+            msg.msg_iov->iov_len -= send_size;
+        }
+    }
+
+    close(sockfd);
+    return sent;
+}
+
+//*****************************************************************************
+//
+// Loopback sink
+//
+//*****************************************************************************
+static int sink_fd = -1;
+static volatile unsigned long long sink_images = 0;
+
+static void *netsink_thread(void *arg)
+{
+    static char buf[NETSINK_BUF];
+    ssize_t n;
+    int fd;
+    (void)arg;
+
+    while ((fd = accept(sink_fd, NULL, NULL)) >= 0)
+    {
+        char last = 0;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            last = buf[n - 1];
+        if (last == 0x4) sink_images++;
+        close(fd);
+    }
+    return NULL;
+}
+
+// Listens on a free 127.0.0.1 port, written to port
+int netsink_start(char *port, size_t port_len)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    pthread_t tid;
+    int yes = 1;
+
+    if (sink_fd >= 0)
+    {
+        getsockname(sink_fd, (struct sockaddr *)&addr, &len);
+        snprintf(port, port_len, "%d", ntohs(addr.sin_port));
+        return 0;
+    }
+    sink_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sink_fd < 0) return -1;
+    setsockopt(sink_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;  // any free port
+    if (bind(sink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sink_fd, 16) < 0 ||
+        getsockname(sink_fd, (struct sockaddr *)&addr, &len) < 0)
+    {
+        perror("netsink");
+        close(sink_fd);
+        sink_fd = -1;
+        return -1;
+    }
+    snprintf(port, port_len, "%d", ntohs(addr.sin_port));
+    if (pthread_create(&tid, NULL, netsink_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+unsigned long long netsink_images(void)
+{
+    return sink_images;
+}
@@ -0,0 +1,49 @@
+/*
+ *
+ *  Client side of the aesd_server image protocol
+ *  Most added work done by Chutao
+ *
+ *  One connection per image: the image bytes followed by the '\n''#''EOT'
+ *  trailer, then the client closes. The server looks for the EOT byte at
+ *  the end of what it has received.
+ *
+ *  A frame with a deadline adds one line before the trailer,
+ *  "\n#E2E frame=<seq> release=<usec> deadline=<usec>", times as wall clock
+ *  usec like the server's own stamps. The server strips it and logs how late
+ *  the image was on disk; across two hosts the clocks must be NTP synced.
+ *
+ *  netsink_start() runs a loopback receiver for the benchmarks: it reads
+ *  each connection up to the EOT like aesd_server and throws the data away.
+ */
+#ifndef NETSEND_H
+#define NETSEND_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <netdb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NETSEND_TRAILER_LEN (3)
+#define NETSEND_E2E_MAX     (96)
+
+typedef struct netsend_e2e
+{
+    unsigned long long frame;
+    long long release_us;       // gettimeofday() usec
+    long long deadline_us;
+}netsend_e2e_t;
+
+// e2e may be NULL for images without a deadline
+ssize_t netsend_image(const struct addrinfo *addr, const void *image, size_t len,
+                      const netsend_e2e_t *e2e);
+int netsink_start(char *port, size_t port_len);
+unsigned long long netsink_images(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETSEND_H */
@@ -0,0 +1,147 @@
+/*
+ *
+ *  Sequencer overrun detection and catch-up policy, see overrun.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "overrun.h"
+#include "rtlog.h"
+
+static const char *overrun_names[] = {"skip", "coalesce", "degrade"};
+
+int overrun_parse(const char *arg, int *policy)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (strcmp(arg, overrun_names[i]) == 0)
+        {
+            *policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *overrun_policy_name(int policy)
+{
+    return overrun_names[policy];
+}
+
+void overrun_init(overrun_t *o, int policy)
+{
+    memset(o, 0, sizeof(overrun_t));
+    o->policy = policy;
+}
+
+void overrun_add(overrun_t *o, int id, const char *name, sem_t *release)
+{
+    o->svc[id].name = name;
+    o->svc[id].release = release;
+}
+
+//*****************************************************************************
+//
+// Sequencer
+//
+//*****************************************************************************
+void overrun_tick(overrun_t *o)
+{
+    __atomic_add_fetch(&o->ticks, 1, __ATOMIC_RELEASE);
+}
+
+long long overrun_wake(overrun_t *o, unsigned long long seq)
+{
+    unsigned long long now = __atomic_load_n(&o->ticks, __ATOMIC_ACQUIRE);
+    unsigned long long missed;
+
+    // a tick that came in while the last activation ran was folded into it
+    if (now == o->seen) return -1;
+    missed = now - o->seen - 1;
+    o->seen = now;
+    if (missed > 0)
+    {
+        o->missed += missed;
+        rtlog(LOG_WARNING, "overrun: sequencer missed %llu release(s) before activation %llu", missed, seq);
+    }
+    return (long long)missed;
+}
+
+int overrun_release(overrun_t *o, int id, unsigned long long seq)
+{
+    overrun_service_t *s = &o->svc[id];
+    unsigned long long backlog = s->released - __atomic_load_n(&s->done, __ATOMIC_ACQUIRE);
+
+    if (backlog == 0)
+    {
+        s->released++;
+        sem_post(s->release);
+        return 1;
+    }
+
+    s->overruns++;
+    if (o->policy == OVERRUN_SKIP || backlog > 1)
+    {
+        // skip, or one release is already queued behind the running one
+        if (o->policy == OVERRUN_SKIP) s->skipped++;
+        else s->coalesced++;
+        rtlog(LOG_WARNING, "overrun: %s busy at activation %llu, %llu behind, release %s", s->name, seq,
+              backlog, o->policy == OVERRUN_SKIP ? "skipped" : "coalesced");
+        return 0;
+    }
+    if (o->policy == OVERRUN_DEGRADE && !s->degraded)
+    {
+        s->degraded = 1;
+        rtlog(LOG_WARNING, "overrun: %s busy at activation %llu, optional stages off", s->name, seq);
+    }
+    else
+        rtlog(LOG_WARNING, "overrun: %s busy at activation %llu, release queued", s->name, seq);
+    s->released++;
+    sem_post(s->release);
+    return 1;
+}
+
+//*****************************************************************************
+//
+// Services
+//
+//*****************************************************************************
+int overrun_degraded(overrun_t *o, int id)
+{
+    overrun_service_t *s = &o->svc[id];
+
+    if (!s->degraded) return 0;
+    s->degraded_runs++;
+    return 1;
+}
+
+void overrun_done(overrun_t *o, int id)
+{
+    overrun_service_t *s = &o->svc[id];
+    unsigned long long done = __atomic_add_fetch(&s->done, 1, __ATOMIC_RELEASE);
+
+    // caught up: nothing released that has not run
+    if (s->degraded && done == s->released)
+    {
+        s->degraded = 0;
+        rtlog(LOG_WARNING, "overrun: %s caught up after %llu releases, optional stages on", s->name, done);
+    }
+}
+
+void overrun_print(const overrun_t *o)
+{
+    int i;
+
+    printf("Overruns (policy %s): sequencer missed %llu release(s)\n", overrun_policy_name(o->policy), o->missed);
+    for (i = 0; i < OVERRUN_MAX_SERVICES; i++)
+    {
+        const overrun_service_t *s = &o->svc[i];
+
+        if (s->name == NULL) continue;
+        printf("  %-4s released %llu done %llu  overruns %llu  skipped %llu  coalesced %llu  degraded runs %llu\n",
+               s->name, s->released, s->done, s->overruns, s->skipped, s->coalesced, s->degraded_runs);
+    }
+}
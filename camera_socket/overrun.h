@@ -0,0 +1,86 @@
+/*
+ *
+ *  Sequencer overrun detection and catch-up policy
+ *  Most added work done by Chutao
+ *
+ *  Two things can go wrong with a sequencer release:
+ *
+ *  missed release  the sequencer itself was not waiting when its timer
+ *                  fired, so ticks pile up; they are folded into the
+ *                  activation that finally runs, never replayed back to back
+ *  service overrun a service is still busy with an earlier release when the
+ *                  sequencer wants to release it again
+ *
+ *  For overruns the policy decides what the sequencer does with the release:
+ *
+ *      skip      drop it, the busy service just carries on
+ *      coalesce  keep at most one release queued behind the running one, so
+ *                the service runs once more on the newest frame (default)
+ *      degrade   coalesce, and the service drops its optional stages (saving,
+ *                compression, timelapse, send) until it has caught up
+ *
+ *  so a service is never more than one release behind, and one slow disk
+ *  write cannot turn into seconds of back to back catch-up iterations. Every
+ *  event goes to syslog and is counted for the end of run report.
+ */
+#ifndef OVERRUN_H
+#define OVERRUN_H
+
+#include <semaphore.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OVERRUN_MAX_SERVICES    (8)
+
+#define OVERRUN_SKIP        (0)
+#define OVERRUN_COALESCE    (1)
+#define OVERRUN_DEGRADE     (2)
+
+typedef struct overrun_service
+{
+    const char *name;                   // NULL when the slot is unused
+    sem_t *release;
+    volatile unsigned long long released;   // posted by the sequencer
+    volatile unsigned long long done;       // finished by the service
+    volatile int degraded;                  // optional stages off
+    unsigned long long overruns;        // releases that found the service busy
+    unsigned long long skipped;
+    unsigned long long coalesced;
+    unsigned long long degraded_runs;
+}overrun_service_t;
+
+typedef struct overrun
+{
+    int policy;
+    volatile unsigned long long ticks;  // timer expirations
+    unsigned long long seen;            // ticks the sequencer has accounted for
+    unsigned long long missed;          // ticks folded into a later activation
+    overrun_service_t svc[OVERRUN_MAX_SERVICES];
+}overrun_t;
+
+int overrun_parse(const char *arg, int *policy);
+const char *overrun_policy_name(int policy);
+void overrun_init(overrun_t *o, int policy);
+void overrun_add(overrun_t *o, int id, const char *name, sem_t *release);
+
+// timer side
+void overrun_tick(overrun_t *o);
+// sequencer side: after the wake up, returns the ticks missed since the last
+// activation, or -1 for a wake up whose tick was already folded in (skip it)
+long long overrun_wake(overrun_t *o, unsigned long long seq);
+// releases service id under the policy, 1 when it was released
+int overrun_release(overrun_t *o, int id, unsigned long long seq);
+
+// service side
+int overrun_degraded(overrun_t *o, int id);     // at the start of an activation
+void overrun_done(overrun_t *o, int id);        // at the end of one
+
+void overrun_print(const overrun_t *o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OVERRUN_H */
@@ -0,0 +1,378 @@
+/*
+ *
+ *  Platform setup and verification, see platform.h
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/utsname.h>
+
+#include "platform.h"
+
+#define CPU_DIR         "/sys/devices/system/cpu"
+#define RT_RUNTIME_FILE "/proc/sys/kernel/sched_rt_runtime_us"
+#define RT_PERIOD_FILE  "/proc/sys/kernel/sched_rt_period_us"
+#define IRQ_DIR         "/proc/irq"
+
+// per-CPU interrupts the kernel would not move, found by platform_apply()
+static int irq_unmovable = 0;
+
+//*****************************************************************************
+//
+// sysfs and procfs
+//
+//*****************************************************************************
+static int file_read(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+
+    buf[0] = '\0';
+    if (f == NULL) return -1;
+    if (fgets(buf, len, f) == NULL) buf[0] = '\0';
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static long file_long(const char *path, long def)
+{
+    char buf[32];
+
+    if (file_read(path, buf, sizeof(buf)) < 0 || buf[0] == '\0') return def;
+    return strtol(buf, NULL, 10);
+}
+
+static int file_write(const char *path, const char *val)
+{
+    FILE *f = fopen(path, "w");
+    int rc;
+
+    if (f == NULL) return -1;
+    rc = fputs(val, f) < 0 ? -1 : 0;
+    // sysfs reports a refused value when the write is flushed
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+// Kernel cpu list, offline and out of range CPUs included
+static void cpulist_parse(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    char *end;
+    long first, last, cpu;
+
+    CPU_ZERO(set);
+    while (*p != '\0')
+    {
+        first = strtol(p, &end, 10);
+        if (end == p) return;
+        last = first;
+        p = end;
+        if (*p == '-') last = strtol(p + 1, (char **)&p, 10);
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, set);
+        if (*p != ',') return;
+        p++;
+    }
+}
+
+static void cpulist_format(const cpu_set_t *set, char *buf, size_t len)
+{
+    int cpu, n = 0;
+
+    buf[0] = '\0';
+    for (cpu = 0; cpu < CPU_SETSIZE && n < (int)len - 8; cpu++)
+        if (CPU_ISSET(cpu, set)) n += sprintf(buf + n, "%s%d", n ? "," : "", cpu);
+}
+
+static int platform_present(void)
+{
+    char buf[64];
+    cpu_set_t set;
+    int cpu, count = 0;
+
+    if (file_read(CPU_DIR "/present", buf, sizeof(buf)) < 0) return 1;
+    cpulist_parse(buf, &set);
+    for (cpu = 0; cpu < PLATFORM_MAX_CPUS; cpu++)
+        if (CPU_ISSET(cpu, &set)) count = cpu + 1;
+    return count;
+}
+
+//*****************************************************************************
+//
+// Options
+//
+//*****************************************************************************
+int platform_parse(const char *list, int *flags)
+{
+    const char *p = list;
+    size_t len;
+
+    *flags = 0;
+    while (*p != '\0')
+    {
+        len = strcspn(p, ",");
+        if (len == 5 && strncmp(p, "apply", 5) == 0) *flags |= PLATFORM_APPLY;
+        else if (len == 6 && strncmp(p, "strict", 6) == 0) *flags |= PLATFORM_STRICT;
+        else if (len != 4 || strncmp(p, "warn", 4) != 0) return -1;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+//*****************************************************************************
+//
+// Apply, as root
+//
+//*****************************************************************************
+static int apply_cpu(int cpu)
+{
+    char path[96], buf[256], max[32];
+    int failed = 0;
+
+    // cpu0 usually has no online file, it cannot go offline
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/online", cpu);
+    if (file_long(path, 1) != 1 && file_write(path, "1") < 0) failed++;
+
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+    if (file_read(path, max, sizeof(max)) < 0) return failed;
+
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_available_governors", cpu);
+    file_read(path, buf, sizeof(buf));
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_governor", cpu);
+    if (strstr(buf, "performance") != NULL)
+    {
+        if (file_write(path, "performance") < 0) failed++;
+    }
+    else if (file_write(path, "userspace") < 0)
+        failed++;
+    else
+    {
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_setspeed", cpu);
+        if (file_write(path, max) < 0) failed++;
+    }
+
+    // max first, a min above the current max is refused
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_max_freq", cpu);
+    if (file_write(path, max) < 0) failed++;
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_min_freq", cpu);
+    if (file_write(path, max) < 0) failed++;
+    return failed;
+}
+
+static int apply_irqs(const cpu_set_t *rt_cpus, const cpu_set_t *be_cpus)
+{
+    char path[320], buf[256], list[256];
+    unsigned long mask = 0;
+    cpu_set_t target, set;
+    struct dirent *d;
+    DIR *dir;
+    int cpu, failed = 0;
+
+    CPU_ZERO(&target);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, be_cpus) && !CPU_ISSET(cpu, rt_cpus)) CPU_SET(cpu, &target);
+    if (CPU_COUNT(&target) == 0)
+    {
+        printf("platform: every CPU is an RT core, IRQs left where they are\n");
+        return 1;
+    }
+    cpulist_format(&target, list, sizeof(list));
+    for (cpu = 0; cpu < (int)sizeof(mask)*8; cpu++)
+        if (CPU_ISSET(cpu, &target)) mask |= 1UL << cpu;
+    snprintf(buf, sizeof(buf), "%lx", mask);
+    if (file_write(IRQ_DIR "/default_smp_affinity", buf) < 0) failed++;
+
+    irq_unmovable = 0;
+    if ((dir = opendir(IRQ_DIR)) == NULL) return failed + 1;
+    while ((d = readdir(dir)) != NULL)
+    {
+        if (!isdigit((unsigned char)d->d_name[0])) continue;
+        snprintf(path, sizeof(path), IRQ_DIR "/%s/smp_affinity_list", d->d_name);
+        if (file_read(path, buf, sizeof(buf)) < 0) continue;
+        cpulist_parse(buf, &set);
+        CPU_AND(&set, &set, rt_cpus);
+        if (CPU_COUNT(&set) == 0) continue;
+        // per-CPU interrupts (timers, IPIs) refuse with EIO
+        if (file_write(path, list) < 0) irq_unmovable++;
+    }
+    closedir(dir);
+    return failed;
+}
+
+int platform_apply(const cpu_set_t *rt_cpus, const cpu_set_t *be_cpus)
+{
+    int cpu, cpus = platform_present(), failed = 0;
+
+    for (cpu = 0; cpu < cpus; cpu++) failed += apply_cpu(cpu);
+    if (file_write(RT_RUNTIME_FILE, "-1") < 0) failed++;
+    // inherited by every thread created after this
+    if (prctl(PR_SET_TIMERSLACK, (unsigned long)PLATFORM_TIMER_SLACK_NS, 0, 0, 0) < 0) failed++;
+    failed += apply_irqs(rt_cpus, be_cpus);
+    if (failed > 0) printf("platform: %d setting(s) could not be applied, not root?\n", failed);
+    return failed;
+}
+
+//*****************************************************************************
+//
+// Probe
+//
+//*****************************************************************************
+// Interrupts with a handler (a subdirectory named after it) that may fire
+// on an RT core
+static void probe_irqs(platform_state_t *p, const cpu_set_t *rt_cpus)
+{
+    char path[320], buf[256];
+    struct dirent *d, *h;
+    cpu_set_t set;
+    DIR *dir, *irq;
+    int handled;
+
+    if ((dir = opendir(IRQ_DIR)) == NULL) return;
+    while ((d = readdir(dir)) != NULL)
+    {
+        if (!isdigit((unsigned char)d->d_name[0])) continue;
+        snprintf(path, sizeof(path), IRQ_DIR "/%s", d->d_name);
+        if ((irq = opendir(path)) == NULL) continue;
+        handled = 0;
+        while ((h = readdir(irq)) != NULL)
+            if (h->d_type == DT_DIR && h->d_name[0] != '.') handled = 1;
+        closedir(irq);
+        if (!handled) continue;
+        p->irqs++;
+
+        // where it is routed now, when the kernel tells
+        snprintf(path, sizeof(path), IRQ_DIR "/%s/effective_affinity_list", d->d_name);
+        if (file_read(path, buf, sizeof(buf)) < 0 || buf[0] == '\0')
+        {
+            snprintf(path, sizeof(path), IRQ_DIR "/%s/smp_affinity_list", d->d_name);
+            if (file_read(path, buf, sizeof(buf)) < 0) continue;
+        }
+        cpulist_parse(buf, &set);
+        CPU_AND(&set, &set, rt_cpus);
+        if (CPU_COUNT(&set) > 0) p->irqs_on_rt++;
+    }
+    closedir(dir);
+}
+
+#define ISSUE(...) do { p->issues++; if (verbose) printf("Warning: platform: " __VA_ARGS__); } while (0)
+
+int platform_probe(platform_state_t *p, const cpu_set_t *rt_cpus, int verbose)
+{
+    char path[96], buf[64];
+    struct utsname uts;
+    cpu_set_t online;
+    int cpu;
+
+    memset(p, 0, sizeof(platform_state_t));
+    p->cpus = platform_present();
+    if (file_read(CPU_DIR "/online", buf, sizeof(buf)) < 0) strcpy(buf, "0");
+    cpulist_parse(buf, &online);
+    for (cpu = 0; cpu < p->cpus; cpu++)
+    {
+        platform_cpu_t *c = &p->cpu[cpu];
+
+        c->online = CPU_ISSET(cpu, &online) != 0;
+        if (!c->online) ISSUE("cpu%d is offline\n", cpu);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_governor", cpu);
+        if (file_read(path, c->governor, sizeof(c->governor)) < 0) continue;
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        c->cur_khz = file_long(path, -1);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_min_freq", cpu);
+        c->min_khz = file_long(path, -1);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/scaling_max_freq", cpu);
+        c->max_khz = file_long(path, -1);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+        c->hw_max_khz = file_long(path, -1);
+        if (strcmp(c->governor, "performance") != 0 && strcmp(c->governor, "userspace") != 0)
+            ISSUE("cpu%d governor is %s\n", cpu, c->governor);
+        if (c->min_khz != c->max_khz)
+            ISSUE("cpu%d frequency scales between %ld and %ld kHz\n", cpu, c->min_khz, c->max_khz);
+        else if (c->max_khz != c->hw_max_khz)
+            ISSUE("cpu%d pinned at %ld kHz, below its %ld kHz maximum\n", cpu, c->max_khz, c->hw_max_khz);
+    }
+
+    p->rt_runtime_us = file_long(RT_RUNTIME_FILE, 0);
+    p->rt_period_us = file_long(RT_PERIOD_FILE, 0);
+    if (p->rt_runtime_us != -1)
+        ISSUE("RT throttling on, %ld of every %ld us\n", p->rt_runtime_us, p->rt_period_us);
+
+    p->timer_slack_ns = (unsigned long)prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    if (p->timer_slack_ns > PLATFORM_TIMER_SLACK_NS)
+        ISSUE("timer slack %lu ns\n", p->timer_slack_ns);
+
+    if (rt_cpus != NULL) probe_irqs(p, rt_cpus);
+    p->irqs_pinned = irq_unmovable < p->irqs_on_rt ? irq_unmovable : p->irqs_on_rt;
+    if (p->irqs_on_rt > p->irqs_pinned)
+        ISSUE("%d IRQ(s) can run on the RT cores\n", p->irqs_on_rt - p->irqs_pinned);
+
+    p->preempt = "none";
+    if (uname(&uts) == 0)
+    {
+        snprintf(p->kernel, sizeof(p->kernel), "%s %s", uts.release, uts.version);
+        if (strstr(uts.version, "PREEMPT_RT") != NULL || strstr(uts.version, " RT ") != NULL)
+            p->preempt = "PREEMPT_RT";
+        else if (strstr(uts.version, "PREEMPT") != NULL)
+            p->preempt = "PREEMPT";
+    }
+    // not something a run can fix, so only a note
+    if (verbose && strcmp(p->preempt, "PREEMPT_RT") != 0)
+        printf("Note: platform: kernel is not PREEMPT_RT (%s)\n", p->preempt);
+    return p->issues;
+}
+
+//*****************************************************************************
+//
+// Report
+//
+//*****************************************************************************
+void platform_print(const platform_state_t *p)
+{
+    int cpu;
+
+    printf("Platform: %s, %d issue(s)\n", p->issues ? "NOT deterministic" : "deterministic", p->issues);
+    printf("  kernel %s (%s)\n", p->kernel, p->preempt);
+    for (cpu = 0; cpu < p->cpus; cpu++)
+    {
+        const platform_cpu_t *c = &p->cpu[cpu];
+
+        if (c->governor[0] == '\0')
+            printf("  cpu%d %-7s governor n/a\n", cpu, c->online ? "online" : "offline");
+        else
+            printf("  cpu%d %-7s governor %-12s cur %7ld  min %7ld  max %7ld  hw max %7ld kHz\n", cpu,
+                   c->online ? "online" : "offline", c->governor, c->cur_khz, c->min_khz, c->max_khz,
+                   c->hw_max_khz);
+    }
+    printf("  sched_rt_runtime_us %ld of %ld, timer slack %lu ns\n", p->rt_runtime_us, p->rt_period_us,
+           p->timer_slack_ns);
+    printf("  IRQs %d, on RT cores %d (%d per-CPU, cannot move)\n", p->irqs, p->irqs_on_rt, p->irqs_pinned);
+}
+
+void platform_print_json(FILE *out, const platform_state_t *p)
+{
+    int cpu;
+
+    fprintf(out, "{\"deterministic\": %s, \"issues\": %d, \"kernel\": \"%s\", \"preempt\": \"%s\",\n",
+            p->issues ? "false" : "true", p->issues, p->kernel, p->preempt);
+    fprintf(out, "    \"rt_runtime_us\": %ld, \"rt_period_us\": %ld, \"timer_slack_ns\": %lu,"
+            " \"irqs\": %d, \"irqs_on_rt\": %d,\n    \"cpus\": [", p->rt_runtime_us, p->rt_period_us,
+            p->timer_slack_ns, p->irqs, p->irqs_on_rt);
+    for (cpu = 0; cpu < p->cpus; cpu++)
+    {
+        const platform_cpu_t *c = &p->cpu[cpu];
+
+        fprintf(out, "%s\n      {\"cpu\": %d, \"online\": %s, \"governor\": \"%s\", \"cur_khz\": %ld,"
+                " \"min_khz\": %ld, \"max_khz\": %ld}", cpu ? "," : "", cpu, c->online ? "true" : "false",
+                c->governor[0] ? c->governor : "n/a", c->cur_khz, c->min_khz, c->max_khz);
+    }
+    fprintf(out, "\n    ]}");
+}
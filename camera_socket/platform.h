@@ -0,0 +1,82 @@
+/*
+ *
+ *  Platform setup and verification, what myscript-2.sh used to do
+ *  Most added work done by Chutao
+ *
+ *  Timing numbers only mean something on a platform in deterministic mode:
+ *
+ *      governor        performance, or userspace at the highest speed
+ *      frequency       scaling_min_freq == scaling_max_freq, no scaling
+ *      CPUs            every present CPU online
+ *      RT throttling   off, kernel.sched_rt_runtime_us = -1
+ *      timer slack     1 ns for the process (RT threads have none anyway)
+ *      IRQ affinity    no device interrupt on the RT cores
+ *
+ *  platform_probe() reads all of it back and counts what is not in place,
+ *  platform_apply() sets it (as root) the way the script did. The probed
+ *  state goes into the run report next to the numbers it was measured with.
+ *  Machines without cpufreq (VMs) report the frequency as n/a, not as an
+ *  issue. Per-CPU interrupts the kernel refuses to move are reported but not
+ *  counted either.
+ */
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PLATFORM_MAX_CPUS   (16)
+#define PLATFORM_TIMER_SLACK_NS (1)
+
+#define PLATFORM_APPLY      (1)
+#define PLATFORM_STRICT     (2)     // refuse to run unless deterministic
+
+typedef struct platform_cpu
+{
+    int online;
+    char governor[24];          // "" = no cpufreq
+    long cur_khz;
+    long min_khz;
+    long max_khz;
+    long hw_max_khz;            // cpuinfo_max_freq
+}platform_cpu_t;
+
+typedef struct platform_state
+{
+    int cpus;                   // present
+    platform_cpu_t cpu[PLATFORM_MAX_CPUS];
+    long rt_runtime_us;
+    long rt_period_us;
+    unsigned long timer_slack_ns;
+    int irqs;                   // with a handler
+    int irqs_on_rt;             // of those, allowed on an RT core
+    int irqs_pinned;            // per-CPU ones platform_apply() could not move
+    char kernel[136];           // release and version
+    const char *preempt;        // PREEMPT_RT, PREEMPT or none
+    int issues;
+}platform_state_t;
+
+// "warn" (default), "apply" and/or "strict", comma separated
+int platform_parse(const char *list, int *flags);
+
+// Number of settings that failed; IRQs go from rt_cpus to be_cpus
+int platform_apply(const cpu_set_t *rt_cpus, const cpu_set_t *be_cpus);
+// Fills p, returns p->issues; verbose prints a warning per issue, rt_cpus
+// NULL leaves the IRQs out (the benchmarks have no RT cores)
+int platform_probe(platform_state_t *p, const cpu_set_t *rt_cpus, int verbose);
+
+void platform_print(const platform_state_t *p);
+void platform_print_json(FILE *out, const platform_state_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLATFORM_H */
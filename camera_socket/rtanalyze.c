@@ -0,0 +1,242 @@
+/*
+ *
+ *  Offline schedulability analysis of recorded service traces
+ *  Most added work done by Chutao
+ *
+ *  Reads record.csv (or any trace in that format, see trace.h), takes the
+ *  observed WCET and period of every service and runs the tests from class
+ *  on them, for one core and rate monotonic priorities (shorter T first,
+ *  equal T in order of appearance, which is the sequencer, S1, S2 order
+ *  seqgen uses):
+ *
+ *      RM LUB      U <= n(2^(1/n) - 1), sufficient
+ *      RTA         exact response time, R = C + sum ceil(R/Tj)*Cj over
+ *                  the higher priorities, feasible when every R <= D
+ *      EDF         U <= 1 (D = T)
+ *
+ *  plus the slack D - R of each service and the fastest sequencer rate each
+ *  test still accepts, with every service kept at its ratio to the
+ *  sequencer and the measured C unchanged.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "latency.h"
+
+#define RTA_MAX_ITER        (1000)
+#define RATE_SEARCH_STEPS   (60)
+
+typedef struct rta_task
+{
+    int svc;            // index in the trace
+    double C;           // ms
+    double T;
+    double D;
+}rta_task_t;
+
+//*****************************************************************************
+//
+// Tests
+//
+//*****************************************************************************
+static double rm_lub(int n)
+{
+    return n*(pow(2.0, 1.0/n) - 1.0);
+}
+
+static double utilization(const rta_task_t *task, int n, double scale)
+{
+    double u = 0.0;
+    int i;
+
+    for (i = 0; i < n; i++) u += task[i].C/(task[i].T/scale);
+    return u;
+}
+
+// Response time of task i with the periods divided by scale, -1 when it
+// passes its deadline
+static double rta_response(const rta_task_t *task, int i, double scale)
+{
+    double D = task[i].D/scale;
+    double R = 0.0, next;
+    int j, iter;
+
+    for (j = 0; j <= i; j++) R += task[j].C;
+    for (iter = 0; iter < RTA_MAX_ITER; iter++)
+    {
+        if (R > D) return -1.0;
+        next = task[i].C;
+        for (j = 0; j < i; j++)
+            next += ceil(R/(task[j].T/scale) - 1e-9)*task[j].C;
+        if (next <= R) return R;
+        R = next;
+    }
+    return -1.0;
+}
+
+static int rta_feasible(const rta_task_t *task, int n, double scale)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (rta_response(task, i, scale) < 0) return 0;
+    return 1;
+}
+
+// Largest rate multiplier RTA accepts; feasibility only gets worse as the
+// periods shrink, so a bisection between the EDF bound and 0 finds it
+static double rta_max_scale(const rta_task_t *task, int n)
+{
+    double u = utilization(task, n, 1.0);
+    double lo = 0.0, hi = u > 0 ? 1.0/u : 1e6;
+    int step;
+
+    if (rta_feasible(task, n, hi)) return hi;
+    for (step = 0; step < RATE_SEARCH_STEPS; step++)
+    {
+        double mid = (lo + hi)/2;
+
+        if (rta_feasible(task, n, mid)) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+//*****************************************************************************
+//
+// Report
+//
+//*****************************************************************************
+static void print_observed(const trace_t *t)
+{
+    int i;
+
+    printf("Observed (%llu rows, %llu skipped)\n", t->rows, t->skipped);
+    printf("  %-8s %9s %7s %8s %7s %7s %9s %7s\n", "service", "n", "T ms", "C avg", "C p99", "WCET", "resp max", "misses");
+    for (i = 0; i < t->count; i++)
+    {
+        const trace_service_t *s = &t->svc[i];
+
+        printf("  %-8s %9llu %7d %8.2f %7d %7d %9d %7llu\n", s->name, s->n, s->T,
+               (double)s->c_sum/s->n, trace_c_percentile(s, 99.0), s->c_max, s->resp_max, s->misses);
+    }
+}
+
+static void print_usage(char *prog)
+{
+    printf("usage: %s [-q sequencer] [-m margin%%] [-p percentile] [trace.csv|-]\n", prog);
+    printf("  -q names the service the others are released by (default Seq), its rate is scaled\n");
+    printf("  -m adds a margin to every C, -p uses a percentile of C instead of the WCET\n");
+    printf("  the trace defaults to ./record.csv, - reads stdin\n");
+}
+
+int main(int argc, char *argv[])
+{
+    trace_t trace;
+    rta_task_t task[TRACE_MAX_SERVICES], tmp;
+    const char *path = "record.csv", *seq_name = "Seq";
+    double margin = 0.0, pct = 100.0;
+    double u, lub, scale, seq_T, slack_min = 1e30;
+    unsigned long long t0, t1;
+    int opt, n, i, j, seq, feasible = 1;
+
+    while ((opt = getopt(argc, argv, "q:m:p:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'q': seq_name = optarg; break;
+            case 'm': margin = atof(optarg); break;
+            case 'p': pct = atof(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (optind < argc) path = argv[optind];
+
+    t0 = latency_now();
+    if (trace_load(&trace, path) < 0)
+    {
+        perror(path);
+        exit(-1);
+    }
+    t1 = latency_now();
+    if (trace.count == 0)
+    {
+        printf("No service rows in %s\n", path);
+        exit(-1);
+    }
+    printf("%s: %llu rows parsed in %.1f ms\n\n", path, trace.rows + trace.skipped, (t1 - t0)/1e6);
+    print_observed(&trace);
+
+    // rate monotonic order, stable so equal periods keep the trace order
+    n = trace.count;
+    for (i = 0; i < n; i++)
+    {
+        const trace_service_t *s = &trace.svc[i];
+        double c = pct >= 100.0 ? s->c_max : trace_c_percentile(s, pct);
+
+        task[i].svc = i;
+        task[i].C = c*(100.0 + margin)/100.0;
+        task[i].T = s->T;
+        task[i].D = s->T;
+    }
+    for (i = 1; i < n; i++)
+    {
+        tmp = task[i];
+        for (j = i - 1; j >= 0 && task[j].T > tmp.T; j--) task[j+1] = task[j];
+        task[j+1] = tmp;
+    }
+
+    u = utilization(task, n, 1.0);
+    lub = rm_lub(n);
+    printf("\nAnalysis, one core, C = %s%s\n", pct >= 100.0 ? "WCET" : "percentile", margin > 0 ? " + margin" : "");
+    if (pct < 100.0) printf("  C percentile %.1f\n", pct);
+    if (margin > 0) printf("  margin %.1f%%\n", margin);
+    printf("  %-8s %4s %8s %7s %7s %9s %9s\n", "service", "prio", "C ms", "T ms", "U", "R ms", "slack ms");
+    for (i = 0; i < n; i++)
+    {
+        double R = rta_response(task, i, 1.0);
+
+        if (R < 0)
+        {
+            feasible = 0;
+            printf("  %-8s %4d %8.2f %7.0f %7.4f %9s %9s\n", trace.svc[task[i].svc].name, i, task[i].C,
+                   task[i].T, task[i].C/task[i].T, "> D", "-");
+            continue;
+        }
+        if (task[i].D - R < slack_min) slack_min = task[i].D - R;
+        printf("  %-8s %4d %8.2f %7.0f %7.4f %9.2f %9.2f\n", trace.svc[task[i].svc].name, i, task[i].C,
+               task[i].T, task[i].C/task[i].T, R, task[i].D - R);
+    }
+    printf("  U %.4f\n", u);
+    printf("  RM LUB  %.4f for %d services: %s\n", lub, n, u <= lub ? "feasible" : "inconclusive");
+    printf("  RTA     %s", feasible ? "feasible" : "infeasible");
+    if (feasible) printf(", least slack %.2f ms", slack_min);
+    printf("\n  EDF     %s\n", u <= 1.0 ? "feasible" : "infeasible");
+
+    // the sequencer's period sets everybody's, scale all rates together
+    seq = trace_find(&trace, seq_name);
+    seq_T = seq >= 0 ? trace.svc[seq].T : task[0].T;
+    if (seq < 0) printf("\nNo %s rows, rates relative to the shortest period\n", seq_name);
+    printf("\nHighest sustainable sequencer rate (now %.3f Hz)\n", 1000.0/seq_T);
+    if (u <= 0.0)
+    {
+        printf("  unbounded, every C is 0 at the record's 1 ms resolution\n");
+    }
+    else
+    {
+        scale = rta_max_scale(task, n);
+        printf("  RM LUB  %.3f Hz\n", lub/u*1000.0/seq_T);
+        printf("  RTA     %.3f Hz\n", scale*1000.0/seq_T);
+        printf("  EDF     %.3f Hz\n", 1.0/u*1000.0/seq_T);
+    }
+
+    trace_free(&trace);
+    return feasible ? 0 : 1;
+}
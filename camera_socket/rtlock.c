@@ -0,0 +1,118 @@
+/*
+ *
+ *  Priority inheriting locks with a contention profile, see rtlock.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "rtlock.h"
+#include "latency.h"
+
+static rtlock_stats_t rtlock_table[RTLOCK_MAX];
+static int rtlock_count;
+static pthread_mutex_t rtlock_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int rtlock_init(rtlock_t *l, const char *name)
+{
+    pthread_mutexattr_t attr;
+    int rc;
+
+    memset(l, 0, sizeof(rtlock_t));
+    pthread_mutexattr_init(&attr);
+    rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    if (rc != 0)
+        printf("rtlock %s: no priority inheritance: %s\n", name, strerror(rc));
+    rc = pthread_mutex_init(&l->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) return -1;
+
+#ifndef RTLOCK_NO_PROFILE
+    // init time only, never on an RT path
+    pthread_mutex_lock(&rtlock_table_lock);
+    if (rtlock_count < RTLOCK_MAX)
+    {
+        l->stats = &rtlock_table[rtlock_count++];
+        snprintf(l->stats->name, RTLOCK_NAME_MAX, "%s", name);
+    }
+    pthread_mutex_unlock(&rtlock_table_lock);
+#endif
+    return 0;
+}
+
+void rtlock_destroy(rtlock_t *l)
+{
+    // the stats slot stays for the report
+    pthread_mutex_destroy(&l->mutex);
+}
+
+void rtlock_lock(rtlock_t *l)
+{
+#ifndef RTLOCK_NO_PROFILE
+    unsigned long long start, wait;
+
+    if (l->stats == NULL)
+    {
+        pthread_mutex_lock(&l->mutex);
+        return;
+    }
+    if (pthread_mutex_trylock(&l->mutex) == 0)
+    {
+        l->locked_at = latency_now();
+        l->stats->acquired++;
+        return;
+    }
+    start = latency_now();
+    pthread_mutex_lock(&l->mutex);
+    l->locked_at = latency_now();
+    wait = l->locked_at - start;
+
+    // the counters are only touched with the lock held
+    l->stats->acquired++;
+    l->stats->contended++;
+    l->stats->wait_sum_ns += wait;
+    if (wait > l->stats->wait_max_ns) l->stats->wait_max_ns = wait;
+#else
+    pthread_mutex_lock(&l->mutex);
+#endif
+}
+
+void rtlock_unlock(rtlock_t *l)
+{
+#ifndef RTLOCK_NO_PROFILE
+    if (l->stats != NULL)
+    {
+        unsigned long long hold = latency_now() - l->locked_at;
+
+        l->stats->hold_sum_ns += hold;
+        if (hold > l->stats->hold_max_ns) l->stats->hold_max_ns = hold;
+    }
+#endif
+    pthread_mutex_unlock(&l->mutex);
+}
+
+void rtlock_print_report(void)
+{
+    int i;
+
+    pthread_mutex_lock(&rtlock_table_lock);
+    if (rtlock_count == 0)
+    {
+        pthread_mutex_unlock(&rtlock_table_lock);
+        return;
+    }
+    printf("Lock contention (priority inheritance)\n");
+    printf("  %-20s %10s %10s %7s %11s %11s %11s %11s\n", "lock", "acquired", "contended", "%",
+           "wait avg", "wait max", "hold avg", "hold max");
+    for (i = 0; i < rtlock_count; i++)
+    {
+        rtlock_stats_t *s = &rtlock_table[i];
+
+        if (s->acquired == 0) continue;
+        printf("  %-20s %10llu %10llu %6.2f%% %8.1f us %8.1f us %8.1f us %8.1f us\n", s->name, s->acquired,
+               s->contended, 100.0*s->contended/s->acquired,
+               s->contended ? s->wait_sum_ns/1e3/s->contended : 0.0, s->wait_max_ns/1e3,
+               s->hold_sum_ns/1e3/s->acquired, s->hold_max_ns/1e3);
+    }
+    pthread_mutex_unlock(&rtlock_table_lock);
+}
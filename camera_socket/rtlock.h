@@ -0,0 +1,59 @@
+/*
+ *
+ *  Priority inheriting locks with a contention profile
+ *  Most added work done by Chutao
+ *
+ *  Every mutex an RT service shares with a lower priority thread (the frame
+ *  pool free list, the worker pool deques) is an rtlock: a pthread mutex
+ *  with PTHREAD_PRIO_INHERIT, so a best-effort worker holding it runs at the
+ *  waiter's priority until it lets go, and a medium priority thread cannot
+ *  stretch the RT service's blocking time.
+ *
+ *  Each lock also counts acquisitions, how many had to wait, and the wait
+ *  and hold times (CLOCK_MONOTONIC, latency_now()). An uncontended
+ *  acquisition costs one clock read on each side. The counters live in a
+ *  static table that outlives the locks, so rtlock_print_report() at the
+ *  end of a run also covers pools already destroyed. make LOCK_PROFILE=0
+ *  builds plain PI mutexes without the counters.
+ */
+#ifndef RTLOCK_H
+#define RTLOCK_H
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTLOCK_MAX          (64)
+#define RTLOCK_NAME_MAX     (32)
+
+typedef struct rtlock_stats
+{
+    char name[RTLOCK_NAME_MAX];
+    unsigned long long acquired;
+    unsigned long long contended;   // trylock failed, had to block
+    unsigned long long wait_sum_ns;
+    unsigned long long wait_max_ns;
+    unsigned long long hold_sum_ns;
+    unsigned long long hold_max_ns;
+}rtlock_stats_t;
+
+typedef struct rtlock
+{
+    pthread_mutex_t mutex;
+    rtlock_stats_t *stats;          // slot in the report table, NULL when it is full
+    unsigned long long locked_at;   // written by the holder only
+}rtlock_t;
+
+int rtlock_init(rtlock_t *l, const char *name);
+void rtlock_destroy(rtlock_t *l);
+void rtlock_lock(rtlock_t *l);
+void rtlock_unlock(rtlock_t *l);
+void rtlock_print_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTLOCK_H */
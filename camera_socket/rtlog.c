@@ -0,0 +1,177 @@
+/*
+ *
+ *  Deferred syslog for the RT threads, see rtlog.h
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "rtlog.h"
+
+// Bounded queue, many producers and the drain thread as the only consumer.
+// A slot is free for the producer that reserves index pos when its seq is pos,
+// and holds a message for the consumer when its seq is pos + 1.
+typedef struct rtlog_slot
+{
+    volatile unsigned long seq;
+    int priority;
+    char msg[RTLOG_MSG_MAX];
+}rtlog_slot_t;
+
+static rtlog_slot_t *slots;
+static unsigned long head;              // next index to reserve, producers
+static unsigned long tail;              // next index to log, drain thread only
+static unsigned long dropped;
+static volatile int running;
+static volatile int stop;
+static sem_t wake;
+static pthread_t thread;
+
+//*****************************************************************************
+//
+// Drain thread
+//
+//*****************************************************************************
+static void rtlog_drain(void)
+{
+    rtlog_slot_t *s = &slots[tail & (RTLOG_SLOTS - 1)];
+
+    while (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == tail + 1)
+    {
+        syslog(s->priority, "%s", s->msg);
+        __atomic_store_n(&s->seq, tail + RTLOG_SLOTS, __ATOMIC_RELEASE);
+        tail++;
+        s = &slots[tail & (RTLOG_SLOTS - 1)];
+    }
+}
+
+static void *rtlog_thread(void *arg)
+{
+    while (!stop)
+    {
+        sem_wait(&wake);
+        rtlog_drain();
+    }
+    rtlog_drain();
+    pthread_exit((void *)0);
+}
+
+//*****************************************************************************
+//
+// Public interface
+//
+//*****************************************************************************
+int rtlog_init(const cpu_set_t *cpus)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    unsigned long i;
+    int rc;
+
+    // all of it touched now, the RT threads only fill it in
+    slots = calloc(RTLOG_SLOTS, sizeof(rtlog_slot_t));
+    if (slots == NULL)
+    {
+        printf("rtlog: no memory for %d messages\n", RTLOG_SLOTS);
+        return -1;
+    }
+    memset(slots, 0, RTLOG_SLOTS*sizeof(rtlog_slot_t));
+    for (i = 0; i < RTLOG_SLOTS; i++) slots[i].seq = i;
+    head = tail = dropped = 0;
+    stop = 0;
+    if (sem_init(&wake, 0, 0))
+    {
+        printf("rtlog: failed to initialize semaphore\n");
+        free(slots);
+        slots = NULL;
+        return -1;
+    }
+
+    // best effort like the worker pool: SCHED_OTHER, off the RT cores
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    if (cpus != NULL && CPU_COUNT(cpus) > 0)
+    {
+        rc = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+        if (rc != 0) printf("rtlog: cannot set affinity (%s)\n", strerror(rc));
+    }
+    rc = pthread_create(&thread, &attr, rtlog_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0)
+    {
+        printf("rtlog: pthread_create failed (%s)\n", strerror(rc));
+        sem_destroy(&wake);
+        free(slots);
+        slots = NULL;
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+// Only once the RT threads are done, a message still being formatted would
+// be lost
+void rtlog_close(void)
+{
+    if (!running) return;
+    running = 0;
+    stop = 1;
+    sem_post(&wake);
+    pthread_join(thread, NULL);
+    if (dropped > 0) printf("rtlog: %lu messages dropped, ring full\n", dropped);
+    sem_destroy(&wake);
+    free(slots);
+    slots = NULL;
+}
+
+void rtlog(int priority, const char *fmt, ...)
+{
+    unsigned long pos, seq;
+    rtlog_slot_t *s;
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (!running)
+    {
+        vsyslog(priority, fmt, ap);
+        va_end(ap);
+        return;
+    }
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (1)
+    {
+        s = &slots[pos & (RTLOG_SLOTS - 1)];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos)
+        {
+            // pos is reloaded when another producer got there first
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((long)(seq - pos) < 0)
+        {
+            // the drain thread is a whole ring behind
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            va_end(ap);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+    s->priority = priority;
+    vsnprintf(s->msg, sizeof(s->msg), fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&wake);
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ *  Deferred syslog for the RT threads
+ *  Most added work done by Chutao
+ *
+ *  syslog() formats, takes a lock and writes to a socket, none of which
+ *  belongs on an RT core. rtlog() only formats into a slot of a ring
+ *  allocated up front and wakes a best-effort thread that makes the syslog()
+ *  call. The ring never blocks: a message that finds it full is dropped and
+ *  counted. Before rtlog_init() (and in the tools that never call it) rtlog()
+ *  is plain syslog().
+ */
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <syslog.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTLOG_SLOTS     (256)       // power of two
+#define RTLOG_MSG_MAX   (160)
+
+// Starts the drain thread, SCHED_OTHER on cpus (NULL: anywhere)
+int rtlog_init(const cpu_set_t *cpus);
+// Logs what is still queued, then stops the thread
+void rtlog_close(void);
+
+// Any thread, never blocks
+void rtlog(int priority, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTLOG_H */
@@ -0,0 +1,203 @@
+/*
+ *
+ *  Memory setup for the RT threads: locked and pre-faulted memory, and a
+ *  debug check for heap allocations after warm-up
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rtmem.h"
+
+//*****************************************************************************
+//
+// Locking and pre-faulting
+//
+//*****************************************************************************
+
+// Touch every page so it is resident before the RT loop starts
+void *rtmem_prefault(void *buf, size_t size)
+{
+    size_t i;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (buf == NULL) return NULL;
+    for (i = 0; i < size; i += page)
+        ((volatile char *)buf)[i] = 0;
+    return buf;
+}
+
+int rtmem_lock(void)
+{
+    void *heap;
+    int rc = 0;
+
+    // Keep the heap in one locked arena that never shrinks, and serve even
+    // large blocks from it instead of fresh (unfaulted) mmap regions
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    if (mlockall(MCL_CURRENT|MCL_FUTURE) != 0)
+    {
+        perror("mlockall, RT threads may page fault");
+        rc = -1;
+    }
+
+    // grow the heap once, freeing it leaves the pages resident and locked
+    heap = rtmem_prefault(malloc(RT_HEAP_PREFAULT), RT_HEAP_PREFAULT);
+    if (heap == NULL)
+    {
+        printf("Cannot pre-fault %d bytes of heap\n", RT_HEAP_PREFAULT);
+        rc = -1;
+    }
+    free(heap);
+
+    return rc;
+}
+
+void rtmem_prefault_stack(void)
+{
+    volatile char stack[RT_STACK_PREFAULT];
+
+    rtmem_prefault((void *)stack, sizeof(stack));
+}
+
+//*****************************************************************************
+//
+// Allocation check
+//
+//*****************************************************************************
+#ifdef RT_ALLOC_CHECK
+typedef struct rtmem_stat
+{
+    const char *name;
+    volatile unsigned long count;
+    void *first_caller;
+    size_t first_size;
+}rtmem_stat_t;
+
+static rtmem_stat_t rtmem_stats[RTMEM_MAX_THREADS];
+static volatile int rtmem_num_stats = 0;
+static __thread int rtmem_slot = -1;
+static __thread int rtmem_armed = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+// Must not allocate or print: it runs inside malloc
+static inline void rtmem_note(size_t size, void *caller)
+{
+    rtmem_stat_t *stat;
+
+    if (!rtmem_armed) return;
+    stat = &rtmem_stats[rtmem_slot];
+    if (stat->count == 0)
+    {
+        stat->first_caller = caller;
+        stat->first_size = size;
+    }
+    stat->count++;
+}
+
+// These replace the libc entry points for the whole process, OpenCV included
+void *malloc(size_t size)
+{
+    rtmem_note(size, __builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    rtmem_note(nmemb*size, __builtin_return_address(0));
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    rtmem_note(size, __builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    rtmem_note(size, __builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    rtmem_note(size, __builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    rtmem_note(size, __builtin_return_address(0));
+    ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void rtmem_arm(const char *name)
+{
+    if (rtmem_slot < 0)
+    {
+        rtmem_slot = __sync_fetch_and_add(&rtmem_num_stats, 1);
+        if (rtmem_slot >= RTMEM_MAX_THREADS)
+        {
+            rtmem_slot = -1;
+            return;
+        }
+        rtmem_stats[rtmem_slot].name = name;
+    }
+    rtmem_armed = 1;
+}
+
+void rtmem_disarm(void)
+{
+    rtmem_armed = 0;
+}
+
+void rtmem_report(void)
+{
+    int i;
+    Dl_info dl;
+    rtmem_stat_t *stat;
+
+    printf("RT allocation check:\n");
+    for (i = 0; i < rtmem_num_stats && i < RTMEM_MAX_THREADS; i++)
+    {
+        stat = &rtmem_stats[i];
+        if (stat->count == 0)
+        {
+            printf("  %s: no allocation after warm-up\n", stat->name);
+            continue;
+        }
+        printf("  %s: %lu allocations after warm-up, first %zu bytes from %p",
+               stat->name, stat->count, stat->first_size, stat->first_caller);
+        if (dladdr(stat->first_caller, &dl) && dl.dli_sname != NULL)
+            printf(" (%s in %s)", dl.dli_sname, dl.dli_fname);
+        printf("\n");
+    }
+}
+#else
+void rtmem_arm(const char *name) { (void)name; }
+void rtmem_disarm(void) { }
+void rtmem_report(void) { }
+#endif
@@ -0,0 +1,39 @@
+/*
+ *
+ *  Memory setup for the RT threads: locked and pre-faulted memory, and a
+ *  debug check for heap allocations after warm-up
+ *  Most added work done by Chutao
+ *
+ *  rtmem_lock() is called once from main() before any thread is created.
+ *  Every RT thread calls rtmem_prefault_stack() first thing, and
+ *  rtmem_arm() once its warm-up iterations are done. Built with
+ *  RT_ALLOC_CHECK (make ALLOC_CHECK=1), any malloc family call made by an
+ *  armed thread is counted and reported by rtmem_report().
+ */
+#ifndef RTMEM_H
+#define RTMEM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RT_STACK_SIZE       (1024*1024)         // stack size of each RT thread
+#define RT_STACK_PREFAULT   (512*1024)          // touched at thread start
+#define RT_HEAP_PREFAULT    (64*1024*1024)      // heap kept resident for buffers and OpenCV
+#define RTMEM_MAX_THREADS   (8)
+#define RTMEM_WARMUP        (2)                 // iterations before a service is armed
+
+int rtmem_lock(void);
+void rtmem_prefault_stack(void);
+void *rtmem_prefault(void *buf, size_t size);
+void rtmem_arm(const char *name);
+void rtmem_disarm(void);
+void rtmem_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTMEM_H */
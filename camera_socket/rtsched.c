@@ -0,0 +1,253 @@
+/*
+ *
+ *  Scheduling modes for the RT services, see rtsched.h
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+
+#include "rtsched.h"
+#include "latency.h"
+#include "rttrace.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_DL_OVERRUN
+#define SCHED_FLAG_DL_OVERRUN 0x04
+#endif
+
+// glibc has no wrapper for sched_setattr()
+struct rtsched_attr
+{
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static __thread volatile unsigned long long *overrun_count;
+
+int rtsched_parse_mode(const char *arg, int *mode, const char **record)
+{
+    if (strcmp(arg, "fifo") == 0)
+    {
+        *mode = RTSCHED_FIFO;
+        return 0;
+    }
+    if (strcmp(arg, "cyclic") == 0)
+    {
+        *mode = RTSCHED_CYCLIC;
+        return 0;
+    }
+    if (strncmp(arg, "deadline", 8) == 0 && (arg[8] == '\0' || arg[8] == '='))
+    {
+        *mode = RTSCHED_DEADLINE;
+        if (arg[8] == '=') *record = arg + 9;
+        return 0;
+    }
+    return -1;
+}
+
+const char *rtsched_mode_name(int mode)
+{
+    return mode == RTSCHED_DEADLINE ? "deadline" : mode == RTSCHED_CYCLIC ? "cyclic" : "fifo";
+}
+
+//*****************************************************************************
+//
+// Budgets from a recorded run
+//
+//*****************************************************************************
+int rtsched_dl_from_record(const char *record, const char *service, int period_ms, rtsched_dl_t *dl)
+{
+    char line[256], name[32];
+    int count, sta, end, C, T, D;
+    int wcet = -1, t = period_ms;
+    FILE *f = fopen(record, "r");
+
+    if (f != NULL)
+    {
+        // "Seq, 1, 0, 0, 0, 1000, 1000", header and unfilled rows skipped
+        while (fgets(line, sizeof(line), f) != NULL)
+        {
+            if (sscanf(line, " %31[^,], %d, %d, %d, %d, %d, %d", name, &count, &sta, &end, &C, &T, &D) != 7)
+                continue;
+            if (strcmp(name, service) != 0 || T <= 0) continue;
+            if (C > wcet) wcet = C;
+            t = T;
+        }
+        fclose(f);
+    }
+
+    dl->period_ns = (unsigned long long)t*1000000ULL;
+    dl->deadline_ns = dl->period_ns;
+    dl->runtime_ns = (unsigned long long)(wcet > 0 ? wcet : 0)*1000000ULL*(100 + RTSCHED_MARGIN_PCT)/100;
+    if (dl->runtime_ns < RTSCHED_MIN_RUNTIME_NS) dl->runtime_ns = RTSCHED_MIN_RUNTIME_NS;
+    if (dl->runtime_ns > dl->period_ns*RTSCHED_MAX_UTIL_PCT/100)
+    {
+        // a recorded C above the period is blocking, not execution
+        printf("rtsched: %s WCET %d ms does not fit its %d ms period, budget capped at %d%%\n",
+               service, wcet, t, RTSCHED_MAX_UTIL_PCT);
+        dl->runtime_ns = dl->period_ns*RTSCHED_MAX_UTIL_PCT/100;
+    }
+    return wcet;
+}
+
+//*****************************************************************************
+//
+// SCHED_DEADLINE
+//
+//*****************************************************************************
+static void rtsched_sigxcpu(int sig)
+{
+    (void)sig;
+    if (overrun_count != NULL) (*overrun_count)++;
+}
+
+int rtsched_set_deadline(const rtsched_dl_t *dl, rtsched_stats_t *stats)
+{
+#ifdef __NR_sched_setattr
+    struct rtsched_attr attr;
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = rtsched_sigxcpu;
+    sigaction(SIGXCPU, &sa, NULL);
+    overrun_count = stats != NULL ? &stats->overruns : NULL;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    attr.sched_flags = SCHED_FLAG_DL_OVERRUN;
+    attr.sched_runtime = dl->runtime_ns;
+    attr.sched_deadline = dl->deadline_ns;
+    attr.sched_period = dl->period_ns;
+    if (syscall(__NR_sched_setattr, 0, &attr, 0) == 0) return 0;
+    if (errno != EINVAL) return -1;
+    // kernels before 4.16 have no overrun signal
+    attr.sched_flags = 0;
+    return syscall(__NR_sched_setattr, 0, &attr, 0) == 0 ? 0 : -1;
+#else
+    (void)dl;
+    (void)stats;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void rtsched_wait_next(void)
+{
+    // for a SCHED_DEADLINE task this gives up the budget until the next period
+    sched_yield();
+}
+
+//*****************************************************************************
+//
+// Statistics, both modes
+//
+//*****************************************************************************
+void rtsched_stats_init(rtsched_stats_t *s, const char *name, unsigned long long period_ns,
+                        unsigned long long deadline_ns)
+{
+    memset(s, 0, sizeof(rtsched_stats_t));
+    s->name = name;
+    s->period_ns = period_ns;
+    s->deadline_ns = deadline_ns;
+}
+
+void rtsched_stats_begin(rtsched_stats_t *s)
+{
+    s->start = latency_now();
+    if (s->n == 0) s->first = s->start;
+    // releases dropped since the last activation; one dropped while that
+    // activation still ran must not move its own release
+    s->skipped += __atomic_exchange_n(&s->skip_pending, 0, __ATOMIC_ACQ_REL);
+    RTTRACE_MARK("%s start %llu", s->name, s->n);
+}
+
+// ideal release, valid between begin and end
+unsigned long long rtsched_stats_release(const rtsched_stats_t *s)
+{
+    return s->first + (s->n + s->skipped)*s->period_ns;
+}
+
+int rtsched_stats_end(rtsched_stats_t *s)
+{
+    unsigned long long end = latency_now();
+    unsigned long long release = rtsched_stats_release(s);
+    unsigned long long lat = s->start > release ? s->start - release : 0;
+    unsigned long long resp = end - release;
+
+    s->lat_sum_ns += lat;
+    if (lat > s->lat_max_ns) s->lat_max_ns = lat;
+    if (resp > s->resp_max_ns) s->resp_max_ns = resp;
+    if (end - s->start > s->exec_max_ns) s->exec_max_ns = end - s->start;
+    rttrace_instant(s->name, "release", release);
+    rttrace_slice(s->name, s->name, s->start, end, s->n);
+    RTTRACE_MARK("%s end %llu%s", s->name, s->n, resp > s->deadline_ns ? " miss" : "");
+    s->n++;
+    if (resp <= s->deadline_ns) return 0;
+    s->misses++;
+    return 1;
+}
+
+// keeps the ideal release times of the later activations in place
+void rtsched_stats_skip(rtsched_stats_t *s, unsigned long long releases)
+{
+    __atomic_add_fetch(&s->skip_pending, releases, __ATOMIC_ACQ_REL);
+}
+
+void rtsched_stats_print(const rtsched_stats_t *s, int count, int mode)
+{
+    int i;
+
+    printf("Schedule (%s): release latency and response against first start + k*T\n", rtsched_mode_name(mode));
+    for (i = 0; i < count; i++)
+    {
+        if (s[i].n == 0) continue;
+        printf("  %-4s n %6llu  T %7.1f ms  latency avg %8.3f max %8.3f ms  response max %8.3f ms"
+               "  exec max %8.3f ms  misses %llu  overruns %llu  skipped %llu\n",
+               s[i].name, s[i].n, s[i].period_ns/1e6, s[i].lat_sum_ns/1e6/s[i].n, s[i].lat_max_ns/1e6,
+               s[i].resp_max_ns/1e6, s[i].exec_max_ns/1e6, s[i].misses, s[i].overruns,
+               s[i].skipped + s[i].skip_pending);
+    }
+}
+
+// Appends one row per service, runs in both modes end up side by side
+int rtsched_stats_csv(const char *path, const rtsched_stats_t *s, int count, int mode)
+{
+    struct stat st;
+    int header = stat(path, &st) != 0 || st.st_size == 0;
+    FILE *f = fopen(path, "a");
+    int i;
+
+    if (f == NULL) return -1;
+    if (header)
+        fprintf(f, "mode,service,n,T_ms,latency_avg_ms,latency_max_ms,response_max_ms,exec_max_ms,misses,overruns\n");
+    for (i = 0; i < count; i++)
+    {
+        if (s[i].n == 0) continue;
+        fprintf(f, "%s,%s,%llu,%.1f,%.3f,%.3f,%.3f,%.3f,%llu,%llu\n", rtsched_mode_name(mode), s[i].name,
+                s[i].n, s[i].period_ns/1e6, s[i].lat_sum_ns/1e6/s[i].n, s[i].lat_max_ns/1e6,
+                s[i].resp_max_ns/1e6, s[i].exec_max_ns/1e6, s[i].misses, s[i].overruns);
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ *
+ *  Scheduling modes for the RT services
+ *  Most added work done by Chutao
+ *
+ *  fifo      the sequencer releases every service with a semaphore and the
+ *            services run SCHED_FIFO at rate monotonic priorities
+ *  deadline  every service is its own periodic SCHED_DEADLINE task: the
+ *            runtime comes from the WCET measured in an earlier record.csv
+ *            (plus RTSCHED_MARGIN_PCT), the period and deadline from T. The
+ *            kernel's constant bandwidth server enforces the budget, so an
+ *            overrunning service is throttled instead of delaying the others,
+ *            and the overrun is counted (SIGXCPU, SCHED_FLAG_DL_OVERRUN).
+ *  cyclic    one RT thread runs every service from a static table of minor
+ *            frames, see cyclic.h
+ *
+ *  All modes fill the same per service statistics, measured against the
+ *  ideal release times first_start + k*T on CLOCK_MONOTONIC, so runs in
+ *  different modes can be compared line by line (rtsched_stats_csv()).
+ */
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTSCHED_FIFO        (0)
+#define RTSCHED_DEADLINE    (1)
+#define RTSCHED_CYCLIC      (2)
+
+#define RTSCHED_MARGIN_PCT  (25)    // runtime = WCET + 25%
+#define RTSCHED_MIN_RUNTIME_NS (1000000ULL)     // record.csv has 1 ms resolution
+#define RTSCHED_MAX_UTIL_PCT (40)   // budget cap of one service, the kernel admits 95% in all
+
+typedef struct rtsched_dl
+{
+    unsigned long long runtime_ns;
+    unsigned long long deadline_ns;
+    unsigned long long period_ns;
+}rtsched_dl_t;
+
+typedef struct rtsched_stats
+{
+    const char *name;
+    unsigned long long period_ns;
+    unsigned long long deadline_ns;     // relative to the ideal release
+    unsigned long long first;           // start of the first activation
+    unsigned long long start;           // start of the current activation
+    unsigned long long n;
+    unsigned long long skipped;         // releases that never ran, folded in at begin
+    volatile unsigned long long skip_pending;   // rtsched_stats_skip() from the releasing thread
+    unsigned long long misses;          // finished after release + deadline
+    unsigned long long lat_sum_ns;      // start - ideal release
+    unsigned long long lat_max_ns;
+    unsigned long long resp_max_ns;     // end - ideal release
+    unsigned long long exec_max_ns;     // end - start
+    volatile unsigned long long overruns;   // budget overruns, deadline mode only
+}rtsched_stats_t;
+
+int rtsched_parse_mode(const char *arg, int *mode, const char **record);
+const char *rtsched_mode_name(int mode);
+
+// Runtime, deadline and period for a service from its worst C in record.csv,
+// period_ms when the record has no row for it. Returns the measured WCET (ms)
+// or -1 when nothing was found.
+int rtsched_dl_from_record(const char *record, const char *service, int period_ms, rtsched_dl_t *dl);
+
+// Calling thread becomes SCHED_DEADLINE; its first period starts now
+int rtsched_set_deadline(const rtsched_dl_t *dl, rtsched_stats_t *stats);
+void rtsched_wait_next(void);   // give the rest of the budget back until the next period
+
+void rtsched_stats_init(rtsched_stats_t *s, const char *name, unsigned long long period_ns,
+                        unsigned long long deadline_ns);
+void rtsched_stats_begin(rtsched_stats_t *s);
+int rtsched_stats_end(rtsched_stats_t *s);     // 1 when the activation missed its deadline
+void rtsched_stats_skip(rtsched_stats_t *s, unsigned long long releases);   // any thread
+unsigned long long rtsched_stats_release(const rtsched_stats_t *s);   // of the current activation
+void rtsched_stats_print(const rtsched_stats_t *s, int count, int mode);
+int rtsched_stats_csv(const char *path, const rtsched_stats_t *s, int count, int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTSCHED_H */
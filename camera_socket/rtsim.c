@@ -0,0 +1,579 @@
+/*
+ *
+ *  Discrete event schedule simulator
+ *  Most added work done by Chutao
+ *
+ *  Predicts deadline misses of a service mix before it runs on the board.
+ *  A service table (rtsim.conf) gives every service its period, deadline,
+ *  SCHED_FIFO priority, CPU affinity and execution time, where the
+ *  execution time is either fixed or drawn from the C histogram of a
+ *  service in a recorded trace (record.csv, see trace.h), optionally
+ *  scaled. Without a table every service of the trace is simulated at rate
+ *  monotonic priorities on any core.
+ *
+ *  The simulation jumps from event to event (releases and completions) in
+ *  integer microseconds, so hours of virtual time take seconds:
+ *
+ *      fp    fixed priority, preemptive, like SCHED_FIFO
+ *      edf   earliest absolute deadline first, like SCHED_DEADLINE
+ *
+ *  on N cores with global dispatch restricted by each service's affinity; a
+ *  preempted job resumes on the core it left when that core is free. A
+ *  service is one thread, its jobs run in order, and a release finding
+ *  RTSIM_QUEUE jobs still pending is dropped. Jobs that pass their deadline
+ *  still run to completion, as they do in seqgen.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "latency.h"
+
+#define RTSIM_MAX_CPUS      (64)
+#define RTSIM_QUEUE         (16)        // pending jobs per service
+#define RTSIM_BIN_US        (100)       // response histogram resolution
+#define RTSIM_HIST_DEADLINES (4)        // histogram range, in deadlines
+#define RTSIM_HOURS         (1.0)
+
+#define POLICY_FP           (0)
+#define POLICY_EDF          (1)
+
+typedef long long sim_time_t;           // us
+
+typedef struct sim_job
+{
+    sim_time_t release;
+    sim_time_t deadline;
+    sim_time_t remaining;
+}sim_job_t;
+
+typedef struct sim_task
+{
+    char name[TRACE_NAME_MAX];
+    sim_time_t T;
+    sim_time_t D;
+    int prio;                           // higher runs first, as SCHED_FIFO
+    unsigned long long cpus;            // bit per simulated core
+
+    // execution time: fixed, or sampled from a trace histogram
+    sim_time_t c_fixed;
+    const trace_service_t *c_trace;
+    double c_scale;
+    unsigned long long *c_cdf;          // cumulative c_hist
+
+    sim_job_t q[RTSIM_QUEUE];
+    int qh, qn;
+    sim_time_t next_release;
+    int cpu;                            // core of the head job, -1 when not running
+
+    unsigned long long released;
+    unsigned long long completed;
+    unsigned long long misses;
+    unsigned long long dropped;
+    unsigned long long preemptions;
+    unsigned long long migrations;
+    sim_time_t resp_min, resp_max, late_max;
+    double resp_sum;
+    unsigned int *hist;
+    int hist_len;
+}sim_task_t;
+
+typedef struct sim
+{
+    sim_task_t task[TRACE_MAX_SERVICES];
+    int count;
+    int cpus;
+    int policy;
+    unsigned long long rng;
+    sim_time_t busy[RTSIM_MAX_CPUS];
+    unsigned long long events;
+}sim_t;
+
+//*****************************************************************************
+//
+// Execution time
+//
+//*****************************************************************************
+// xorshift64*, runs are repeatable for a seed
+static unsigned long long sim_rand(sim_t *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng*2685821657736338717ULL;
+}
+
+static int sim_cdf_build(sim_task_t *t)
+{
+    const trace_service_t *s = t->c_trace;
+    unsigned long long sum = 0;
+    int c;
+
+    t->c_cdf = malloc(sizeof(unsigned long long)*s->hist_len);
+    if (t->c_cdf == NULL) return -1;
+    for (c = 0; c < s->hist_len; c++)
+    {
+        sum += s->c_hist[c];
+        t->c_cdf[c] = sum;
+    }
+    return 0;
+}
+
+static sim_time_t sim_exec_time(sim_t *sim, sim_task_t *t)
+{
+    unsigned long long r;
+    int lo, hi;
+
+    if (t->c_trace == NULL) return t->c_fixed;
+
+    // the record has 1 ms resolution, the sample is the bin
+    r = sim_rand(sim) % t->c_trace->n;
+    lo = 0;
+    hi = t->c_trace->hist_len - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi)/2;
+
+        if (t->c_cdf[mid] > r) hi = mid;
+        else lo = mid + 1;
+    }
+    return (sim_time_t)(lo*1000.0*t->c_scale + 0.5);
+}
+
+//*****************************************************************************
+//
+// Simulation
+//
+//*****************************************************************************
+// does a run before b
+static int sim_before(const sim_t *sim, int a, int b)
+{
+    const sim_task_t *ta = &sim->task[a], *tb = &sim->task[b];
+
+    if (sim->policy == POLICY_EDF)
+    {
+        sim_time_t da = ta->q[ta->qh].deadline, db = tb->q[tb->qh].deadline;
+
+        if (da != db) return da < db;
+    }
+    if (ta->prio != tb->prio) return ta->prio > tb->prio;
+    return a < b;
+}
+
+static void sim_dispatch(sim_t *sim)
+{
+    int order[TRACE_MAX_SERVICES], newcpu[TRACE_MAX_SERVICES];
+    int owner[RTSIM_MAX_CPUS];
+    int n = 0, i, j, c;
+
+    for (i = 0; i < sim->count; i++)
+    {
+        newcpu[i] = -1;
+        if (sim->task[i].qn == 0) continue;
+        for (j = n; j > 0 && sim_before(sim, i, order[j-1]); j--) order[j] = order[j-1];
+        order[j] = i;
+        n++;
+    }
+    for (c = 0; c < sim->cpus; c++) owner[c] = -1;
+
+    for (i = 0; i < n; i++)
+    {
+        sim_task_t *t = &sim->task[order[i]];
+
+        // stay where it ran if that core is still free, else the first allowed one
+        if (t->cpu >= 0 && owner[t->cpu] < 0) c = t->cpu;
+        else
+            for (c = 0; c < sim->cpus; c++)
+                if (owner[c] < 0 && (t->cpus & (1ULL << c))) break;
+        if (c < sim->cpus)
+        {
+            owner[c] = order[i];
+            newcpu[order[i]] = c;
+        }
+    }
+
+    for (i = 0; i < sim->count; i++)
+    {
+        sim_task_t *t = &sim->task[i];
+
+        if (t->cpu >= 0 && newcpu[i] < 0) t->preemptions++;
+        else if (t->cpu >= 0 && newcpu[i] != t->cpu) t->migrations++;
+        t->cpu = newcpu[i];
+    }
+}
+
+static void sim_complete(sim_t *sim, sim_task_t *t, sim_time_t now)
+{
+    sim_job_t *job = &t->q[t->qh];
+    sim_time_t resp = now - job->release;
+    int bin = (int)(resp/RTSIM_BIN_US);
+
+    (void)sim;
+    t->completed++;
+    if (now > job->deadline)
+    {
+        t->misses++;
+        if (now - job->deadline > t->late_max) t->late_max = now - job->deadline;
+    }
+    if (t->completed == 1 || resp < t->resp_min) t->resp_min = resp;
+    if (resp > t->resp_max) t->resp_max = resp;
+    t->resp_sum += resp;
+    t->hist[bin < t->hist_len ? bin : t->hist_len - 1]++;
+
+    t->qh = (t->qh + 1) % RTSIM_QUEUE;
+    t->qn--;
+}
+
+static void sim_release(sim_t *sim, sim_task_t *t, sim_time_t now)
+{
+    sim_job_t *job;
+
+    t->released++;
+    t->next_release = now + t->T;
+    if (t->qn == RTSIM_QUEUE)
+    {
+        t->dropped++;
+        return;
+    }
+    job = &t->q[(t->qh + t->qn) % RTSIM_QUEUE];
+    job->release = now;
+    job->deadline = now + t->D;
+    job->remaining = sim_exec_time(sim, t);
+    t->qn++;
+}
+
+static void sim_run(sim_t *sim, sim_time_t end)
+{
+    sim_time_t now = 0;
+    int i;
+
+    for (i = 0; i < sim->count; i++)
+    {
+        sim->task[i].next_release = 0;      // critical instant: everybody at once
+        sim->task[i].cpu = -1;
+    }
+
+    while (now < end)
+    {
+        sim_time_t next = end, dt;
+
+        for (i = 0; i < sim->count; i++)
+        {
+            sim_task_t *t = &sim->task[i];
+
+            if (t->next_release < next) next = t->next_release;
+            if (t->cpu >= 0 && now + t->q[t->qh].remaining < next) next = now + t->q[t->qh].remaining;
+        }
+
+        dt = next - now;
+        for (i = 0; i < sim->count; i++)
+        {
+            sim_task_t *t = &sim->task[i];
+
+            if (t->cpu < 0) continue;
+            t->q[t->qh].remaining -= dt;
+            sim->busy[t->cpu] += dt;
+        }
+        now = next;
+        if (now >= end) break;
+
+        for (i = 0; i < sim->count; i++)
+        {
+            sim_task_t *t = &sim->task[i];
+
+            if (t->cpu >= 0 && t->q[t->qh].remaining == 0)
+            {
+                sim_complete(sim, t, now);
+                t->cpu = -1;
+            }
+            if (t->next_release == now) sim_release(sim, t, now);
+        }
+        sim_dispatch(sim);
+        sim->events++;
+    }
+}
+
+//*****************************************************************************
+//
+// Service table
+//
+//*****************************************************************************
+static int parse_cpus(const char *list, int cpus, unsigned long long *mask)
+{
+    const char *p = list;
+    char *end;
+    long first, last;
+
+    *mask = 0;
+    if (strcmp(list, "all") == 0 || strcmp(list, "*") == 0)
+    {
+        *mask = cpus == 64 ? ~0ULL : (1ULL << cpus) - 1;
+        return 0;
+    }
+    while (*p != '\0')
+    {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0) return -1;
+        last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) return -1;
+            p = end;
+        }
+        if (last >= cpus)
+        {
+            printf("CPU %ld, only %d simulated\n", last, cpus);
+            return -1;
+        }
+        for (; first <= last; first++) *mask |= 1ULL << first;
+        if (*p == ',') p++;
+        else if (*p != '\0') return -1;
+    }
+    return *mask != 0 ? 0 : -1;
+}
+
+// C is a number of ms, or @service[*scale] for the service's trace histogram
+static int parse_exec(sim_task_t *t, const char *arg, const trace_t *trace)
+{
+    char name[TRACE_NAME_MAX];
+    const char *star;
+    int i, len;
+
+    t->c_scale = 1.0;
+    if (arg[0] != '@')
+    {
+        t->c_fixed = (sim_time_t)(atof(arg)*1000.0 + 0.5);
+        return 0;
+    }
+    star = strchr(arg, '*');
+    len = star != NULL ? (int)(star - arg - 1) : (int)strlen(arg + 1);
+    if (len <= 0 || len >= TRACE_NAME_MAX) return -1;
+    memcpy(name, arg + 1, len);
+    name[len] = '\0';
+    if (star != NULL) t->c_scale = atof(star + 1);
+
+    if (trace == NULL || (i = trace_find(trace, name)) < 0)
+    {
+        printf("No trace rows for %s\n", name);
+        return -1;
+    }
+    t->c_trace = &trace->svc[i];
+    return sim_cdf_build(t);
+}
+
+static int load_table(sim_t *sim, const char *path, const trace_t *trace)
+{
+    char line[256], name[TRACE_NAME_MAX], cpus[64], exec[64];
+    double T, D;
+    int prio, lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        sim_task_t *t = &sim->task[sim->count];
+
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') continue;
+        if (sscanf(line, "%15s %lf %lf %d %63s %63s", name, &T, &D, &prio, cpus, exec) != 6 || T <= 0
+            || sim->count == TRACE_MAX_SERVICES)
+        {
+            printf("%s:%d: expected name T D prio cpus C\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        strcpy(t->name, name);
+        t->T = (sim_time_t)(T*1000.0 + 0.5);
+        t->D = D > 0 ? (sim_time_t)(D*1000.0 + 0.5) : t->T;
+        t->prio = prio;
+        if (parse_cpus(cpus, sim->cpus, &t->cpus) < 0 || parse_exec(t, exec, trace) < 0)
+        {
+            printf("%s:%d: bad cpus or C\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        sim->count++;
+    }
+    fclose(f);
+    return 0;
+}
+
+// every service of the trace, rate monotonic from 99 down, any core
+static int table_from_trace(sim_t *sim, const trace_t *trace)
+{
+    int i, j, above;
+
+    for (i = 0; i < trace->count; i++)
+    {
+        sim_task_t *t = &sim->task[i];
+
+        strcpy(t->name, trace->svc[i].name);
+        t->T = (sim_time_t)trace->svc[i].T*1000;
+        t->D = t->T;
+        parse_cpus("all", sim->cpus, &t->cpus);
+        t->c_scale = 1.0;
+        t->c_trace = &trace->svc[i];
+        if (sim_cdf_build(t) < 0) return -1;
+    }
+    for (i = 0; i < trace->count; i++)
+    {
+        above = 0;
+        for (j = 0; j < trace->count; j++)
+            if (trace->svc[j].T < trace->svc[i].T || (trace->svc[j].T == trace->svc[i].T && j < i)) above++;
+        sim->task[i].prio = 99 - above;
+    }
+    sim->count = trace->count;
+    return 0;
+}
+
+//*****************************************************************************
+//
+// Report
+//
+//*****************************************************************************
+static double sim_percentile(const sim_task_t *t, double pct)
+{
+    unsigned long long want = (unsigned long long)(pct/100.0*t->completed + 0.5), seen = 0;
+    int b;
+
+    if (want == 0) want = 1;
+    for (b = 0; b < t->hist_len - 1; b++)
+    {
+        seen += t->hist[b];
+        if (seen >= want) break;
+    }
+    // upper edge of the bin, the largest response can be below it
+    if (b < t->hist_len - 1 && (b + 1)*RTSIM_BIN_US < t->resp_max) return (b + 1)*RTSIM_BIN_US/1000.0;
+    return t->resp_max/1000.0;
+}
+
+static void sim_report(const sim_t *sim, double hours, double wall_s)
+{
+    int i, c;
+
+    printf("%.2f h virtual in %.2f s, %llu events, %s on %d core%s\n", hours, wall_s, sim->events,
+           sim->policy == POLICY_EDF ? "EDF" : "fixed priority", sim->cpus, sim->cpus > 1 ? "s" : "");
+    printf("  %-8s %4s %8s %8s %10s %8s %7s %7s %8s %8s %8s %8s %8s %9s\n", "service", "prio", "T ms", "D ms",
+           "released", "misses", "miss%", "dropped", "R min", "R avg", "R p50", "R p99", "R max", "late max");
+    for (i = 0; i < sim->count; i++)
+    {
+        const sim_task_t *t = &sim->task[i];
+
+        printf("  %-8s %4d %8.1f %8.1f %10llu %8llu %7.3f %7llu %8.2f %8.2f %8.2f %8.2f %8.2f %9.2f\n", t->name,
+               t->prio, t->T/1000.0, t->D/1000.0, t->released, t->misses,
+               t->completed ? 100.0*t->misses/t->completed : 0.0, t->dropped,
+               t->resp_min/1000.0, t->completed ? t->resp_sum/t->completed/1000.0 : 0.0,
+               sim_percentile(t, 50.0), sim_percentile(t, 99.0), t->resp_max/1000.0, t->late_max/1000.0);
+    }
+    printf("  preemptions/migrations:");
+    for (i = 0; i < sim->count; i++)
+        printf(" %s %llu/%llu", sim->task[i].name, sim->task[i].preemptions, sim->task[i].migrations);
+    printf("\n  core load:");
+    for (c = 0; c < sim->cpus; c++)
+        printf(" %d %.1f%%", c, 100.0*sim->busy[c]/(hours*3600e6));
+    printf("\n");
+}
+
+//*****************************************************************************
+//
+// Main
+//
+//*****************************************************************************
+static void print_usage(char *prog)
+{
+    printf("usage: %s [-t trace.csv] [-s table] [-p fp|edf] [-c cores] [-H hours] [-r seed]\n", prog);
+    printf("  table lines: name T_ms D_ms(0 = T) prio cpus C, C in ms or @service[*scale]\n");
+    printf("  sampled from the trace (default ./record.csv); see rtsim.conf\n");
+}
+
+int main(int argc, char *argv[])
+{
+    sim_t *sim;
+    trace_t trace;
+    const char *trace_path = "record.csv", *table = NULL;
+    double hours = RTSIM_HOURS;
+    unsigned long long t0, t1;
+    int opt, i, have_trace;
+
+    sim = calloc(1, sizeof(sim_t));
+    if (sim == NULL) exit(-1);
+    sim->cpus = 1;
+    sim->policy = POLICY_FP;
+    sim->rng = 0x9e3779b97f4a7c15ULL;
+
+    while ((opt = getopt(argc, argv, "t:s:p:c:H:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': trace_path = optarg; break;
+            case 's': table = optarg; break;
+            case 'p':
+                if (strcmp(optarg, "fp") == 0) sim->policy = POLICY_FP;
+                else if (strcmp(optarg, "edf") == 0) sim->policy = POLICY_EDF;
+                else
+                {
+                    print_usage(argv[0]);
+                    exit(-1);
+                }
+                break;
+            case 'c': sim->cpus = atoi(optarg); break;
+            case 'H': hours = atof(optarg); break;
+            case 'r': sim->rng = strtoull(optarg, NULL, 0) | 1; break;
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (sim->cpus < 1 || sim->cpus > RTSIM_MAX_CPUS || hours <= 0)
+    {
+        print_usage(argv[0]);
+        exit(-1);
+    }
+
+    // a table of fixed C needs no trace
+    have_trace = trace_load(&trace, trace_path) == 0;
+    if (!have_trace && table == NULL)
+    {
+        perror(trace_path);
+        exit(-1);
+    }
+    if (table != NULL ? load_table(sim, table, have_trace ? &trace : NULL) < 0
+                      : table_from_trace(sim, &trace) < 0)
+        exit(-1);
+    if (sim->count == 0)
+    {
+        printf("No services to simulate\n");
+        exit(-1);
+    }
+    for (i = 0; i < sim->count; i++)
+    {
+        sim_task_t *t = &sim->task[i];
+
+        t->hist_len = (int)(RTSIM_HIST_DEADLINES*t->D/RTSIM_BIN_US) + 1;
+        t->hist = calloc(t->hist_len, sizeof(unsigned int));
+        if (t->hist == NULL) exit(-1);
+    }
+
+    t0 = latency_now();
+    sim_run(sim, (sim_time_t)(hours*3600e6));
+    t1 = latency_now();
+    sim_report(sim, hours, (t1 - t0)/1e9);
+
+    for (i = 0; i < sim->count; i++)
+    {
+        free(sim->task[i].hist);
+        free(sim->task[i].c_cdf);
+    }
+    if (have_trace) trace_free(&trace);
+    free(sim);
+    return 0;
+}
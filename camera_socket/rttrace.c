@@ -0,0 +1,260 @@
+/*
+ *
+ *  Timeline tracing, see rttrace.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rttrace.h"
+
+#define RTTRACE_TRACKS  (32)
+
+static const char *tracefs_dirs[] = {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+
+typedef struct rttrace_event
+{
+    const char *track;
+    const char *name;
+    unsigned long long ts;          // ns
+    unsigned long long dur;         // ns, instant events have none
+    unsigned long long seq;
+    int instant;
+}rttrace_event_t;
+
+int rttrace_marker_fd = -1;
+
+static rttrace_event_t *events;
+static volatile unsigned long events_used;
+static unsigned long events_dropped;
+static unsigned long markers_lost;
+static char json_file[256];
+
+//*****************************************************************************
+//
+// Setup
+//
+//*****************************************************************************
+int rttrace_parse(const char *list, int *flags, const char **json_path)
+{
+    const char *p = list;
+    size_t len;
+
+    *flags = 0;
+    while (*p != '\0')
+    {
+        len = strcspn(p, ",");
+        if (len == 6 && strncmp(p, "marker", 6) == 0)
+            *flags |= RTTRACE_MARKER;
+        else if (strncmp(p, "json", 4) == 0 && (len == 4 || p[4] == '='))
+        {
+            *flags |= RTTRACE_JSON;
+            // the rest of the list is the file name
+            if (p[4] == '=')
+            {
+                *json_path = p + 5;
+                return 0;
+            }
+        }
+        else
+            return -1;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+// The JSON timeline lines up with the kernel trace only on the mono clock
+static void rttrace_check_clock(const char *dir)
+{
+    char path[64], buf[256];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/trace_clock", dir);
+    if ((fd = open(path, O_RDONLY)) < 0) return;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = '\0';
+    if (strstr(buf, "[mono]") == NULL)
+        printf("rttrace: ftrace clock is not mono, echo mono > %s to line the traces up\n", path);
+}
+
+static int rttrace_open_marker(void)
+{
+    char path[64];
+    size_t i;
+
+    for (i = 0; i < sizeof(tracefs_dirs)/sizeof(tracefs_dirs[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/trace_marker", tracefs_dirs[i]);
+        rttrace_marker_fd = open(path, O_WRONLY|O_CLOEXEC);
+        if (rttrace_marker_fd >= 0)
+        {
+            rttrace_check_clock(tracefs_dirs[i]);
+            return 0;
+        }
+    }
+    perror("rttrace: trace_marker");
+    return -1;
+}
+
+int rttrace_init(int flags, const char *json_path)
+{
+    int rc = 0;
+
+    if ((flags & RTTRACE_MARKER) && rttrace_open_marker() < 0) rc = -1;
+    if (flags & RTTRACE_JSON)
+    {
+        // all of it touched now, the RT threads only fill it in
+        events = calloc(RTTRACE_EVENTS, sizeof(rttrace_event_t));
+        if (events == NULL)
+        {
+            printf("rttrace: no memory for %d events\n", RTTRACE_EVENTS);
+            return -1;
+        }
+        memset(events, 0, RTTRACE_EVENTS*sizeof(rttrace_event_t));
+        snprintf(json_file, sizeof(json_file), "%s", json_path != NULL ? json_path : "trace.json");
+    }
+    return rc;
+}
+
+//*****************************************************************************
+//
+// Events
+//
+//*****************************************************************************
+void rttrace_mark(const char *fmt, ...)
+{
+    char buf[RTTRACE_MARK_MAX];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+    // one write() is one marker; it fails while tracing is off
+    if (len > 0 && write(rttrace_marker_fd, buf, len) < 0)
+        __atomic_add_fetch(&markers_lost, 1, __ATOMIC_RELAXED);
+}
+
+static rttrace_event_t *rttrace_event(void)
+{
+    unsigned long i;
+
+    if (events == NULL) return NULL;
+    i = __atomic_fetch_add(&events_used, 1, __ATOMIC_RELAXED);
+    if (i >= RTTRACE_EVENTS)
+    {
+        __atomic_store_n(&events_used, RTTRACE_EVENTS, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&events_dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return &events[i];
+}
+
+void rttrace_slice(const char *track, const char *name, unsigned long long begin,
+                   unsigned long long end, unsigned long long seq)
+{
+    rttrace_event_t *e = rttrace_event();
+
+    if (e == NULL) return;
+    e->track = track;
+    e->name = name;
+    e->ts = begin;
+    e->dur = end > begin ? end - begin : 0;
+    e->seq = seq;
+    e->instant = 0;
+}
+
+void rttrace_instant(const char *track, const char *name, unsigned long long when)
+{
+    rttrace_event_t *e = rttrace_event();
+
+    if (e == NULL) return;
+    e->track = track;
+    e->name = name;
+    e->ts = when;
+    e->dur = 0;
+    e->seq = 0;
+    e->instant = 1;
+}
+
+//*****************************************************************************
+//
+// Chrome trace JSON
+//
+//*****************************************************************************
+static int rttrace_tid(const char **tracks, int *count, const char *track)
+{
+    int i;
+
+    for (i = 0; i < *count; i++)
+        if (strcmp(tracks[i], track) == 0) return i + 1;
+    if (*count == RTTRACE_TRACKS) return *count;
+    tracks[(*count)++] = track;
+    return *count;
+}
+
+static int rttrace_export_json(const char *path)
+{
+    const char *tracks[RTTRACE_TRACKS];
+    unsigned long i, used = events_used < RTTRACE_EVENTS ? events_used : RTTRACE_EVENTS;
+    int count = 0, tid;
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL) return -1;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"seqgen\"}}",
+            (int)getpid());
+    for (i = 0; i < used; i++)
+    {
+        const rttrace_event_t *e = &events[i];
+
+        if (e->name == NULL) continue;
+        tid = rttrace_tid(tracks, &count, e->track);
+        if (e->instant)
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f}",
+                    e->name, (int)getpid(), tid, e->ts/1e3);
+        else
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f,"
+                    " \"args\": {\"seq\": %llu}}", e->name, (int)getpid(), tid, e->ts/1e3, e->dur/1e3, e->seq);
+    }
+    // tracks named after the service or stage, in order of first use
+    for (tid = 0; tid < count; tid++)
+    {
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                (int)getpid(), tid + 1, tracks[tid]);
+        fprintf(f, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d,"
+                " \"args\": {\"sort_index\": %d}}", (int)getpid(), tid + 1, tid);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("rttrace: %lu events to %s", used, path);
+    if (events_dropped > 0) printf(", %lu dropped, table full", events_dropped);
+    printf("\n");
+    return 0;
+}
+
+void rttrace_close(void)
+{
+    if (events != NULL)
+    {
+        if (rttrace_export_json(json_file) < 0) perror(json_file);
+        free(events);
+        events = NULL;
+    }
+    if (rttrace_marker_fd >= 0)
+    {
+        if (markers_lost > 0) printf("rttrace: %lu markers not written, tracing off?\n", markers_lost);
+        close(rttrace_marker_fd);
+        rttrace_marker_fd = -1;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ *
+ *  Timeline tracing: ftrace markers and a Chrome/Perfetto trace export
+ *  Most added work done by Chutao
+ *
+ *  Two independent outputs, both off unless rttrace_init() turns them on:
+ *
+ *  marker  one line per service release, start and end and per frame stage
+ *          written to the kernel's trace_marker, so they show up in the
+ *          ftrace buffer between the sched_switch, irq and page fault events
+ *          of the same CPU. Costs one write() per event; off it is a test of
+ *          rttrace_marker_fd.
+ *  json    jobs and frame stages kept in a table allocated up front and
+ *          written out as Chrome trace JSON (chrome://tracing, Perfetto UI)
+ *          at the end of the run, one track per service and per stage.
+ *
+ *  Times are CLOCK_MONOTONIC; with the ftrace clock set to mono
+ *  (echo mono > /sys/kernel/tracing/trace_clock) the JSON timeline and the
+ *  kernel trace use the same time base.
+ */
+#ifndef RTTRACE_H
+#define RTTRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTTRACE_MARKER      (1)
+#define RTTRACE_JSON        (2)
+
+#define RTTRACE_EVENTS      (64*1024)   // JSON table, later events are dropped
+#define RTTRACE_MARK_MAX    (128)
+
+extern int rttrace_marker_fd;
+
+// "marker", "json[=file]" or both, comma separated
+int rttrace_parse(const char *list, int *flags, const char **json_path);
+// 0, or -1 when a requested output could not be set up (it stays off)
+int rttrace_init(int flags, const char *json_path);
+void rttrace_close(void);     // writes the JSON file
+
+void rttrace_mark(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define RTTRACE_MARK(...) do { if (rttrace_marker_fd >= 0) rttrace_mark(__VA_ARGS__); } while (0)
+
+// JSON events; track and name must be static strings, they are kept as is
+void rttrace_slice(const char *track, const char *name, unsigned long long begin,
+                   unsigned long long end, unsigned long long seq);
+void rttrace_instant(const char *track, const char *name, unsigned long long when);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTTRACE_H */
@@ -95,11 +95,26 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
+#include "workpool.h"
+#include "affinity.h"
+#include "rtmem.h"
+#include "capture.h"
+#include "netsend.h"
+#include "diskwriter.h"
+#include "rtsched.h"
+#include "rtlock.h"
+#include "overrun.h"
+#include "cyclic.h"
+#include "fault.h"
+#include "rttrace.h"
+#include "platform.h"
+#include "rtlog.h"
+
 #define USEC_PER_MSEC (1000)
 #define NANOSEC_PER_SEC (1000000000)
-#define NUM_CPU_CORES (1)
 #define TRUE (1)
 #define FALSE (0)
 #define CHUTAO_IP_ADDR "10.0.0.89" // local
@@ -107,6 +122,22 @@
 #define SAM_IP_ADDR "73.78.219.44" // Sam's public
 #define NUM_THREADS (2+1)
 #define BUF_SIZE 925696
+#define RT_CPU (3)    // default RT core when no -i/-a option is given
+// Keep the stamped PPM of every frame in ./images
+#define SAVE_PPM
+#define PPM_PATTERN "./images/cap_%06llu.ppm"
+// Compress every captured frame to JPEG on the best-effort worker pool
+#define COMPRESS_IMAGE
+// Service_2 sends the latest frame to the aesd_server
+//#define SEND_IMAGE
+// Append every TIMELAPSE_RATIO-th frame to a daily video in TIMELAPSE_DIR
+#define TIMELAPSE
+#define TIMELAPSE_RATIO (1)
+#define TIMELAPSE_DIR "./timelapse"
+
+#if defined(COMPRESS_IMAGE) || defined(TIMELAPSE)
+#define USE_WORKPOOL
+#endif
 //*****************************************************************************
 //j
 // ECEN 5623 related define and global variables: for problem 3
@@ -254,6 +285,8 @@ typedef struct all_service_info
     service_info_t S3[FRAME_NUM];
 }all_service_info_t;
 
+// every row has one writer, the service it belongs to; other services only
+// read rows of frames already handed to them, so no lock is needed
 all_service_info_t info;
 
 void print_all_info(void)
@@ -286,13 +319,14 @@ void print_all_info_to_csv(void)
             O_WRONLY|O_CREAT,
             S_IRWXU|S_IRWXG|S_IRWXO);
     sprintf(my_buf,"Sevice Name, Count, Start Time, End Time, C, T, D\n");
-    int write_size = write(fd, my_buf, strlen(my_buf));
+    int failed = 0;
+    if(write(fd, my_buf, strlen(my_buf)) < 0) failed++;
     // Sequencer
     for (i=0;i<FRAME_NUM;i++)
     {
         sprintf(my_buf,"Seq, %d, %d, %d, %d, %d, %d\n",i+1,info.Seq[i].sta_time, info.Seq[i].end_time, info.Seq[i].C, info.Seq[i].T, info.Seq[i].D);
 
-        write_size = write(fd, my_buf, strlen(my_buf));
+        if(write(fd, my_buf, strlen(my_buf)) < 0) failed++;
     }
 
     // Service 1
@@ -300,32 +334,60 @@ void print_all_info_to_csv(void)
     for (i=0;i<FRAME_NUM;i++)
     {
         sprintf(my_buf,"S1, %d, %d, %d, %d, %d, %d\n",i+1,info.S1[i].sta_time, info.S1[i].end_time, info.S1[i].C, info.S1[i].T, info.S1[i].D);
-        write_size = write(fd, my_buf, strlen(my_buf));
+        if(write(fd, my_buf, strlen(my_buf)) < 0) failed++;
     }
     
     // Service 2
     for (i=0;i<FRAME_NUM;i++)
     {
         sprintf(my_buf,"S2, %d, %d, %d, %d, %d, %d\n",i+1,info.S2[i].sta_time, info.S2[i].end_time, info.S2[i].C, info.S2[i].T, info.S2[i].D);
-        write_size = write(fd, my_buf, strlen(my_buf));
+        if(write(fd, my_buf, strlen(my_buf)) < 0) failed++;
+    }
+
+#ifdef COMPRESS_IMAGE
+    // Service 3 (compression on the worker pool)
+    for (i=0;i<FRAME_NUM;i++)
+    {
+        sprintf(my_buf,"S3, %d, %d, %d, %d, %d, %d\n",i+1,info.S3[i].sta_time, info.S3[i].end_time, info.S3[i].C, info.S3[i].T, info.S3[i].D);
+        if(write(fd, my_buf, strlen(my_buf)) < 0) failed++;
     }
+#endif
 
     close(fd);
+    if(failed > 0) printf("record.csv: %d rows not written\n", failed);
 }
 //*****************************************************************************
 //
 // Capture related
 //
 //*****************************************************************************
-int capture_write(int dev, char * filename);
+// see capture.h, frames are shared between services through the frame pool
+
+// latest frame handed from Service_1 to Service_2, a one frame mailbox
+// swapped atomically: whoever takes a frame out of it owns that reference
+capture_frame_t * volatile latest_frame = NULL;
 
 //*****************************************************************************
 //
 // Timer related
 //
 //*****************************************************************************
-pthread_mutex_t timer_flag;
-pthread_mutex_t image_lock;
+// signals, not locks: posted by one thread and taken by another, which a
+// mutex (and priority inheritance) does not allow
+sem_t timer_sem;    // timer tick for the sequencer
+sem_t image_sem;    // a new frame for Service_2
+
+// releases of services still busy, see overrun.h
+overrun_t overrun;
+int overrun_policy = OVERRUN_COALESCE;
+
+// a pending signal is not counted twice, like the locked mutexes used before
+static void sem_post_once(sem_t *sem)
+{
+    int val;
+    if(sem_getvalue(sem, &val) == 0 && val > 0) return;
+    sem_post(sem);
+}
 static inline void timespec_add( struct timespec *result,
                         const struct timespec *ts_1, const struct timespec *ts_2)
 {
@@ -338,7 +400,8 @@ static inline void timespec_add( struct timespec *result,
 }
 static void timer_thread ()
 {
-    pthread_mutex_unlock(&timer_flag);
+    overrun_tick(&overrun);
+    sem_post_once(&timer_sem);
 }
 
 int delete_periodic_timer(timer_t * timerid)
@@ -393,108 +456,199 @@ int init_periodic_timer (timer_t * timerid, time_t second, long msec)
 //
 //*****************************************************************************
 struct addrinfo * res;
-int sockfd;
-void send_thread(char * filename)
-{
-    struct addrinfo * p = res;
-    // inifite while loop for sending image
-    int error_code = 0;
 
-    /* Open image file at /var/tmp/cap_stamped.ppm */
-    int fd = open(filename,
-            O_RDONLY,
-            S_IRWXU|S_IRWXG|S_IRWXO);
+// -e: capture release to fsync on the server, S2 sends within S1's period
+unsigned long long e2e_deadline_ms = SEV1_PERIOD_MSEC;
 
+// Send one pooled frame, straight from the frame buffer (see netsend.c)
+void send_frame(capture_frame_t * frame)
+{
+    netsend_e2e_t e2e, *e2e_p = NULL;
+    struct timeval now;
 
-    /* Read all content */
-    // create a buffer for sending message
-    void * local_buf = malloc(BUF_SIZE);
-    if(local_buf == NULL)
+    if(capture_frame_ppm(frame) < 0)
     {
-        printf("no more space\n");
+        return;
     }
-    int num_read = 1;
-    bool EOF_flag = false;
-    ssize_t read_size;
-    ssize_t total_read_size;// assume ssize_t never overflow
-    while(EOF_flag==false)
+    if(frame->release != 0)
     {
-        read_size = read(fd, (local_buf+(num_read-1)*BUF_SIZE), (size_t) BUF_SIZE);
-        if(read_size < 0)
-        {
-            printf("error while reading capture image");
-        }
-        // update total_size
-        total_read_size = ((num_read-1)*BUF_SIZE)+read_size;
-        if(read_size < BUF_SIZE)
-        {
-            EOF_flag = true;
-        }
-        else
-        {
-            num_read++;
-            local_buf = realloc(local_buf,num_read*BUF_SIZE);
-            if(local_buf == NULL)
-            {
-                printf("no more space\n");
-            }
-        }
+        // the server stamps with gettimeofday(), move the times to that clock
+        gettimeofday(&now, (struct timezone *)0);
+        long long offset = (long long)now.tv_sec*1000000LL + now.tv_usec - (long long)(latency_now()/1000);
+        e2e.frame = frame->seq;
+        e2e.release_us = (long long)(frame->release/1000) + offset;
+        e2e.deadline_us = (long long)(frame->deadline/1000) + offset;
+        e2e_p = &e2e;
     }
-    /* Add '\n''#''EOF' at the end of buffer */
-    total_read_size = total_read_size + 3;
-    local_buf = realloc(local_buf,total_read_size);
-    ((char *)local_buf)[total_read_size-3] = '\n';
-    ((char *)local_buf)[total_read_size-2] = '#';
-    ((char *)local_buf)[total_read_size-1] = 0x4;
-
-    /* Close /var/tmp/cap_stamped.ppm */
-    error_code = close(fd);
-
-    /* check NULL */
-    if(p == NULL){
-        syslog(LOG_ERR, "client: client failed to connect: %s", strerror(errno));
+    /* Send image to Sam over TCP */
+    ssize_t send_size = netsend_image(res, frame->ppm, frame->ppm_len, e2e_p);
+    if (send_size<0)
+    {
+        printf("send wrong\n");
+        return;
     }
+    latency_mark(frame->lat, LAT_SEND);
+    syslog(LOG_USER, "Image sent:send_size = %ld",send_size);
+}
 
-    if((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1){
-            perror("client: socket");
-    }
+#ifdef SEND_IMAGE
+// Service_2 only drops the newest frame in this one frame mailbox, the send
+// (and however long the server takes) runs here, best effort like the
+// worker pool. Whoever takes the frame out owns that reference.
+capture_frame_t * volatile send_slot = NULL;
+sem_t send_sem;
+volatile int abortSend = FALSE;
+pthread_t send_thread;
+unsigned long long send_replaced = 0;   // frames a newer one replaced before they were sent
+
+static void *Sender(void *threadp)
+{
+    capture_frame_t * frame;
 
-    /* Connect to Target ip else just dont send anything*/
-    if(connect(sockfd, p->ai_addr, p->ai_addrlen) == -1)
+    while(1)
     {
-        close(sockfd);
-        perror("client: connection failed");
-    }
-    else
-    {
-        /* Send image to Sam over TCP */
-        ssize_t send_size = send(sockfd,local_buf,total_read_size,0);
-        if (send_size<0)
+        sem_wait(&send_sem);
+        frame = __atomic_exchange_n(&send_slot, NULL, __ATOMIC_ACQ_REL);
+        if(frame == NULL)
         {
-            printf("send wrong\n");
+            if(abortSend) break;
+            continue;
         }
-        syslog(LOG_USER, "Image sent:send_size = %ld",send_size);
+        send_frame(frame);
+        capture_frame_release(frame);
     }
+    pthread_exit((void *)0);
+}
 
+int init_sender(cpu_set_t *cpus)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    int rc;
+
+    if(sem_init(&send_sem, 0, 0)) return -1;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    if(CPU_COUNT(cpus) > 0)
+    {
+        rc = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+        if(rc != 0) printf("sender: cannot set affinity (%s)\n", strerror(rc));
+    }
+    rc = pthread_create(&send_thread, &attr, Sender, NULL);
+    pthread_attr_destroy(&attr);
+    if(rc != 0) printf("sender: pthread_create failed (%s)\n", strerror(rc));
+    return rc == 0 ? 0 : -1;
+}
 
-    /* Send image to Sam over TCP */
-    ssize_t send_size = send(sockfd,local_buf,total_read_size,0);
-    if(send_size < 0)
+// Sends the frame still in the mailbox, then stops the thread
+void close_sender(void)
+{
+    abortSend = TRUE;
+    sem_post(&send_sem);
+    pthread_join(send_thread, NULL);
+    sem_destroy(&send_sem);
+    printf("Sender: %llu frames replaced by a newer one before they were sent\n", send_replaced);
+}
+#endif
+
+//*****************************************************************************
+//
+// Best-effort worker pool: compression and timelapse encoding
+//
+//*****************************************************************************
+struct timeval start_time_val;
+affinity_config_t affinity;
+#ifdef USE_WORKPOOL
+workpool_t worker_pool;
+#endif
+
+#ifdef COMPRESS_IMAGE
+
+// job arg is the pooled frame, the job holds a reference until its commit
+static void compress_work(void *arg, unsigned long long seq)
+{
+    capture_frame_t *f = (capture_frame_t *)arg;
+    unsigned long long frame = f->seq;
+    struct timeval sta_timeval;
+    struct timeval end_timeval;
+    char dst_filename[30];
+
+    gettimeofday(&sta_timeval, (struct timezone *)0);
+    rebase_timeval(&sta_timeval,&start_time_val);
+
+    sprintf(dst_filename, "./images/cap_%06lld.jpg",frame);
+    if(compress_frame(f, dst_filename) < 0)
+        syslog(LOG_ERR, "Image compress failed: %s", dst_filename);
+
+    gettimeofday(&end_timeval, (struct timezone *)0);
+    rebase_timeval(&end_timeval,&start_time_val);
+    if(frame < FRAME_NUM)
     {
-        printf("error while reading capture image");
+        info.S3[frame].sta_time = time_val_to_msec(sta_timeval);
+        info.S3[frame].end_time = time_val_to_msec(end_timeval);
+        info.S3[frame].C = C_calculate(info.S3[frame].sta_time, info.S3[frame].end_time);
+        info.S3[frame].T = SEV1_PERIOD_MSEC;
+        // best effort: allow one extra frame period after the capture deadline
+        info.S3[frame].D = info.S1[frame].D + SEV1_PERIOD_MSEC;
     }
-    syslog(LOG_USER, "Image sent:send_size = %ld",send_size);
+}
 
-    close(sockfd);
-    // free local_buf
-    free(local_buf);
+// runs in capture order whatever worker finished first
+static void compress_commit(void *arg, unsigned long long seq)
+{
+    capture_frame_t *f = (capture_frame_t *)arg;
+    syslog(LOG_USER, "Image compressed: frame=%llu seq=%llu", f->seq, seq);
+    capture_frame_release(f);
+}
+#endif
 
+#ifdef TIMELAPSE
+// the video is a single stream, so the encode happens in the ordered commit
+static void timelapse_commit(void *arg, unsigned long long seq)
+{
+    timelapse_append((int)(uintptr_t)arg);
 }
+#endif
+
+#ifdef SAVE_PPM
+//*****************************************************************************
+//
+// Frame storage: Service_1 queues the PPM and the disk writer saves it off
+// the RT cores (see diskwriter.h), -w sync writes it in the RT slot as before
+//
+//*****************************************************************************
+int storage_async = TRUE;
+int storage_engine = DISKWRITER_AUTO;
+int storage_flags = 0;
+diskwriter_t storage;
+
+// storage thread, the writer holds a frame reference until the file is saved
+static void storage_done(void *arg, int err)
+{
+    capture_frame_t *f = (capture_frame_t *)arg;
+
+    if(err == 0) latency_mark(f->lat, LAT_FILE_WRITE);
+    capture_frame_release(f);
+}
+#endif
+
+#ifdef USE_WORKPOOL
+int init_worker_pool(void)
+{
+    // one worker per best-effort core
+    int num_workers = CPU_COUNT(&affinity.be_cpus);
+
+    printf("Worker pool: %d workers\n", num_workers);
+    return workpool_init(&worker_pool, num_workers, &affinity.be_cpus);
+}
+#endif
 
 int abortTest=FALSE;
 int abortS1=FALSE, abortS2=FALSE, abortS3=FALSE;
 sem_t semS1, semS2, semS3;
-struct timeval start_time_val;
 
 typedef struct
 {
@@ -504,15 +658,201 @@ typedef struct
 
 
 void *Sequencer(void *threadp);
+void *Cyclic_Executive(void *threadp);
 
 void *Service_1(void *threadp);
 void *Service_2(void *threadp);
 double getTimeMsec(void);
 void print_scheduler(void);
 
+//*****************************************************************************
+//
+// Command line options
+//
+//*****************************************************************************
+const char *service_names[NUM_THREADS] = {"seq", "s1", "s2"};
+int capture_dev = 0;
+unsigned long long seq_periods = SEQ_NUM;
 
-void main(void)
+// -P: governor, frequency, RT throttling, timer slack and IRQs, see platform.h
+int platform_flags = 0;
+platform_state_t platform;
+
+// -T: ftrace markers and/or a Chrome trace of the run, see rttrace.h
+int trace_flags = 0;
+const char *trace_json = NULL;
+
+// -m deadline: the services release themselves under SCHED_DEADLINE, see rtsched.h
+int sched_mode = RTSCHED_FIFO;
+const char *sched_record = "record.csv";
+rtsched_dl_t sched_dl[NUM_THREADS];
+rtsched_stats_t sched_stats[NUM_THREADS];
+
+void print_usage(char *prog)
+{
+    printf("usage: %s [-i cpulist|auto] [-a name=cpulist]... [-b opencv|v4l2|synthetic] [-d dev] [-O fields]\n", prog);
+    printf("  -i cpulist  pin RT services to this isolated set, best effort elsewhere\n");
+    printf("              (auto = kernel isolcpus list, default CPU %d)\n", RT_CPU);
+    printf("  -a name=cpulist  per service affinity, name is seq, s1, s2 or be\n");
+    printf("              (best effort: worker pool, send, logging)\n");
+    printf("  cpulist is e.g. 3, 2-3, 0,2 or all\n");
+    printf("  -b backend  opencv (VideoCapture, default), v4l2 (mmap, driver timestamps)\n");
+    printf("              or synthetic (generated frames, no camera)\n");
+    printf("  -d dev      camera number, /dev/video<dev> (default 0)\n");
+    printf("  -O fields   overlay fields: date,sec,name,comment, all (default) or none\n");
+    printf("  -w storage  PPM writer: auto (default), uring or threads, plus direct (O_DIRECT)\n");
+    printf("              and fsync, e.g. uring,direct; sync writes in Service_1 like before\n");
+    printf("  -m mode     fifo (sequencer, default) or deadline[=record.csv], SCHED_DEADLINE\n");
+    printf("              with budgets from the WCET in the record (default ./record.csv),\n");
+    printf("              or cyclic (one RT thread runs every service from a frame table)\n");
+    printf("  -n periods  sequencer periods to run (default and max %d)\n", SEQ_NUM);
+    printf("  -p policy   release of a service still busy: skip, coalesce (default) or\n");
+    printf("              degrade (coalesce and drop saving, compression and send)\n");
+    printf("  -e msec     end-to-end deadline of a frame, capture release to fsync on the\n");
+    printf("              server (default %d)\n", SEV1_PERIOD_MSEC);
+    printf("  -B pcts     share of that deadline each stage must be done by, in stage order\n");
+    printf("              driver,dequeue,overlay,file_write,encode,send (default 5,10,20,70,80,90,\n");
+    printf("              see latency.h)\n");
+    printf("  -F file     fault injection scenario, see fault.h\n");
+    printf("  -T trace    marker (ftrace trace_marker) and/or json[=file] (Chrome/Perfetto\n");
+    printf("              timeline, default trace.json), e.g. marker,json\n");
+    printf("  -P setup    platform: warn (default) only checks, apply sets it up as root,\n");
+    printf("              strict refuses to run unless deterministic, e.g. apply,strict\n");
+}
+
+void parse_options(int argc, char *argv[])
+{
+    int opt;
+
+    affinity_init(&affinity, NUM_THREADS, service_names, RT_CPU);
+    while((opt = getopt(argc, argv, "i:a:b:d:O:w:m:n:p:e:B:F:T:P:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i':
+                if(affinity_isolate(&affinity, optarg) < 0)
+                {
+                    printf("Bad isolated cpu list: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'a':
+                if(affinity_parse_service(&affinity, optarg) < 0)
+                {
+                    printf("Bad affinity option: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'b':
+                if(strcmp(optarg, "v4l2") == 0)
+                    capture_set_backend(CAPTURE_BACKEND_V4L2);
+                else if(strcmp(optarg, "opencv") == 0)
+                    capture_set_backend(CAPTURE_BACKEND_OPENCV);
+                else if(strcmp(optarg, "synthetic") == 0)
+                    capture_set_backend(CAPTURE_BACKEND_SYNTHETIC);
+                else
+                {
+                    printf("Bad capture backend: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'd':
+                capture_dev = atoi(optarg);
+                break;
+            case 'O':
+                if(capture_set_overlay(capture_parse_overlay(optarg)) < 0)
+                {
+                    printf("Bad overlay fields: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'm':
+                if(rtsched_parse_mode(optarg, &sched_mode, &sched_record) < 0)
+                {
+                    printf("Bad scheduling mode: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'n':
+                seq_periods = strtoull(optarg, NULL, 0);
+                if(seq_periods == 0 || seq_periods > SEQ_NUM) seq_periods = SEQ_NUM;
+                break;
+            case 'p':
+                if(overrun_parse(optarg, &overrun_policy) < 0)
+                {
+                    printf("Bad overrun policy: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'e':
+                e2e_deadline_ms = strtoull(optarg, NULL, 0);
+                if(e2e_deadline_ms == 0) e2e_deadline_ms = SEV1_PERIOD_MSEC;
+                break;
+            case 'B':
+                if(latency_set_budget(optarg) < 0)
+                {
+                    printf("Bad stage budget, expected %d percentages: %s\n", LAT_NUM_STAGES, optarg);
+                    exit(-1);
+                }
+                break;
+            case 'F':
+                if(fault_load(optarg) < 0) exit(-1);
+                break;
+            case 'T':
+                if(rttrace_parse(optarg, &trace_flags, &trace_json) < 0)
+                {
+                    printf("Bad trace option: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'P':
+                if(platform_parse(optarg, &platform_flags) < 0)
+                {
+                    printf("Bad platform option: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+#ifdef SAVE_PPM
+            case 'w':
+                if(strcmp(optarg, "sync") == 0)
+                    storage_async = FALSE;
+                else if(diskwriter_parse(optarg, &storage_engine, &storage_flags) < 0)
+                {
+                    printf("Bad storage option: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+#endif
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    affinity_finalize(&affinity);
+}
+
+
+int main(int argc, char *argv[])
 {
+    parse_options(argc, argv);
+
+    // the platform first, nothing is worth timing on a scaling CPU
+    cpu_set_t rt_cpus;
+    CPU_ZERO(&rt_cpus);
+    for(int svc = 0; svc < NUM_THREADS; svc++)
+        CPU_OR(&rt_cpus, &rt_cpus, &affinity.service_cpus[svc]);
+    if(platform_flags & PLATFORM_APPLY) platform_apply(&rt_cpus, &affinity.be_cpus);
+    if(platform_probe(&platform, &rt_cpus, 1) > 0 && (platform_flags & PLATFORM_STRICT))
+    {
+        printf("Platform not in deterministic mode, not running (-P apply sets it up as root)\n");
+        exit(-1);
+    }
+    if(trace_flags && rttrace_init(trace_flags, trace_json) < 0)
+        printf("Warning: tracing not fully set up\n");
+
+    // lock and pre-fault memory before any RT thread exists
+    if(rtmem_lock() < 0) printf("Warning: RT memory is not locked\n");
+
     /********************************************************************************/
     /**************************** Network section ***********************************/
 
@@ -537,7 +877,6 @@ void main(void)
     /********************************************************************************/
     struct timeval current_time_val;
     int i, rc, scope;
-    cpu_set_t threadcpu;
     pthread_t threads[NUM_THREADS];
     threadParams_t threadParams[NUM_THREADS];
     pthread_attr_t rt_sched_attr[NUM_THREADS];
@@ -558,10 +897,31 @@ void main(void)
 
    CPU_ZERO(&allcpuset);
 
-   for(i=0; i < NUM_CPU_CORES; i++)
+   for(i=0; i < get_nprocs(); i++)
        CPU_SET(i, &allcpuset);
 
    printf("Using CPUS=%d from total available.\n", CPU_COUNT(&allcpuset));
+   affinity_print_map(&affinity);
+
+    // from here on the RT threads only queue their syslog messages
+    if (rtlog_init(&affinity.be_cpus) < 0) printf("Warning: RT threads call syslog() directly\n");
+#ifdef USE_WORKPOOL
+    if (init_worker_pool() < 0) { printf ("Failed to initialize worker pool\n"); exit (-1); }
+#endif
+#ifdef SEND_IMAGE
+    if (init_sender(&affinity.be_cpus) < 0) { printf ("Failed to start the sender\n"); exit (-1); }
+#endif
+#ifdef TIMELAPSE
+    if (timelapse_open(TIMELAPSE_DIR) < 0) { printf ("Failed to open timelapse directory\n"); exit (-1); }
+#endif
+#ifdef SAVE_PPM
+    if (storage_async)
+    {
+        if (diskwriter_init(&storage, PPM_PATTERN, storage_engine, storage_flags, storage_done, &affinity.be_cpus) < 0)
+        { printf ("Failed to start the disk writer\n"); exit (-1); }
+        printf("Disk writer: %s\n", diskwriter_engine_name(&storage));
+    }
+#endif
 
 
     // initialize the sequencer semaphores
@@ -569,6 +929,11 @@ void main(void)
     if (sem_init (&semS1, 0, 0)) { printf ("Failed to initialize S1 semaphore\n"); exit (-1); }
     if (sem_init (&semS2, 0, 0)) { printf ("Failed to initialize S2 semaphore\n"); exit (-1); }
     if (sem_init (&semS3, 0, 0)) { printf ("Failed to initialize S3 semaphore\n"); exit (-1); }
+    if (sem_init (&timer_sem, 0, 0)) { printf ("Failed to initialize timer semaphore\n"); exit (-1); }
+    if (sem_init (&image_sem, 0, 0)) { printf ("Failed to initialize image semaphore\n"); exit (-1); }
+    overrun_init(&overrun, overrun_policy);
+    overrun_add(&overrun, 1, "s1", &semS1);
+    overrun_add(&overrun, 2, "s2", &semS2);
 
     mainpid=getpid();
 
@@ -594,31 +959,70 @@ void main(void)
     printf("rt_max_prio=%d\n", rt_max_prio);
     printf("rt_min_prio=%d\n", rt_min_prio);
 
-    for(i=0; i < NUM_THREADS; i++)
+    rtsched_stats_init(&sched_stats[0], "seq", SEQ_PERIOD_MSEC*1000000ULL, SEQ_PERIOD_MSEC*1000000ULL);
+    rtsched_stats_init(&sched_stats[1], "s1", SEV1_PERIOD_MSEC*1000000ULL, SEV1_PERIOD_MSEC*1000000ULL);
+    rtsched_stats_init(&sched_stats[2], "s2", SEV2_PERIOD_MSEC*1000000ULL, SEV2_PERIOD_MSEC*1000000ULL);
+    if(sched_mode == RTSCHED_DEADLINE)
     {
+        int periods_ms[NUM_THREADS] = {SEQ_PERIOD_MSEC, SEV1_PERIOD_MSEC, SEV2_PERIOD_MSEC};
+        double util = 0.0;
+        // the sequencer would warm the capture up
+        capture_write(capture_dev,"test_image.ppm");
+        fault_start();
+        for(i=1; i < NUM_THREADS; i++)
+        {
+            char name[4];
+            sprintf(name, "S%d", i);
+            int wcet = rtsched_dl_from_record(sched_record, name, periods_ms[i], &sched_dl[i]);
+            sched_stats[i].period_ns = sched_dl[i].period_ns;
+            sched_stats[i].deadline_ns = sched_dl[i].deadline_ns;
+            util += (double)sched_dl[i].runtime_ns/sched_dl[i].period_ns;
+            printf("SCHED_DEADLINE %s: WCET %d ms in %s, runtime %.1f deadline %.1f period %.1f ms\n",
+                   service_names[i], wcet, sched_record, sched_dl[i].runtime_ns/1e6,
+                   sched_dl[i].deadline_ns/1e6, sched_dl[i].period_ns/1e6);
+        }
+        printf("SCHED_DEADLINE utilization %.3f\n", util);
+    }
 
-      CPU_ZERO(&threadcpu);
-      CPU_SET(3, &threadcpu);
+    for(i=0; i < NUM_THREADS; i++)
+    {
 
       rc=pthread_attr_init(&rt_sched_attr[i]);
       rc=pthread_attr_setinheritsched(&rt_sched_attr[i], PTHREAD_EXPLICIT_SCHED);
+      if(sched_mode == RTSCHED_DEADLINE)
+      {
+        // the thread switches itself to SCHED_DEADLINE, which the kernel only
+        // admits with the affinity of the whole root domain
+        rc=pthread_attr_setschedpolicy(&rt_sched_attr[i], SCHED_OTHER);
+        rt_param[i].sched_priority=0;
+        pthread_attr_setschedparam(&rt_sched_attr[i], &rt_param[i]);
+        pthread_attr_setstacksize(&rt_sched_attr[i], RT_STACK_SIZE);
+        threadParams[i].threadIdx=i;
+        continue;
+      }
       rc=pthread_attr_setschedpolicy(&rt_sched_attr[i], SCHED_FIFO);
-      //rc=pthread_attr_setaffinity_np(&rt_sched_attr[i], sizeof(cpu_set_t), &threadcpu);
+      rc=pthread_attr_setaffinity_np(&rt_sched_attr[i], sizeof(cpu_set_t), &affinity.service_cpus[i]);
+      if(rc != 0) printf("Cannot set affinity for %s: %s\n", service_names[i], strerror(rc));
 
       rt_param[i].sched_priority=rt_max_prio-i;
       pthread_attr_setschedparam(&rt_sched_attr[i], &rt_param[i]);
+      pthread_attr_setstacksize(&rt_sched_attr[i], RT_STACK_SIZE);
 
       threadParams[i].threadIdx=i;
     }
    
-    printf("Service threads will run on %d CPU cores\n", CPU_COUNT(&threadcpu));
+    for(i=0; i < NUM_THREADS; i++)
+        printf("Service %s will run on %d CPU cores\n", service_names[i], CPU_COUNT(&affinity.service_cpus[i]));
 
     // Create Service threads which will block awaiting release for:
     //
 
+    // (cyclic mode: the executive calls them, no service threads)
+    if(sched_mode != RTSCHED_CYCLIC)
+    {
     // Servcie_1 = RT_MAX-1	@ 3 Hz
     //
-    rt_param[1].sched_priority=rt_max_prio-1;
+    rt_param[1].sched_priority=(sched_mode == RTSCHED_FIFO) ? rt_max_prio-1 : 0;
     pthread_attr_setschedparam(&rt_sched_attr[1], &rt_param[1]);
     rc=pthread_create(&threads[1],               // pointer to thread descriptor
                       &rt_sched_attr[1],         // use specific attributes
@@ -634,13 +1038,14 @@ void main(void)
 
     // Service_2 = RT_MAX-2	@ 1 Hz
     //
-    rt_param[2].sched_priority=rt_max_prio-2;
+    rt_param[2].sched_priority=(sched_mode == RTSCHED_FIFO) ? rt_max_prio-2 : 0;
     pthread_attr_setschedparam(&rt_sched_attr[2], &rt_param[2]);
     rc=pthread_create(&threads[2], &rt_sched_attr[2], Service_2, (void *)&(threadParams[2]));
     if(rc < 0)
         perror("pthread_create for service 2");
     else
         printf("pthread_create successful for service 2\n");
+    }
 
 
 
@@ -654,8 +1059,11 @@ void main(void)
     // usleep(1000000);
  
     // Create Sequencer thread, which like a cyclic executive, is highest prio
+    // (deadline mode: the services release themselves, no sequencer)
+    if(sched_mode == RTSCHED_FIFO)
+    {
     printf("Start sequencer\n");
-    threadParams[0].sequencePeriods=SEQ_NUM;
+    threadParams[0].sequencePeriods=seq_periods;
 
     // Sequencer = RT_MAX	@ 30 Hz
     //
@@ -666,10 +1074,52 @@ void main(void)
         perror("pthread_create for sequencer service 0");
     else
         printf("pthread_create successful for sequeencer service 0\n");
+    }
+    else if(sched_mode == RTSCHED_CYCLIC)
+    {
+        // the executive takes the sequencer's priority and cores
+        printf("Start cyclic executive\n");
+        threadParams[0].sequencePeriods=seq_periods;
+        rt_param[0].sched_priority=rt_max_prio;
+        pthread_attr_setschedparam(&rt_sched_attr[0], &rt_param[0]);
+        rc=pthread_create(&threads[0], &rt_sched_attr[0], Cyclic_Executive, (void *)&(threadParams[0]));
+        if(rc != 0)
+            perror("pthread_create for cyclic executive");
+    }
 
 
     for(i=0;i<NUM_THREADS;i++)
+    {
+        // deadline mode has no sequencer, cyclic mode nothing but the executive
+        if((i == 0 && sched_mode == RTSCHED_DEADLINE) || (i > 0 && sched_mode == RTSCHED_CYCLIC)) continue;
         pthread_join(threads[i], NULL);
+    }
+    rtsched_stats_print(sched_stats, NUM_THREADS, sched_mode);
+    platform_print(&platform);
+    if(sched_mode == RTSCHED_FIFO) overrun_print(&overrun);
+    fault_print();
+    rtsched_stats_csv("sched_compare.csv", sched_stats, NUM_THREADS, sched_mode);
+
+#ifdef SEND_IMAGE
+    close_sender();
+#endif
+#ifdef USE_WORKPOOL
+    // finish whatever is still queued before the report is written
+    workpool_destroy(&worker_pool);
+    workpool_print_stats(&worker_pool);
+#endif
+#ifdef TIMELAPSE
+    timelapse_close();
+#endif
+#ifdef SAVE_PPM
+    if (storage_async)
+    {
+        // saves what is still queued
+        diskwriter_close(&storage);
+        diskwriter_print_stats(&storage);
+    }
+#endif
+    rtlog_close();
     
     
     // freeaddrinfo so that no memory leak
@@ -678,8 +1128,15 @@ void main(void)
     print_all_info();
 
     print_all_info_to_csv();
+    capture_print_stats();
+    latency_print_summary();
+    rtlock_print_report();
+    latency_print_to_csv("latency.csv");
+    rttrace_close();
+    rtmem_report();
 
     printf("\nTEST COMPLETE\n");
+    return 0;
 }
 
 
@@ -688,11 +1145,13 @@ void *Sequencer(void *threadp)
     struct timeval current_time_val;
     struct timeval sta_timeval;
     struct timeval end_timeval;
-    capture_write(0,"test_image.ppm");
-    double current_time;
-    double residual;
-    int rc, delay_cnt=0;
-    unsigned long long seqCnt=0;
+    rtmem_prefault_stack();
+    // warm-up capture: opens the device and sizes every capture buffer
+    capture_write(capture_dev,"test_image.ppm");
+    // scenario times count from here, after the warm-up
+    fault_start();
+    int delay_cnt=0;
+    unsigned long long seqCnt=0, tick=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
     gettimeofday(&current_time_val, (struct timezone *)0);
@@ -700,10 +1159,6 @@ void *Sequencer(void *threadp)
     printf("Sequencer thread @ sec=%d, msec=%d\n", (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
 
 
-    pthread_mutex_init(&timer_flag, NULL);
-    pthread_mutex_lock(&timer_flag);
-    pthread_mutex_init(&image_lock, NULL);
-    pthread_mutex_lock(&image_lock);
     // Initialize the timer for period PERIOD_T sec
     timer_t timer_id = NULL;
     int error_code = init_periodic_timer(&timer_id,SEQ_IN_SEC,SEQ_PERIOD_MSEC);
@@ -714,7 +1169,21 @@ void *Sequencer(void *threadp)
     }
     do
     {
-        pthread_mutex_lock(&timer_flag);
+        sem_wait(&timer_sem);
+        // a tick that came in while the last activation ran is folded into it
+        delay_cnt = (int)overrun_wake(&overrun, seqCnt);
+        if(delay_cnt < 0) continue;
+        // missed ticks never run, the later ideal releases stay on the grid;
+        // a service whose release fell on one of them skips it too
+        if(delay_cnt > 0)
+        {
+            rtsched_stats_skip(&sched_stats[0], delay_cnt);
+            rtsched_stats_skip(&sched_stats[1], (tick + delay_cnt + SEV1_RATIO - 1)/SEV1_RATIO - (tick + SEV1_RATIO - 1)/SEV1_RATIO);
+            rtsched_stats_skip(&sched_stats[2], (tick + delay_cnt + SEV2_RATIO - 1)/SEV2_RATIO - (tick + SEV2_RATIO - 1)/SEV2_RATIO);
+            tick += delay_cnt;
+        }
+        rtsched_stats_begin(&sched_stats[0]);
+        if(seqCnt == RTMEM_WARMUP) rtmem_arm("seq");
 
         gettimeofday(&sta_timeval, (struct timezone *)0);
         rebase_timeval(&sta_timeval,&start_time_val);
@@ -723,23 +1192,34 @@ void *Sequencer(void *threadp)
         info.Seq[seqCnt].D = D_calculate(info.Seq[seqCnt].sta_time,SEQ_PERIOD_MSEC);
 
 
-        if(delay_cnt > 1) printf("Sequencer looping delay %d\n", delay_cnt);
+        if(delay_cnt > 0) printf("Sequencer looping delay %d\n", delay_cnt);
 
 
         // Release each service at a sub-rate of the generic sequencer rate
 
         // Servcie_1 = RT_MAX-1	@ 1 Hz
-        if((seqCnt % SEV1_RATIO) == 0) sem_post(&semS1);
+        if((tick % SEV1_RATIO) == 0)
+        {
+            if(overrun_release(&overrun, 1, seqCnt)) RTTRACE_MARK("s1 release %llu", seqCnt);
+            else rtsched_stats_skip(&sched_stats[1], 1);
+        }
 
         // Service_2 = RT_MAX-2	@ 1 Hz
-        if((seqCnt % SEV2_RATIO) == 0) sem_post(&semS2);
+        if((tick % SEV2_RATIO) == 0)
+        {
+            if(overrun_release(&overrun, 2, seqCnt)) RTTRACE_MARK("s2 release %llu", seqCnt);
+            else rtsched_stats_skip(&sched_stats[2], 1);
+        }
+        fault_inject(FAULT_CPU, "seq");
 
         gettimeofday(&end_timeval, (struct timezone *)0);
         rebase_timeval(&end_timeval,&start_time_val);
         info.Seq[seqCnt].end_time = time_val_to_msec(end_timeval);
         info.Seq[seqCnt].C = C_calculate(info.Seq[seqCnt].sta_time, info.Seq[seqCnt].end_time);
+        fault_record(rtsched_stats_end(&sched_stats[0]));
 
         seqCnt++;
+        tick++;
 
     } while(!abortTest && (seqCnt < threadParams->sequencePeriods));
 
@@ -761,81 +1241,214 @@ void *Sequencer(void *threadp)
 
 
 
+// One release of Service_1, from its thread or the cyclic executive
+void Service_1_job(unsigned long long S1Cnt)
+{
+    struct timeval sta_timeval;
+    struct timeval end_timeval;
+
+    rtsched_stats_begin(&sched_stats[1]);
+    // behind its releases: capture and hand off only
+    int degraded = overrun_degraded(&overrun, 1);
+    if(S1Cnt == RTMEM_WARMUP) rtmem_arm("s1");
+    gettimeofday(&sta_timeval, (struct timezone *)0);
+    rebase_timeval(&sta_timeval,&start_time_val);
+    info.S1[S1Cnt].sta_time = time_val_to_msec(sta_timeval);
+    info.S1[S1Cnt].T = SEV1_PERIOD_MSEC;
+    info.S1[S1Cnt].D = D_calculate(info.S1[S1Cnt].sta_time,SEV1_PERIOD_MSEC);
+
+    fault_inject(FAULT_CPU, "s1");
+    // workload here
+#ifdef SAVE_PPM
+    char filename[30];
+    sprintf(filename, PPM_PATTERN, S1Cnt);
+    capture_frame_t * frame = capture_frame(capture_dev, (storage_async || degraded) ? NULL : filename);
+    if(frame != NULL && storage_async && !degraded)
+    {
+        // only queued here, the writer takes its own reference
+        capture_frame_ppm(frame);
+        capture_frame_ref(frame);
+        if(diskwriter_submit(&storage, S1Cnt, frame->ppm, frame->ppm_len, frame) < 0)
+        {
+            capture_frame_release(frame);
+            rtlog(LOG_ERR, "Disk writer full, frame %llu not saved", S1Cnt);
+        }
+    }
+#else
+    // frame stays in memory for the other services only
+    capture_frame_t * frame = capture_frame(capture_dev, NULL);
+#endif
+    if(frame != NULL)
+    {
+        frame->seq = S1Cnt;
+        // the budget starts at the ideal release, not when capture got going
+        frame->release = rtsched_stats_release(&sched_stats[1]);
+        frame->deadline = frame->release + e2e_deadline_ms*1000000ULL;
+
+        // every consumer takes its own reference on the pooled frame
+        capture_frame_ref(frame);
+        capture_frame_t * stale = __atomic_exchange_n(&latest_frame, frame, __ATOMIC_ACQ_REL);
+        if(stale != NULL) capture_frame_release(stale);
+    }
+    else
+        rtlog(LOG_ERR, "Capture failed, frame %llu", S1Cnt);
+    sem_post_once(&image_sem);
+#ifdef COMPRESS_IMAGE
+    // hand off to the worker pool, never blocks
+    if(frame != NULL && !degraded)
+    {
+        capture_frame_ref(frame);
+        if(workpool_submit(&worker_pool, compress_work, compress_commit, frame) < 0)
+        {
+            capture_frame_release(frame);
+            rtlog(LOG_ERR, "Worker pool full, frame %llu not compressed", S1Cnt);
+        }
+    }
+#endif
+#ifdef TIMELAPSE
+    if(frame != NULL && !degraded && (S1Cnt % TIMELAPSE_RATIO) == 0)
+    {
+        int slot = timelapse_stage(frame);
+        if(slot < 0)
+            rtlog(LOG_ERR, "Timelapse behind, frame %llu skipped", S1Cnt);
+        else if(workpool_submit(&worker_pool, NULL, timelapse_commit, (void *)(uintptr_t)slot) < 0)
+        {
+            timelapse_drop(slot);
+            rtlog(LOG_ERR, "Worker pool full, frame %llu skipped from timelapse", S1Cnt);
+        }
+    }
+#endif
+    capture_frame_release(frame);
+
+    gettimeofday(&end_timeval, (struct timezone *)0);
+    rebase_timeval(&end_timeval,&start_time_val);
+    info.S1[S1Cnt].end_time = time_val_to_msec(end_timeval);
+    info.S1[S1Cnt].C = C_calculate(info.S1[S1Cnt].sta_time, info.S1[S1Cnt].end_time);
+    fault_record(rtsched_stats_end(&sched_stats[1]));
+    overrun_done(&overrun, 1);
+}
+
 void *Service_1(void *threadp)
 {
     struct timeval current_time_val;
-    double current_time;
     unsigned long long S1Cnt=0;
-    threadParams_t *threadParams = (threadParams_t *)threadp;
+
+    rtmem_prefault_stack();
 
     gettimeofday(&current_time_val, (struct timezone *)0);
     syslog(LOG_CRIT, "Frame Sampler thread @ sec=%d, usec=%d\n", (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
     printf("Frame Sampler thread @ sec=%d, usec=%d\n", (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
 
-    struct timeval sta_timeval;
-    struct timeval end_timeval;
-    while(!abortS1)
+    if(sched_mode == RTSCHED_DEADLINE && rtsched_set_deadline(&sched_dl[1], &sched_stats[1]) < 0)
     {
-        sem_wait(&semS1);
-        gettimeofday(&sta_timeval, (struct timezone *)0);
-        rebase_timeval(&sta_timeval,&start_time_val);
-        info.S1[S1Cnt].sta_time = time_val_to_msec(sta_timeval);
-        info.S1[S1Cnt].T = SEV1_PERIOD_MSEC;
-        info.S1[S1Cnt].D = D_calculate(info.S1[S1Cnt].sta_time,SEV1_PERIOD_MSEC);
-
-        // workload here
-        char filename[30];
-        sprintf(filename, "./images/cap_%06lld.ppm",S1Cnt);
-        capture_write(0, filename);
-        pthread_mutex_unlock(&image_lock);
+        perror("Service_1 SCHED_DEADLINE");
+        exit(-1);
+    }
 
-        gettimeofday(&end_timeval, (struct timezone *)0);
-        rebase_timeval(&end_timeval,&start_time_val);
-        info.S1[S1Cnt].end_time = time_val_to_msec(end_timeval);
-        info.S1[S1Cnt].C = C_calculate(info.S1[S1Cnt].sta_time, info.S1[S1Cnt].end_time);
+    while(!abortS1)
+    {
+        if(sched_mode == RTSCHED_FIFO)
+            sem_wait(&semS1);
+        else if(S1Cnt >= seq_periods/SEV1_RATIO)
+            break;
+        else if(S1Cnt > 0)
+            rtsched_wait_next();
+        Service_1_job(S1Cnt);
         S1Cnt++;
 /*        syslog(LOG_CRIT, "Frame Sampler release %llu @ sec=%d, msec=%d\n", S1Cnt, 
             (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);*/
     }
+    if(sched_mode == RTSCHED_DEADLINE)
+    {
+        // no sequencer to stop Service_2, it may be waiting for one more frame
+        abortS2 = TRUE;
+        sem_post_once(&image_sem);
+    }
 
     pthread_exit((void *)0);
 }
 
 
+// One release of Service_2, from its thread or the cyclic executive
+void Service_2_job(unsigned long long S2Cnt)
+{
+    struct timeval sta_timeval;
+    struct timeval end_timeval;
+
+    rtsched_stats_begin(&sched_stats[2]);
+    int degraded = overrun_degraded(&overrun, 2);
+    // the executive cannot block: a frame S1 did not refresh is simply not there
+    if(sched_mode == RTSCHED_CYCLIC)
+        sem_trywait(&image_sem);
+    else
+        sem_wait(&image_sem);
+    if(S2Cnt == RTMEM_WARMUP) rtmem_arm("s2");
+    gettimeofday(&sta_timeval, (struct timezone *)0);
+    rebase_timeval(&sta_timeval,&start_time_val);
+    
+    info.S2[S2Cnt].sta_time = time_val_to_msec(sta_timeval);
+    info.S2[S2Cnt].T = SEV2_PERIOD_MSEC;
+    info.S2[S2Cnt].D = info.S1[S2Cnt].D;
+    
+
+    fault_inject(FAULT_CPU, "s2");
+    // workload here
+    capture_frame_t * frame = __atomic_exchange_n(&latest_frame, NULL, __ATOMIC_ACQ_REL);
+    if(frame != NULL)
+    {
+#ifdef SEND_IMAGE
+        if(!degraded)
+        {
+            // handed to the sender with our reference, never waits for the network
+            capture_frame_t * stale = __atomic_exchange_n(&send_slot, frame, __ATOMIC_ACQ_REL);
+            if(stale != NULL)
+            {
+                send_replaced++;
+                capture_frame_release(stale);
+            }
+            sem_post_once(&send_sem);
+            frame = NULL;
+        }
+#else
+        (void)degraded;
+#endif
+        capture_frame_release(frame);
+    }
+
+    gettimeofday(&end_timeval, (struct timezone *)0);
+    rebase_timeval(&end_timeval,&start_time_val);
+    info.S2[S2Cnt].end_time = time_val_to_msec(end_timeval);
+    info.S2[S2Cnt].C = C_calculate(info.S2[S2Cnt].sta_time, info.S2[S2Cnt].end_time);
+    fault_record(rtsched_stats_end(&sched_stats[2]));
+    overrun_done(&overrun, 2);
+}
+
 void *Service_2(void *threadp)
 {
     struct timeval current_time_val;
-    double current_time;
     unsigned long long S2Cnt=0;
-    threadParams_t *threadParams = (threadParams_t *)threadp;
+
+    rtmem_prefault_stack();
 
     gettimeofday(&current_time_val, (struct timezone *)0);
     syslog(LOG_CRIT, "Time-stamp with Image Analysis thread @ sec=%d, usec=%d\n", (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
     printf("Time-stamp with Image Analysis thread @ sec=%d, usec=%d\n", (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
 
-    struct timeval sta_timeval;
-    struct timeval end_timeval;
-    while(!abortS2)
+    if(sched_mode == RTSCHED_DEADLINE && rtsched_set_deadline(&sched_dl[2], &sched_stats[2]) < 0)
     {
-        sem_wait(&semS2);
-        pthread_mutex_lock(&image_lock);
-        gettimeofday(&sta_timeval, (struct timezone *)0);
-        rebase_timeval(&sta_timeval,&start_time_val);
-        
-        info.S2[S2Cnt].sta_time = time_val_to_msec(sta_timeval);
-        info.S2[S2Cnt].T = SEV2_PERIOD_MSEC;
-        info.S2[S2Cnt].D = info.S1[S2Cnt].D;
-        
-
-        // workload here
-        // char filename[30];
-        // sprintf(filename, "./images/cap_%06lld.ppm",S2Cnt);
-        // send_thread(filename);
+        perror("Service_2 SCHED_DEADLINE");
+        exit(-1);
+    }
 
-        gettimeofday(&end_timeval, (struct timezone *)0);
-        rebase_timeval(&end_timeval,&start_time_val);
-        info.S2[S2Cnt].end_time = time_val_to_msec(end_timeval);
-        info.S2[S2Cnt].C = C_calculate(info.S2[S2Cnt].sta_time, info.S2[S2Cnt].end_time);
+    while(!abortS2)
+    {
+        if(sched_mode == RTSCHED_FIFO)
+            sem_wait(&semS2);
+        else if(S2Cnt >= seq_periods/SEV2_RATIO)
+            break;
+        else if(S2Cnt > 0)
+            rtsched_wait_next();
+        Service_2_job(S2Cnt);
         S2Cnt++;
         //syslog(LOG_CRIT, "Time-stamp with Image Analysis release %llu @ sec=%d, msec=%d\n", S2Cnt, (int)(current_time_val.tv_sec-start_time_val.tv_sec), (int)current_time_val.tv_usec/USEC_PER_MSEC);
     }
@@ -844,6 +1457,39 @@ void *Service_2(void *threadp)
 }
 
 
+//*****************************************************************************
+//
+// Cyclic executive
+//
+//*****************************************************************************
+void *Cyclic_Executive(void *threadp)
+{
+    threadParams_t *threadParams = (threadParams_t *)threadp;
+    cyclic_t exec;
+
+    rtmem_prefault_stack();
+    // warm-up capture, as the sequencer does
+    capture_write(capture_dev,"test_image.ppm");
+    fault_start();
+
+    cyclic_init(&exec);
+    cyclic_add(&exec, "s1", SEV1_PERIOD_MSEC, Service_1_job, &sched_stats[1]);
+    cyclic_add(&exec, "s2", SEV2_PERIOD_MSEC, Service_2_job, &sched_stats[2]);
+    if(cyclic_build(&exec) < 0)
+    {
+        printf("No cyclic schedule for these service periods\n");
+        exit(-1);
+    }
+    cyclic_print_table(&exec);
+
+    // the seq line of the report times the minor frames
+    rtsched_stats_init(&sched_stats[0], "exec", exec.minor_ms*1000000ULL, exec.minor_ms*1000000ULL);
+    cyclic_run(&exec, threadParams->sequencePeriods*SEQ_PERIOD_MSEC/exec.minor_ms, &abortTest, &sched_stats[0]);
+    cyclic_print_stats(&exec);
+
+    pthread_exit((void *)0);
+}
+
 
 double getTimeMsec(void)
 {
@@ -0,0 +1,378 @@
+/*
+ *
+ *  Storage throughput benchmark for the frame writer
+ *  Most added work done by Chutao
+ *
+ *  Saves frame sized buffers to disk at a set rate, the way Service_1 does,
+ *  once per storage engine:
+ *
+ *      sync            open/write/close in the caller, the old Service_1 path
+ *      threads         diskwriter, pwrite() thread pool
+ *      threads_direct  the same with O_DIRECT
+ *      uring           diskwriter, io_uring
+ *      uring_direct    the same with O_DIRECT
+ *
+ *  For each it reports what the caller (the RT service) paid per frame,
+ *  how long a frame took to reach the disk, the throughput and the frames
+ *  dropped, as JSON like capture_bench. `make storagebench` writes
+ *  storage_bench.json.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#include "diskwriter.h"
+#include "latency.h"
+#include "platform.h"
+
+#define SBENCH_FRAMES   (300)
+#define SBENCH_RATE_HZ  (30)
+#define SBENCH_DIR      "./bench_out"
+
+enum sbench_config
+{
+    SCFG_SYNC = 0,
+    SCFG_THREADS,
+    SCFG_THREADS_DIRECT,
+    SCFG_URING,
+    SCFG_URING_DIRECT,
+    SCFG_NUM
+};
+
+static const char *sconfig_names[SCFG_NUM] = {"sync", "threads", "threads_direct", "uring", "uring_direct"};
+static const int sconfig_engine[SCFG_NUM] = {0, DISKWRITER_POOL, DISKWRITER_POOL, DISKWRITER_URING, DISKWRITER_URING};
+static const int sconfig_flags[SCFG_NUM] = {0, 0, DISKWRITER_DIRECT, 0, DISKWRITER_DIRECT};
+
+typedef struct sbench_opts
+{
+    int frames;
+    int rate_hz;            // 0 = back to back
+    size_t frame_len;
+    int sync;               // fsync every file
+    const char *dir;
+    const char *out;        // NULL = stdout
+    int configs[SCFG_NUM];
+}sbench_opts_t;
+
+typedef struct sbench_result
+{
+    const char *engine;
+    double elapsed_s;       // first submit to last frame on disk
+    int written;
+    int dropped;
+    long long *submit_us;   // caller side, per frame
+    long long *done_us;     // submit to on disk, -1 = not written
+}sbench_result_t;
+
+static unsigned long long *submit_ns;
+static sbench_result_t *current;
+static volatile int done_count;
+static unsigned long long last_done_ns;
+
+//*****************************************************************************
+//
+// Statistics
+//
+//*****************************************************************************
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts in place; returns the number of frames counted
+static int percentiles(long long *v, int n, long long *p50, long long *p99, long long *max)
+{
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        if (v[i] >= 0) v[count++] = v[i];
+    if (count == 0) return 0;
+    qsort(v, count, sizeof(long long), cmp_ll);
+    *p50 = v[(count - 1)*50/100];
+    *p99 = v[(count - 1)*99/100];
+    *max = v[count - 1];
+    return count;
+}
+
+//*****************************************************************************
+//
+// One configuration
+//
+//*****************************************************************************
+static void sbench_done(void *arg, int err)
+{
+    int i = (int)(uintptr_t)arg;
+    unsigned long long now = latency_now();
+
+    if (err == 0)
+    {
+        current->done_us[i] = (long long)(now - submit_ns[i])/1000;
+        __atomic_fetch_add(&current->written, 1, __ATOMIC_RELAXED);
+    }
+    last_done_ns = now;
+    __atomic_fetch_add(&done_count, 1, __ATOMIC_RELEASE);
+}
+
+static int sync_write(const char *path, const void *data, size_t len, int sync)
+{
+    size_t done = 0;
+    ssize_t n;
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU|S_IRWXG|S_IRWXO);
+
+    if (fd < 0) return -1;
+    while (done < len)
+    {
+        n = write(fd, (const char *)data + done, len - done);
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    if (sync) fsync(fd);
+    return close(fd);
+}
+
+static int sbench_run(sbench_opts_t *opts, int config, const void *frame, sbench_result_t *r)
+{
+    unsigned long long period_ns = opts->rate_hz ? 1000000000ULL/opts->rate_hz : 0;
+    unsigned long long start, release, t0, t1;
+    char pattern[DISKWRITER_PATH_MAX], path[DISKWRITER_PATH_MAX + 32];
+    struct timespec ts;
+    diskwriter_t *w = NULL;
+    int i;
+
+    memset(r, 0, sizeof(sbench_result_t));
+    r->submit_us = malloc(sizeof(long long)*opts->frames);
+    r->done_us = malloc(sizeof(long long)*opts->frames);
+    if (r->submit_us == NULL || r->done_us == NULL) return -1;
+    for (i = 0; i < opts->frames; i++) r->done_us[i] = -1;
+    current = r;
+    done_count = 0;
+
+    snprintf(pattern, sizeof(pattern), "%s/%s_%%06llu.ppm", opts->dir, sconfig_names[config]);
+    if (config == SCFG_SYNC)
+    {
+        r->engine = "sync";
+    }
+    else
+    {
+        w = malloc(sizeof(diskwriter_t));
+        if (w == NULL || diskwriter_init(w, pattern, sconfig_engine[config],
+                sconfig_flags[config] | (opts->sync ? DISKWRITER_SYNC : 0), sbench_done, NULL) < 0)
+        {
+            free(w);
+            return -1;
+        }
+        r->engine = diskwriter_engine_name(w);
+    }
+
+    start = latency_now();
+    for (i = 0; i < opts->frames; i++)
+    {
+        release = start + (unsigned long long)i*period_ns;
+        ts.tv_sec = release/1000000000ULL;
+        ts.tv_nsec = release%1000000000ULL;
+        if (period_ns) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        t0 = latency_now();
+        submit_ns[i] = t0;
+        if (w == NULL)
+        {
+            snprintf(path, sizeof(path), pattern, (unsigned long long)i);
+            if (sync_write(path, frame, opts->frame_len, opts->sync) == 0)
+            {
+                r->written++;
+                last_done_ns = latency_now();
+                r->done_us[i] = (long long)(last_done_ns - t0)/1000;
+            }
+        }
+        else
+        {
+            // back to back measures the disk, so wait for room instead of dropping
+            while (diskwriter_submit(w, i, frame, opts->frame_len, (void *)(uintptr_t)i) < 0)
+            {
+                if (period_ns)
+                {
+                    r->dropped++;
+                    break;
+                }
+                sched_yield();
+            }
+        }
+        t1 = latency_now();
+        r->submit_us[i] = (long long)(t1 - t0)/1000;
+    }
+
+    if (w != NULL)
+    {
+        // wait for the writer to empty its queue
+        diskwriter_close(w);
+        free(w);
+    }
+    r->elapsed_s = (last_done_ns > start ? last_done_ns - start : 0)/1e9;
+    return 0;
+}
+
+static void sbench_print(FILE *out, sbench_opts_t *opts, int config, sbench_result_t *r, int first)
+{
+    long long p50 = 0, p99 = 0, max = 0;
+    int n;
+
+    fprintf(out, "%s    {\n", first ? "" : ",\n");
+    fprintf(out, "      \"config\": \"%s\",\n", sconfig_names[config]);
+    fprintf(out, "      \"engine\": \"%s\",\n", r->engine);
+    fprintf(out, "      \"frames\": %d,\n", opts->frames);
+    fprintf(out, "      \"written\": %d,\n", r->written);
+    fprintf(out, "      \"dropped\": %d,\n", r->dropped);
+    fprintf(out, "      \"elapsed_s\": %.3f,\n", r->elapsed_s);
+    fprintf(out, "      \"throughput_mb_s\": %.1f,\n",
+            r->elapsed_s > 0 ? r->written*(double)opts->frame_len/1e6/r->elapsed_s : 0.0);
+    n = percentiles(r->submit_us, opts->frames, &p50, &p99, &max);
+    fprintf(out, "      \"caller_us\": {\"n\": %d, \"p50\": %lld, \"p99\": %lld, \"max\": %lld},\n", n, p50, p99, max);
+    p50 = p99 = max = 0;
+    n = percentiles(r->done_us, opts->frames, &p50, &p99, &max);
+    fprintf(out, "      \"to_disk_us\": {\"n\": %d, \"p50\": %lld, \"p99\": %lld, \"max\": %lld}\n", n, p50, p99, max);
+    fprintf(out, "    }");
+}
+
+//*****************************************************************************
+//
+// Main
+//
+//*****************************************************************************
+static void print_usage(char *prog)
+{
+    printf("usage: %s [-c config[,config]...|all] [-n frames] [-r hz] [-W width] [-H height]\n", prog);
+    printf("          [-S] [-d dir] [-o file.json]\n");
+    printf("  config is sync, threads, threads_direct, uring or uring_direct (default all)\n");
+    printf("  -r 0 writes back to back, waiting when the writer queue is full; -S fsyncs every file\n");
+    printf("  -d should be on the storage under test, tmpfs has no O_DIRECT\n");
+}
+
+static int parse_configs(sbench_opts_t *opts, char *list)
+{
+    char *tok, *save;
+    int c, found;
+
+    memset(opts->configs, 0, sizeof(opts->configs));
+    for (tok = strtok_r(list, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        if (strcmp(tok, "all") == 0)
+        {
+            for (c = 0; c < SCFG_NUM; c++) opts->configs[c] = 1;
+            continue;
+        }
+        found = 0;
+        for (c = 0; c < SCFG_NUM; c++)
+        {
+            if (strcmp(tok, sconfig_names[c]) == 0)
+            {
+                opts->configs[c] = 1;
+                found = 1;
+            }
+        }
+        if (!found) return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    sbench_opts_t opts;
+    sbench_result_t result;
+    platform_state_t platform;
+    FILE *out = stdout;
+    unsigned char *frame;
+    int opt, c, width = 640, height = 480, first = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.frames = SBENCH_FRAMES;
+    opts.rate_hz = SBENCH_RATE_HZ;
+    opts.dir = SBENCH_DIR;
+    for (c = 0; c < SCFG_NUM; c++) opts.configs[c] = 1;
+
+    while ((opt = getopt(argc, argv, "c:n:r:W:H:Sd:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (parse_configs(&opts, optarg) < 0)
+                {
+                    printf("Bad config list: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'n': opts.frames = atoi(optarg); break;
+            case 'r': opts.rate_hz = atoi(optarg); break;
+            case 'W': width = atoi(optarg); break;
+            case 'H': height = atoi(optarg); break;
+            case 'S': opts.sync = 1; break;
+            case 'd': opts.dir = optarg; break;
+            case 'o': opts.out = optarg; break;
+            default:
+                print_usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (opts.frames <= 0) opts.frames = 1;
+
+    // a PPM of the frame size, the content does not matter to the disk
+    opts.frame_len = (size_t)width*height*3 + 32;
+    frame = malloc(opts.frame_len);
+    submit_ns = malloc(sizeof(unsigned long long)*opts.frames);
+    if (frame == NULL || submit_ns == NULL)
+    {
+        printf("Out of memory\n");
+        exit(-1);
+    }
+    memset(frame, 0x80, opts.frame_len);
+    opts.frame_len -= 32 - sprintf((char *)frame, "P6\n%d %d\n255\n", width, height);
+    mkdir(opts.dir, S_IRWXU|S_IRWXG|S_IRWXO);
+
+    if (opts.out != NULL && (out = fopen(opts.out, "w")) == NULL)
+    {
+        perror(opts.out);
+        exit(-1);
+    }
+
+    fprintf(out, "{\n  \"dir\": \"%s\",\n  \"frame_bytes\": %zu,\n", opts.dir, opts.frame_len);
+    fprintf(out, "  \"rate_hz\": %d,\n  \"fsync\": %s,\n", opts.rate_hz, opts.sync ? "true" : "false");
+    platform_probe(&platform, NULL, 0);
+    fprintf(out, "  \"platform\": ");
+    platform_print_json(out, &platform);
+    fprintf(out, ",\n  \"runs\": [\n");
+    for (c = 0; c < SCFG_NUM; c++)
+    {
+        if (!opts.configs[c]) continue;
+        fprintf(stderr, "storage_bench: %s, %d frames\n", sconfig_names[c], opts.frames);
+        if (sbench_run(&opts, c, frame, &result) < 0)
+        {
+            printf("Benchmark %s failed\n", sconfig_names[c]);
+            exit(-1);
+        }
+        sbench_print(out, &opts, c, &result, first);
+        first = 0;
+        free(result.submit_us);
+        free(result.done_us);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    free(frame);
+    free(submit_ns);
+    return 0;
+}
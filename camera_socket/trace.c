@@ -0,0 +1,228 @@
+/*
+ *
+ *  Service traces, see trace.h
+ *  Most added work done by Chutao
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_FIELDS    (6)     // Count, Start Time, End Time, C, T, D
+
+//*****************************************************************************
+//
+// Row parsing
+//
+//*****************************************************************************
+// "S1, 12, 3402, 4064, 662, 1000, 4402" without the newline
+static int trace_parse_row(const char *p, const char *end, char *name, long *v)
+{
+    int len = 0, i;
+
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (p < end && *p != ',')
+    {
+        if (len < TRACE_NAME_MAX - 1) name[len++] = *p;
+        p++;
+    }
+    while (len > 0 && (name[len-1] == ' ' || name[len-1] == '\t')) len--;
+    name[len] = '\0';
+    if (len == 0) return -1;
+
+    for (i = 0; i < TRACE_FIELDS; i++)
+    {
+        long x = 0;
+        int neg = 0, digits = 0;
+
+        if (p >= end || *p != ',') return -1;
+        p++;
+        while (p < end && *p == ' ') p++;
+        if (p < end && *p == '-')
+        {
+            neg = 1;
+            p++;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            x = x*10 + (*p++ - '0');
+            digits++;
+        }
+        if (digits == 0) return -1;
+        while (p < end && (*p == ' ' || *p == '\r')) p++;
+        v[i] = neg ? -x : x;
+    }
+    return 0;
+}
+
+static int trace_hist_add(trace_service_t *s, int c)
+{
+    if (c >= s->hist_len)
+    {
+        int len = s->hist_len ? s->hist_len : 64;
+        unsigned int *h;
+
+        while (len <= c) len *= 2;
+        h = realloc(s->c_hist, sizeof(unsigned int)*len);
+        if (h == NULL) return -1;
+        memset(h + s->hist_len, 0, sizeof(unsigned int)*(len - s->hist_len));
+        s->c_hist = h;
+        s->hist_len = len;
+    }
+    s->c_hist[c]++;
+    return 0;
+}
+
+static int trace_add(trace_t *t, int *last, const char *name, const long *v)
+{
+    trace_service_t *s;
+    long sta = v[1], end = v[2], C = v[3], T = v[4], D = v[5];
+    long resp;
+
+    if (T <= 0 || C < 0 || end < sta)
+    {
+        t->skipped++;
+        return 0;
+    }
+
+    // rows come grouped by service, the last one nearly always matches
+    if (*last < 0 || strcmp(t->svc[*last].name, name) != 0)
+    {
+        *last = trace_find(t, name);
+        if (*last < 0)
+        {
+            if (t->count == TRACE_MAX_SERVICES)
+            {
+                t->skipped++;
+                return 0;
+            }
+            *last = t->count++;
+            strcpy(t->svc[*last].name, name);
+        }
+    }
+    s = &t->svc[*last];
+
+    s->n++;
+    s->T = (int)T;
+    s->c_sum += C;
+    if (C > s->c_max) s->c_max = (int)C;
+    resp = end - (D - T);
+    if (resp > s->resp_max) s->resp_max = (int)resp;
+    if (end > D) s->misses++;
+    t->rows++;
+    return trace_hist_add(s, (int)C);
+}
+
+//*****************************************************************************
+//
+// Loading
+//
+//*****************************************************************************
+int trace_load(trace_t *t, const char *path)
+{
+    char name[TRACE_NAME_MAX];
+    long v[TRACE_FIELDS];
+    char *buf;
+    size_t have = 0;
+    ssize_t got;
+    int fd, last = -1, rc = 0;
+
+    memset(t, 0, sizeof(trace_t));
+    fd = strcmp(path, "-") == 0 ? 0 : open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    buf = malloc(TRACE_BLOCK_SIZE);
+    if (buf == NULL)
+    {
+        if (fd != 0) close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (;;)
+    {
+        char *p, *nl, *end;
+
+        got = read(fd, buf + have, TRACE_BLOCK_SIZE - have);
+        if (got < 0)
+        {
+            if (errno == EINTR) continue;
+            rc = -1;
+            break;
+        }
+        end = buf + have + got;
+        p = buf;
+        // the last block may end without a newline
+        while ((nl = memchr(p, '\n', end - p)) != NULL || (got == 0 && p < end))
+        {
+            char *eol = nl != NULL ? nl : end;
+
+            if (eol > p && trace_parse_row(p, eol, name, v) == 0)
+            {
+                if (trace_add(t, &last, name, v) < 0)
+                {
+                    errno = ENOMEM;
+                    rc = -1;
+                    break;
+                }
+            }
+            else if (eol > p)
+                t->skipped++;
+            p = eol + (nl != NULL);
+        }
+        if (rc < 0 || got == 0) break;
+
+        // keep the partial line for the next block
+        have = end - p;
+        if (have == TRACE_BLOCK_SIZE)
+        {
+            // a line longer than a block is not a trace row
+            t->skipped++;
+            have = 0;
+        }
+        memmove(buf, p, have);
+    }
+
+    free(buf);
+    if (fd != 0) close(fd);
+    if (rc < 0) trace_free(t);
+    return rc;
+}
+
+void trace_free(trace_t *t)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++)
+    {
+        free(t->svc[i].c_hist);
+        t->svc[i].c_hist = NULL;
+        t->svc[i].hist_len = 0;
+    }
+}
+
+int trace_find(const trace_t *t, const char *name)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++)
+        if (strcmp(t->svc[i].name, name) == 0) return i;
+    return -1;
+}
+
+int trace_c_percentile(const trace_service_t *s, double pct)
+{
+    unsigned long long want = (unsigned long long)(pct/100.0*s->n + 0.5), seen = 0;
+    int c;
+
+    if (want == 0) want = 1;
+    for (c = 0; c < s->hist_len; c++)
+    {
+        seen += s->c_hist[c];
+        if (seen >= want) return c;
+    }
+    return s->c_max;
+}
@@ -0,0 +1,59 @@
+/*
+ *
+ *  Service traces, the rows of record.csv
+ *  Most added work done by Chutao
+ *
+ *  "Service Name, Count, Start Time, End Time, C, T, D", times in ms. D is
+ *  the absolute deadline, release + T, where the release is the sequencer
+ *  tick that let the service go; so the release of a row is D - T and its
+ *  observed response End - (D - T). Rows with T = 0 were never filled in
+ *  (a run shorter than FRAME_NUM) and are skipped, as is the header.
+ *
+ *  The file is read in large blocks and parsed in place, no stdio line
+ *  reads and no sscanf(), so traces of millions of rows load in well under
+ *  a second. Per service only counters and a 1 ms histogram of C are kept,
+ *  the histogram is what percentiles and the simulator draw from.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAX_SERVICES  (16)
+#define TRACE_NAME_MAX      (16)
+#define TRACE_BLOCK_SIZE    (1024*1024)
+
+typedef struct trace_service
+{
+    char name[TRACE_NAME_MAX];
+    unsigned long long n;
+    int T;                          // last period seen, ms
+    int c_max;                      // observed WCET, ms
+    unsigned long long c_sum;
+    unsigned int *c_hist;           // c_hist[C] = rows with that C
+    int hist_len;
+    int resp_max;                   // End - release
+    unsigned long long misses;      // End > D
+}trace_service_t;
+
+typedef struct trace
+{
+    trace_service_t svc[TRACE_MAX_SERVICES];   // in order of first appearance
+    int count;
+    unsigned long long rows;
+    unsigned long long skipped;     // header, unfilled and malformed rows
+}trace_t;
+
+// path "-" reads stdin; 0 or -1 with errno
+int trace_load(trace_t *t, const char *path);
+void trace_free(trace_t *t);
+int trace_find(const trace_t *t, const char *name);        // index or -1
+int trace_c_percentile(const trace_service_t *s, double pct);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
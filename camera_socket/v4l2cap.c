@@ -0,0 +1,233 @@
+/*
+ *
+ *  Native V4L2 streaming capture with mmap buffers
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "v4l2cap.h"
+
+// retry on signals, the SIGEV_THREAD timer can interrupt a blocking DQBUF
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int rc;
+
+    do
+    {
+        rc = ioctl(fd, request, arg);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+// Formats OpenCV can use without a decoder, best first: BGR24 is used in place
+static const unsigned int v4l2cap_formats[] =
+{
+    V4L2_PIX_FMT_BGR24,
+    V4L2_PIX_FMT_RGB24,
+    V4L2_PIX_FMT_YUYV,
+};
+
+static int v4l2cap_set_format(v4l2cap_t *cap, int width, int height)
+{
+    struct v4l2_format fmt;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(v4l2cap_formats)/sizeof(v4l2cap_formats[0]); i++)
+    {
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = v4l2cap_formats[i];
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if (xioctl(cap->fd, VIDIOC_S_FMT, &fmt) < 0)
+        {
+            perror("VIDIOC_S_FMT");
+            return -1;
+        }
+        // the driver answers with the closest format it has
+        if (fmt.fmt.pix.pixelformat == v4l2cap_formats[i])
+        {
+            cap->width = fmt.fmt.pix.width;
+            cap->height = fmt.fmt.pix.height;
+            cap->pixelformat = fmt.fmt.pix.pixelformat;
+            cap->bytesperline = fmt.fmt.pix.bytesperline;
+            return 0;
+        }
+    }
+    printf("V4L2 device has no BGR24, RGB24 or YUYV format\n");
+    return -1;
+}
+
+static int v4l2cap_map_buffers(v4l2cap_t *cap)
+{
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    int i;
+
+    memset(&req, 0, sizeof(req));
+    req.count = V4L2CAP_NUM_BUFS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cap->fd, VIDIOC_REQBUFS, &req) < 0)
+    {
+        perror("VIDIOC_REQBUFS");
+        return -1;
+    }
+    if (req.count < V4L2CAP_MIN_QUEUED + 1)
+    {
+        printf("V4L2 driver granted only %u buffers\n", req.count);
+        return -1;
+    }
+    cap->num_bufs = req.count > V4L2CAP_MAX_BUFS ? V4L2CAP_MAX_BUFS : req.count;
+
+    for (i = 0; i < cap->num_bufs; i++)
+    {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(cap->fd, VIDIOC_QUERYBUF, &buf) < 0)
+        {
+            perror("VIDIOC_QUERYBUF");
+            return -1;
+        }
+        // writable, the overlays are stamped straight into the driver buffer
+        cap->start[i] = mmap(NULL, buf.length, PROT_READ|PROT_WRITE, MAP_SHARED, cap->fd, buf.m.offset);
+        if (cap->start[i] == MAP_FAILED)
+        {
+            cap->start[i] = NULL;
+            perror("V4L2 mmap");
+            return -1;
+        }
+        cap->length[i] = buf.length;
+        cap->ts_monotonic = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    }
+    return 0;
+}
+
+int v4l2cap_open(v4l2cap_t *cap, int dev, int width, int height)
+{
+    char path[32];
+    struct v4l2_capability caps;
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int i;
+
+    memset(cap, 0, sizeof(v4l2cap_t));
+    snprintf(path, sizeof(path), "/dev/video%d", dev);
+    cap->fd = open(path, O_RDWR);
+    if (cap->fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if (xioctl(cap->fd, VIDIOC_QUERYCAP, &caps) < 0)
+    {
+        perror("VIDIOC_QUERYCAP");
+        goto fail;
+    }
+    if (!(caps.device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps.device_caps & V4L2_CAP_STREAMING))
+    {
+        printf("%s (%s) cannot stream video capture\n", path, caps.card);
+        goto fail;
+    }
+
+    if (v4l2cap_set_format(cap, width, height) < 0) goto fail;
+    if (v4l2cap_map_buffers(cap) < 0) goto fail;
+
+    for (i = 0; i < cap->num_bufs; i++)
+    {
+        if (v4l2cap_queue(cap, i) < 0) goto fail;
+    }
+    if (xioctl(cap->fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        perror("VIDIOC_STREAMON");
+        goto fail;
+    }
+
+    printf("V4L2 %s (%s): %dx%d %.4s, %d mmap buffers\n", path, caps.card,
+           cap->width, cap->height, (char *)&cap->pixelformat, cap->num_bufs);
+    return 0;
+
+fail:
+    v4l2cap_close(cap);
+    return -1;
+}
+
+// Blocks until the driver has a filled buffer. The buffer belongs to the
+// caller until it is handed back with v4l2cap_queue().
+int v4l2cap_dequeue(v4l2cap_t *cap, v4l2cap_buf_t *out)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cap->fd, VIDIOC_DQBUF, &buf) < 0)
+    {
+        perror("VIDIOC_DQBUF");
+        return -1;
+    }
+    __sync_fetch_and_sub(&cap->queued, 1);
+
+    out->index = buf.index;
+    out->data = (unsigned char *)cap->start[buf.index];
+    out->bytesused = buf.bytesused;
+    out->timestamp = buf.timestamp;
+    out->sequence = buf.sequence;
+    if (buf.flags & V4L2_BUF_FLAG_ERROR)
+    {
+        // the data may be corrupt, give it straight back
+        v4l2cap_queue(cap, buf.index);
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// Safe from any thread, frames are released by the worker pool too
+int v4l2cap_queue(v4l2cap_t *cap, int index)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (xioctl(cap->fd, VIDIOC_QBUF, &buf) < 0)
+    {
+        perror("VIDIOC_QBUF");
+        return -1;
+    }
+    __sync_fetch_and_add(&cap->queued, 1);
+    return 0;
+}
+
+void v4l2cap_close(v4l2cap_t *cap)
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int i;
+
+    if (cap->fd < 0) return;
+    xioctl(cap->fd, VIDIOC_STREAMOFF, &type);
+    for (i = 0; i < cap->num_bufs; i++)
+    {
+        if (cap->start[i] != NULL) munmap(cap->start[i], cap->length[i]);
+    }
+    close(cap->fd);
+    cap->fd = -1;
+    cap->num_bufs = 0;
+    cap->queued = 0;
+}
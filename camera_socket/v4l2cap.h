@@ -0,0 +1,61 @@
+/*
+ *
+ *  Native V4L2 streaming capture with mmap buffers
+ *  Most added work done by Chutao
+ *
+ *  The driver fills a ring of mmap'd buffers. v4l2cap_dequeue() hands one
+ *  out in place, stamped with the driver timestamp, and v4l2cap_queue()
+ *  gives it back once nothing looks at it any more. No copy is made and
+ *  nothing is converted here.
+ *
+ *  Test without a camera on the vivid virtual driver:
+ *      sudo modprobe vivid n_devs=1 node_types=0x1
+ *      ./seqgen -b v4l2 -d <N>         (N from /dev/videoN)
+ */
+#ifndef V4L2CAP_H
+#define V4L2CAP_H
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define V4L2CAP_MAX_BUFS    (8)
+#define V4L2CAP_NUM_BUFS    (6)     // requested from the driver
+#define V4L2CAP_MIN_QUEUED  (2)     // below this a frame is copied out and its buffer requeued
+
+typedef struct v4l2cap_buf
+{
+    int index;
+    unsigned char *data;
+    size_t bytesused;
+    struct timeval timestamp;       // driver timestamp, see v4l2cap_t.ts_monotonic
+    unsigned int sequence;          // driver frame counter, gaps are frames the driver dropped
+}v4l2cap_buf_t;
+
+typedef struct v4l2cap
+{
+    int fd;
+    int width;
+    int height;
+    unsigned int pixelformat;       // V4L2_PIX_FMT_BGR24, _RGB24 or _YUYV
+    unsigned int bytesperline;
+    int num_bufs;
+    void *start[V4L2CAP_MAX_BUFS];
+    size_t length[V4L2CAP_MAX_BUFS];
+    volatile int queued;            // buffers owned by the driver
+    int ts_monotonic;               // timestamps are CLOCK_MONOTONIC (almost every driver)
+}v4l2cap_t;
+
+int v4l2cap_open(v4l2cap_t *cap, int dev, int width, int height);
+int v4l2cap_dequeue(v4l2cap_t *cap, v4l2cap_buf_t *buf);
+int v4l2cap_queue(v4l2cap_t *cap, int index);
+void v4l2cap_close(v4l2cap_t *cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* V4L2CAP_H */
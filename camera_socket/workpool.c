@@ -0,0 +1,253 @@
+/*
+ *
+ *  Work-stealing worker pool for best-effort jobs (compression, encoding)
+ *  Most added work done by Chutao
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workpool.h"
+
+//*****************************************************************************
+//
+// Deque helpers, each deque is protected by its own lock
+//
+//*****************************************************************************
+static bool deque_push(workpool_deque_t *dq, workpool_job_t *job)
+{
+    bool pushed = false;
+    rtlock_lock(&dq->lock);
+    if(dq->count < WORKPOOL_QUEUE_DEPTH)
+    {
+        dq->jobs[(dq->head + dq->count) % WORKPOOL_QUEUE_DEPTH] = *job;
+        dq->count++;
+        pushed = true;
+    }
+    rtlock_unlock(&dq->lock);
+    return pushed;
+}
+
+static bool deque_pop(workpool_deque_t *dq, workpool_job_t *job)
+{
+    bool popped = false;
+    rtlock_lock(&dq->lock);
+    if(dq->count > 0)
+    {
+        *job = dq->jobs[dq->head];
+        dq->head = (dq->head + 1) % WORKPOOL_QUEUE_DEPTH;
+        dq->count--;
+        popped = true;
+    }
+    rtlock_unlock(&dq->lock);
+    return popped;
+}
+
+//*****************************************************************************
+//
+// Reorder buffer: commit callbacks run strictly in sequence order
+//
+//*****************************************************************************
+static void workpool_complete(workpool_t *pool, workpool_job_t *job)
+{
+    unsigned int slot;
+
+    rtlock_lock(&pool->commit_lock);
+    slot = job->seq % WORKPOOL_REORDER_DEPTH;
+    pool->done[slot] = *job;
+    pool->done_valid[slot] = true;
+
+    // drain every job that is now in order
+    slot = pool->next_commit % WORKPOOL_REORDER_DEPTH;
+    while(pool->done_valid[slot] && pool->done[slot].seq == pool->next_commit)
+    {
+        if(pool->done[slot].commit != NULL)
+            pool->done[slot].commit(pool->done[slot].arg, pool->done[slot].seq);
+        pool->done_valid[slot] = false;
+        pool->next_commit++;
+        slot = pool->next_commit % WORKPOOL_REORDER_DEPTH;
+    }
+    rtlock_unlock(&pool->commit_lock);
+}
+
+//*****************************************************************************
+//
+// Worker thread: own deque first, then steal from the others
+//
+//*****************************************************************************
+static bool workpool_take(workpool_worker_t *self, workpool_job_t *job)
+{
+    workpool_t *pool = self->pool;
+    int i, victim;
+
+    if(deque_pop(&pool->deques[self->idx], job)) return true;
+    for(i = 1; i < pool->num_workers; i++)
+    {
+        victim = (self->idx + i) % pool->num_workers;
+        if(deque_pop(&pool->deques[victim], job))
+        {
+            self->stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *workpool_worker(void *threadp)
+{
+    workpool_worker_t *self = (workpool_worker_t *)threadp;
+    workpool_t *pool = self->pool;
+    workpool_job_t job;
+    bool found;
+
+    while(1)
+    {
+        sem_wait(&pool->work_sem);
+
+        // The sweep is not atomic: while we look at one deque another worker
+        // may steal the job our count was posted for, and the job it was
+        // posted for sits in a deque we already passed. Every count still
+        // held stands for a queued job, so sweep again instead of dropping
+        // the count. Only a stop count can come up empty for good, and after
+        // stop nothing is pushed any more.
+        while(!(found = workpool_take(self, &job)) && !pool->stop)
+            sched_yield();
+        if(!found) break;
+
+        if(job.work != NULL)
+            job.work(job.arg, job.seq);
+        self->executed++;
+        workpool_complete(pool, &job);
+    }
+
+    pthread_exit((void *)0);
+}
+
+//*****************************************************************************
+//
+// Public interface
+//
+//*****************************************************************************
+int workpool_init(workpool_t *pool, int num_workers, cpu_set_t *cpus)
+{
+    int i, rc;
+    pthread_attr_t attr;
+    struct sched_param param;
+
+    if(num_workers < 1) num_workers = 1;
+    if(num_workers > WORKPOOL_MAX_WORKERS) num_workers = WORKPOOL_MAX_WORKERS;
+
+    memset(pool, 0, sizeof(workpool_t));
+    pool->num_workers = num_workers;
+
+    if(sem_init(&pool->work_sem, 0, 0))
+    {
+        printf("Failed to initialize workpool semaphore\n");
+        return -1;
+    }
+    rtlock_init(&pool->commit_lock, "workpool.commit");
+    for(i = 0; i < num_workers; i++)
+    {
+        char name[RTLOCK_NAME_MAX];
+        snprintf(name, sizeof(name), "workpool.deque%d", i);
+        rtlock_init(&pool->deques[i].lock, name);
+    }
+
+    // workers are best effort: SCHED_OTHER even when created from an RT
+    // thread, and kept off the RT cores
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    if(cpus != NULL && CPU_COUNT(cpus) > 0)
+    {
+        rc = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+        if(rc != 0) printf("workpool: cannot set affinity (%s)\n", strerror(rc));
+    }
+
+    for(i = 0; i < num_workers; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].idx = i;
+        rc = pthread_create(&pool->workers[i].thread, &attr, workpool_worker, &pool->workers[i]);
+        if(rc != 0)
+        {
+            printf("workpool: pthread_create for worker %d failed (%s)\n", i, strerror(rc));
+            pool->num_workers = i;
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    return (pool->num_workers > 0) ? 0 : -1;
+}
+
+// Never blocks, so it is safe to call from an RT service. Returns -1 when the
+// pool is saturated and the job is dropped. Only one thread may submit.
+int workpool_submit(workpool_t *pool, workpool_fn_t work, workpool_fn_t commit, void *arg)
+{
+    workpool_job_t job;
+    int i, target;
+
+    // keep the reorder buffer from wrapping over jobs not yet committed
+    if(pool->next_seq - pool->next_commit >= WORKPOOL_REORDER_DEPTH)
+    {
+        pool->dropped++;
+        return -1;
+    }
+
+    job.seq = pool->next_seq;
+    job.work = work;
+    job.commit = commit;
+    job.arg = arg;
+
+    for(i = 0; i < pool->num_workers; i++)
+    {
+        target = (pool->next_worker + i) % pool->num_workers;
+        if(deque_push(&pool->deques[target], &job))
+        {
+            pool->next_worker = (target + 1) % pool->num_workers;
+            pool->next_seq++;
+            sem_post(&pool->work_sem);
+            return 0;
+        }
+    }
+
+    pool->dropped++;
+    return -1;
+}
+
+// Runs every job still queued, then joins the workers.
+void workpool_destroy(workpool_t *pool)
+{
+    int i;
+
+    pool->stop = true;
+    for(i = 0; i < pool->num_workers; i++)
+        sem_post(&pool->work_sem);
+    for(i = 0; i < pool->num_workers; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for(i = 0; i < pool->num_workers; i++)
+        rtlock_destroy(&pool->deques[i].lock);
+    rtlock_destroy(&pool->commit_lock);
+    sem_destroy(&pool->work_sem);
+}
+
+void workpool_print_stats(workpool_t *pool)
+{
+    int i;
+
+    printf("Workpool: %d workers, %llu jobs committed, %llu dropped\n",
+           pool->num_workers, pool->next_commit, pool->dropped);
+    for(i = 0; i < pool->num_workers; i++)
+    {
+        printf("  worker %d: executed %llu, stolen %llu\n", i,
+               pool->workers[i].executed, pool->workers[i].stolen);
+    }
+}
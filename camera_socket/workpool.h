@@ -0,0 +1,92 @@
+/*
+ *
+ *  Work-stealing worker pool for best-effort jobs (compression, encoding)
+ *  Most added work done by Chutao
+ *
+ *  Each worker owns a small job deque. Jobs are handed out round-robin by the
+ *  submitter (normally an RT service) and an idle worker steals from the other
+ *  deques before going back to sleep. Every job gets a sequence number at
+ *  submit time; the commit callback of a job only runs once every job with a
+ *  lower sequence number has committed, so output order matches submit order
+ *  no matter which worker finished first.
+ */
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "rtlock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORKPOOL_MAX_WORKERS    (8)
+#define WORKPOOL_QUEUE_DEPTH    (32)    // per worker
+#define WORKPOOL_REORDER_DEPTH  (WORKPOOL_MAX_WORKERS*WORKPOOL_QUEUE_DEPTH)
+
+typedef void (*workpool_fn_t)(void *arg, unsigned long long seq);
+
+typedef struct workpool_job
+{
+    unsigned long long seq;
+    workpool_fn_t work;     // runs on any worker, in parallel
+    workpool_fn_t commit;   // runs in sequence order, one at a time
+    void *arg;
+}workpool_job_t;
+
+typedef struct workpool_deque
+{
+    rtlock_t lock;          // the RT submitter pushes, workers pop
+    workpool_job_t jobs[WORKPOOL_QUEUE_DEPTH];
+    unsigned int head;      // oldest job
+    unsigned int count;
+}workpool_deque_t;
+
+struct workpool;
+
+typedef struct workpool_worker
+{
+    struct workpool *pool;
+    int idx;
+    pthread_t thread;
+    unsigned long long executed;
+    unsigned long long stolen;
+}workpool_worker_t;
+
+typedef struct workpool
+{
+    int num_workers;
+    workpool_worker_t workers[WORKPOOL_MAX_WORKERS];
+    workpool_deque_t deques[WORKPOOL_MAX_WORKERS];
+    sem_t work_sem;         // one count per queued job
+    volatile bool stop;
+
+    // submit side, only touched by the submitting thread
+    unsigned long long next_seq;
+    unsigned int next_worker;
+    unsigned long long dropped;
+
+    // reorder buffer
+    rtlock_t commit_lock;
+    volatile unsigned long long next_commit;
+    workpool_job_t done[WORKPOOL_REORDER_DEPTH];
+    bool done_valid[WORKPOOL_REORDER_DEPTH];
+}workpool_t;
+
+int workpool_init(workpool_t *pool, int num_workers, cpu_set_t *cpus);
+int workpool_submit(workpool_t *pool, workpool_fn_t work, workpool_fn_t commit, void *arg);
+void workpool_destroy(workpool_t *pool);
+void workpool_print_stats(workpool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKPOOL_H */
@@ -1,24 +1,8 @@
 #! /bin/bash
 
+# The platform setup (userspace/performance governor at the highest speed,
+# CPUs online, sched_rt_runtime_us=-1, timer slack, IRQs off the RT cores)
+# now lives in seqgen, see camera_socket/platform.h. It checks every
+# setting took and refuses to run when one did not.
 clear
-echo userspace > /sys/devices/system/cpu/cpu0/cpufreq/scaling_governor
-cat /sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu0/cpufreq/scaling_min_freq
-cat /sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu0/cpufreq/scaling_setspeed
-echo 1 > /sys/devices/system/cpu/cpu0/online
-
-echo userspace > /sys/devices/system/cpu/cpu1/cpufreq/scaling_governor
-cat /sys/devices/system/cpu/cpu1/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu1/cpufreq/scaling_min_freq
-cat /sys/devices/system/cpu/cpu1/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu1/cpufreq/scaling_setspeed
-echo 1 > /sys/devices/system/cpu/cpu1/online
-
-echo userspace > /sys/devices/system/cpu/cpu2/cpufreq/scaling_governor
-cat /sys/devices/system/cpu/cpu2/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu2/cpufreq/scaling_min_freq
-cat /sys/devices/system/cpu/cpu2/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu2/cpufreq/scaling_setspeed
-echo 1 > /sys/devices/system/cpu/cpu2/online
-
-echo userspace > /sys/devices/system/cpu/cpu3/cpufreq/scaling_governor
-cat /sys/devices/system/cpu/cpu3/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu3/cpufreq/scaling_min_freq
-cat /sys/devices/system/cpu/cpu3/cpufreq/scaling_max_freq > /sys/devices/system/cpu/cpu3/cpufreq/scaling_setspeed
-echo 1 > /sys/devices/system/cpu/cpu3/online
-
-sysctl kernel.sched_rt_runtime_us=-1
+cd "$(dirname "$0")/camera_socket" && exec ./seqgen -P apply,strict "$@"
@@ -0,0 +1,49 @@
+# Name: profiles.mk
+# Description: build profiles shared by every makefile in the project
+#
+#   make                      release: -O3, architecture tuning, LTO
+#   make PROFILE=profile      -O2 with frame pointers, for perf and gprof-free sampling
+#   make PROFILE=debug        -O0 -g3, what every makefile used to build
+#   make ARCH=pi4             tune for the Raspberry Pi 4 (Cortex-A72) instead of the
+#                             build machine, use it when cross compiling
+#   make ARCH=generic         no architecture flags, binary runs on any CPU of the family
+#   make PGO=gen / PGO=use    profile guided optimization, see the pgo target in
+#                             camera_socket/makefile (profile data in $(PGO_DIR))
+#
+# Makefiles include this file and add $(PROFILE_CFLAGS) to the compile flags
+# and $(PROFILE_LDFLAGS) to the link line.
+
+PROFILE ?= release
+ARCH ?= native
+PGO ?=
+PGO_DIR ?= $(CURDIR)/pgo
+
+ifeq ($(ARCH),native)
+	ARCH_FLAGS = -march=native
+else ifeq ($(ARCH),pi4)
+	ARCH_FLAGS = -mcpu=cortex-a72 -mtune=cortex-a72
+else
+	ARCH_FLAGS =
+endif
+
+ifeq ($(PROFILE),release)
+	PROFILE_CFLAGS = -O3 -g $(ARCH_FLAGS) -flto=auto
+	PROFILE_LDFLAGS = -O3 $(ARCH_FLAGS) -flto=auto
+else ifeq ($(PROFILE),profile)
+	PROFILE_CFLAGS = -O2 -g $(ARCH_FLAGS) -fno-omit-frame-pointer
+	PROFILE_LDFLAGS =
+else ifeq ($(PROFILE),debug)
+	PROFILE_CFLAGS = -O0 -g3 -fno-omit-frame-pointer
+	PROFILE_LDFLAGS =
+else
+$(error PROFILE must be release, profile or debug)
+endif
+
+ifeq ($(PGO),gen)
+	PROFILE_CFLAGS += -fprofile-generate -fprofile-dir=$(PGO_DIR)
+	PROFILE_LDFLAGS += -fprofile-generate
+else ifeq ($(PGO),use)
+	# a missing or partial profile only costs the optimization, not the build
+	PROFILE_CFLAGS += -fprofile-use -fprofile-dir=$(PGO_DIR) -fprofile-partial-training -Wno-missing-profile
+	PROFILE_LDFLAGS += -fprofile-use
+endif
@@ -9,6 +9,7 @@
  */
 
 /********************* Include *********************/
+#define _GNU_SOURCE
 // std related
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,7 @@
 
 // Time related
 #include <time.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 // Signal/Exception related
@@ -44,6 +46,19 @@
 
 //#define WRITE_ERROR_TO_FILE
 #define BUF_SIZE 925696
+// Fixed receive buffers, one per connection in flight. Each one holds a
+// whole image (a 1280x720 PPM is about 2.7MB) plus the '\n''#''EOT' trailer
+#define RECV_POOL_BUFS 4
+#define RECV_BUF_SIZE (4*1024*1024)
+// fsync every image before it counts as received
+#define SYNC_IMAGE
+// Per image receive/fsync timestamps, joined with the camera latency.csv
+// on the capture time found in the "# sec=, msec=" PPM comment
+#define RECV_LATENCY_FILE "./images/recv_latency.csv"
+// "\n#E2E frame=, release=, deadline=" line the camera puts before the
+// trailer of a frame with a deadline, wall clock usec, see netsend.h
+#define E2E_TAG "\n#E2E "
+#define E2E_LINE_MAX 96
 #define CHUTAO_IP_ADDR "71.205.27.171"
 #define PORT "9000"
 #define SAM_IP_ADDR "71.205.27.171"
@@ -85,6 +100,14 @@ volatile bool caught_sigint = false;
 volatile bool caught_sigterm = false;
 // mutex
 pthread_mutex_t lock;
+// receive buffer pool, allocated once in main
+char * recv_pool_mem = NULL;
+char * recv_pool_free[RECV_POOL_BUFS];
+int recv_pool_count = 0;
+pthread_mutex_t recv_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t recv_pool_cond = PTHREAD_COND_INITIALIZER;
+// latency log
+int latency_fd = -1;
 /********************* Signal Handler *********************/
 
 static void signal_handler(int signal_number)
@@ -112,6 +135,20 @@ bool check_main_input_arg(int argc, char *argv[]);
 int init_signal_handle(void);
 int aesd_recv(int sockfd);
 int aesd_send(int sockfd);
+int init_recv_pool(void);
+char * recv_buf_get(void);
+void recv_buf_put(char * buf);
+long long usec_now(void);
+typedef struct e2e
+{
+	int valid;
+	unsigned long long frame;
+	long long release;
+	long long deadline;
+}e2e_t;
+
+ssize_t strip_e2e(char * buf, ssize_t size, e2e_t * e2e);
+void log_recv_latency(int count, char * image, ssize_t size, long long * stamps, const e2e_t * e2e);
 
 /********************* Thread *********************/
 /* Singly-linked List head. */
@@ -135,6 +172,7 @@ void *recv_send_thread(void * arg)
 	{
 		// recv function
 		aesd_recv(data->target_sockfd);
+		close(data->target_sockfd);
 	}
 
 	data->complete_flag = true;
@@ -183,52 +221,187 @@ int init_signal_handle(void)
 
 
 
+int init_recv_pool(void)
+{
+	int i;
+
+	recv_pool_mem = malloc((size_t)RECV_POOL_BUFS*RECV_BUF_SIZE);
+	ERROR_CHECK_NULL(recv_pool_mem);
+	// touch every page now instead of on the first images
+	memset(recv_pool_mem, 0, (size_t)RECV_POOL_BUFS*RECV_BUF_SIZE);
+	for (i = 0; i < RECV_POOL_BUFS; i++)
+	{
+		recv_pool_free[i] = recv_pool_mem + (size_t)i*RECV_BUF_SIZE;
+	}
+	recv_pool_count = RECV_POOL_BUFS;
+	return 0;
+}
+
+// Blocks until a buffer is free, so a burst of clients is throttled
+// instead of growing the heap
+char * recv_buf_get(void)
+{
+	char * buf;
+
+	pthread_mutex_lock(&recv_pool_lock);
+	while (recv_pool_count == 0)
+	{
+		pthread_cond_wait(&recv_pool_cond, &recv_pool_lock);
+	}
+	buf = recv_pool_free[--recv_pool_count];
+	pthread_mutex_unlock(&recv_pool_lock);
+	return buf;
+}
+
+void recv_buf_put(char * buf)
+{
+	pthread_mutex_lock(&recv_pool_lock);
+	recv_pool_free[recv_pool_count++] = buf;
+	pthread_cond_signal(&recv_pool_cond);
+	pthread_mutex_unlock(&recv_pool_lock);
+}
+
+long long usec_now(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (long long)now.tv_sec*1000000 + now.tv_usec;
+}
+
+// Finds the deadline line at the end of the image and cuts it off,
+// returns the size of the image without it
+ssize_t strip_e2e(char * buf, ssize_t size, e2e_t * e2e)
+{
+	char line[E2E_LINE_MAX + 1];
+	ssize_t i, start = size > E2E_LINE_MAX ? size - E2E_LINE_MAX : 0;
+
+	e2e->valid = 0;
+	for (i = size - (ssize_t)strlen(E2E_TAG); i >= start; i--)
+	{
+		if (memcmp(buf + i, E2E_TAG, strlen(E2E_TAG)) == 0)
+		{
+			break;
+		}
+	}
+	if (i < start)
+	{
+		return size;
+	}
+	memcpy(line, buf + i, size - i);
+	line[size - i] = '\0';
+	if (sscanf(line, "\n#E2E frame=%llu release=%lld deadline=%lld",
+			&e2e->frame, &e2e->release, &e2e->deadline) != 3)
+	{
+		return size;
+	}
+	e2e->valid = 1;
+	return i;
+}
+
+// stamps: first byte, last byte, written, synced (wall clock usec)
+void log_recv_latency(int count, char * image, ssize_t size, long long * stamps, const e2e_t * e2e)
+{
+	static unsigned long long late_frames = 0;
+	char line[256];
+	int capture_sec = -1, capture_msec = -1;
+	long long e2e_msec = -1;
+	long long lateness = 0;
+
+	if (latency_fd < 0)
+	{
+		return;
+	}
+	// capture time from the PPM header comment, when the camera put one in
+	char * comment = memmem(image, size < 512 ? size : 512, "# sec=", 6);
+	if (comment != NULL)
+	{
+		sscanf(comment, "# sec=%d, msec=%d", &capture_sec, &capture_msec);
+		e2e_msec = stamps[3]/1000 - ((long long)capture_sec*1000 + capture_msec);
+	}
+	// the image only counts once it is on disk
+	if (e2e->valid)
+	{
+		lateness = stamps[3] - e2e->deadline;
+		if (lateness > 0)
+		{
+			late_frames++;
+			syslog(LOG_WARNING, "Frame %llu late by %lld usec (%llu late so far)",
+					e2e->frame, lateness, late_frames);
+		}
+	}
+	int len = sprintf(line, "%d, %d, %d, %lld, %lld, %lld, %lld, %lld, %lld, %lld, %lld\n",
+			count, capture_sec, capture_msec,
+			stamps[0], stamps[1] - stamps[0], stamps[2] - stamps[1], stamps[3] - stamps[2],
+			e2e_msec,
+			e2e->valid ? (long long)e2e->frame : -1LL,
+			e2e->valid ? e2e->deadline - e2e->release : -1LL,
+			lateness);
+	if (write(latency_fd, line, len) != len)
+	{
+		perror("latency write error");
+	}
+}
+
 int aesd_recv(int sockfd)
 {
+	long long stamps[4];
+	e2e_t e2e;
 	static int count = 0;
 	int error_code = 0;
-	// create a buffer for receiving message
-	void * local_buf = malloc(BUF_SIZE);
-	ERROR_CHECK_NULL(local_buf);
+	// take a buffer for receiving message from the pool
+	char * local_buf = recv_buf_get();
 
 	/* receive data */
-	int num_receive = 1;
 	bool EOT_flag = false;
 	ssize_t recv_size;
-	ssize_t total_recv_size; // assume ssize_t never overflow
+	ssize_t total_recv_size = 0;
 	while(EOT_flag==false)
 	{
+		if (total_recv_size == RECV_BUF_SIZE)
+		{
+			syslog(LOG_ERR, "Image larger than %d bytes, dropped", RECV_BUF_SIZE);
+			recv_buf_put(local_buf);
+			return -1;
+		}
 		// receive
-		recv_size = recv(sockfd,(local_buf+(num_receive-1)*BUF_SIZE),BUF_SIZE,0);
+		recv_size = recv(sockfd, local_buf+total_recv_size, RECV_BUF_SIZE-total_recv_size, 0);
 		ERROR_CHECK_LT_ZERO(recv_size);
-		total_recv_size = ((num_receive-1)*BUF_SIZE)+recv_size;
-		// check if receive '\n'
-		if (((char *)local_buf)[total_recv_size-1]==0x4)
+		if (recv_size == 0)
 		{
-			EOT_flag = true;
+			// client closed before the EOT
+			syslog(LOG_ERR, "Connection closed mid image, dropped");
+			recv_buf_put(local_buf);
+			return -1;
 		}
-		else
+		if (total_recv_size == 0)
 		{
-			num_receive++;
-			local_buf = realloc(local_buf,num_receive*BUF_SIZE);
-			ERROR_CHECK_NULL(local_buf);
+			stamps[0] = usec_now();
+		}
+		total_recv_size += recv_size;
+		// check if receive EOT
+		if (local_buf[total_recv_size-1]==0x4)
+		{
+			EOT_flag = true;
 		}
 	}
+	stamps[1] = usec_now();
+	// strip the '\n''#''EOT' trailer
 	total_recv_size = total_recv_size - 3;
-	local_buf = realloc(local_buf,total_recv_size - 1);
-	ERROR_CHECK_NULL(local_buf);
+	total_recv_size = strip_e2e(local_buf, total_recv_size, &e2e);
 
-    char filename[30];
-    sprintf(filename, "./images/cap_%06d.ppm",count);
+	char filename[30];
+	// several connections can finish at once, each image takes its own number
+	int image_count = __sync_fetch_and_add(&count, 1);
+	sprintf(filename, "./images/cap_%06d.ppm",image_count);
 	/* Open /var/tmp/cap_recv.ppm */
 	int fd = open(filename,
-			O_WRONLY|O_CREAT/*|O_APPEND*/,
+			O_WRONLY|O_CREAT|O_TRUNC,
 			S_IRWXU|S_IRWXG|S_IRWXO);
 	ERROR_CHECK_LT_ZERO(fd);
 
-	// write to /var/tmp/aesdsocketdata
-	pthread_mutex_lock(&lock);
-
+	// each connection writes and syncs its own file, nothing shared until
+	// the latency log below
 	ssize_t write_size = write(fd, local_buf, (size_t) total_recv_size);
 	// Check for error
 	if (write_size != total_recv_size)
@@ -236,15 +409,24 @@ int aesd_recv(int sockfd)
 		// Use errno to print error
 		perror("write error");
 	}
-
+	stamps[2] = usec_now();
+#ifdef SYNC_IMAGE
+	if (fsync(fd) != 0)
+	{
+		perror("fsync error");
+	}
+#endif
+	stamps[3] = usec_now();
+	// the latency file and the late frame count are shared
+	pthread_mutex_lock(&lock);
+	log_recv_latency(image_count, local_buf, total_recv_size, stamps, &e2e);
 	pthread_mutex_unlock(&lock);
 	syslog(LOG_USER, "Image_recv saved");
 	error_code = close(fd);
 	ERROR_CHECK_NE_ZERO(error_code);
 
-	// free local_buf
-	free(local_buf);
-	count++;
+	// give local_buf back to the pool
+	recv_buf_put(local_buf);
 	return 0;
 }
 
@@ -341,6 +523,24 @@ int main(int argc, char *argv[])
     error_code = pthread_mutex_init(&lock, NULL);
     ERROR_CHECK_NE_ZERO(error_code);
 
+	// Receive buffers, no malloc per image afterwards
+	init_recv_pool();
+
+	// Latency log, one line per image
+	latency_fd = open(RECV_LATENCY_FILE, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU|S_IRWXG|S_IRWXO);
+	if (latency_fd < 0)
+	{
+		perror("Cannot open " RECV_LATENCY_FILE);
+	}
+	else
+	{
+		char header[] = "Count, Capture Sec, Capture Msec, First Byte Usec, Receive, Write, Fsync, E2E Msec, Frame, Deadline Usec, Lateness Usec\n";
+		if (write(latency_fd, header, strlen(header)) < 0)
+		{
+			perror("latency write error");
+		}
+	}
+
 
 	// listen(sockfd)
 	error_code = listen(sockfd,10);
@@ -442,6 +642,11 @@ int main(int argc, char *argv[])
 
 	// freeaddrinfo so that no memory leak
 	freeaddrinfo(res);
+	free(recv_pool_mem);
+	if (latency_fd >= 0)
+	{
+		close(latency_fd);
+	}
 
 }
 
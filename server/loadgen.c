@@ -0,0 +1,390 @@
+/*
+ ============================================================================
+ Name        : loadgen.c
+ Author      : Chutao Wei
+ Version     : 1.00
+ Copyright   : MIT
+ Description : Loopback load generator for aesd_server
+ ============================================================================
+
+ N client threads each open one connection per frame, stream a synthetic PPM
+ with the same '\n''#''EOT' framing as the camera, then wait for the server
+ to close the connection. aesd_server closes only after the image is written
+ (and fsync'd), so that close is the ack.
+
+ Reports frames/s, MB/s, connect latency and send-to-ack latency (p50, p90,
+ p99, p99.9, max), on stdout or as JSON with -o.
+
+ Example, 4 cameras at 10 fps of 1280x720 for 20 s against a local server:
+     ./aesd_server &
+     ./loadgen -c 4 -r 10 -W 1280 -H 720 -t 20
+*/
+
+/********************* Include *********************/
+#define _GNU_SOURCE
+// std related
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Error related
+#include <errno.h>
+
+// File related
+#include <unistd.h>
+
+// Thread related
+#include <pthread.h>
+
+// Network related
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Time related
+#include <time.h>
+#include <sys/time.h>
+
+/********************* Define *********************/
+
+#define MAX_CLIENTS 64
+#define PORT "9000"
+#define HEADER_MAX 128
+#define ACK_BUF_SIZE 64
+
+/********************* Global Variables *********************/
+
+typedef struct client
+{
+	pthread_t thread_id;
+	int id;
+	// results
+	unsigned long long frames;
+	unsigned long long failed;
+	unsigned long long bytes;
+	double * connect_us;
+	double * ack_us;
+	size_t count;
+	size_t capacity;
+}client_t;
+
+struct addrinfo * server = NULL;
+char * pixels = NULL;
+size_t pixels_size = 0;
+int width = 640;
+int height = 480;
+int rate = 0;			// frames/s per client, 0 = as fast as possible
+double duration = 10.0;	// seconds
+unsigned long long frames_per_client = 0;	// 0 = run for duration
+unsigned long long start_ns = 0;
+
+/********************* Function *********************/
+
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void record(client_t * c, double connect_us, double ack_us)
+{
+	if (c->count == c->capacity)
+	{
+		c->capacity = c->capacity ? c->capacity*2 : 1024;
+		c->connect_us = realloc(c->connect_us, c->capacity*sizeof(double));
+		c->ack_us = realloc(c->ack_us, c->capacity*sizeof(double));
+		if ((c->connect_us == NULL) || (c->ack_us == NULL))
+		{
+			perror("loadgen realloc");
+			exit(1);
+		}
+	}
+	c->connect_us[c->count] = connect_us;
+	c->ack_us[c->count] = ack_us;
+	c->count++;
+}
+
+// One frame on one connection; returns 0 when the server acked it
+int send_frame(client_t * c)
+{
+	static const char trailer[3] = {'\n', '#', 0x4};
+	char header[HEADER_MAX];
+	char ack[ACK_BUF_SIZE];
+	struct timeval now;
+	struct iovec iov[3];
+	struct msghdr msg;
+	unsigned long long t0, t1, t2;
+	ssize_t size;
+
+	// capture time comment, so the server latency log can use it
+	gettimeofday(&now, NULL);
+	int header_len = snprintf(header, sizeof(header), "P6\n# sec=%d, msec=%d\n%d %d\n255\n",
+			(int)now.tv_sec, (int)now.tv_usec/1000, width, height);
+
+	t0 = now_ns();
+	int sockfd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+	if (sockfd < 0)
+	{
+		return -1;
+	}
+	if (connect(sockfd, server->ai_addr, server->ai_addrlen) != 0)
+	{
+		close(sockfd);
+		return -1;
+	}
+	t1 = now_ns();
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = header_len;
+	iov[1].iov_base = pixels;
+	iov[1].iov_len = pixels_size;
+	iov[2].iov_base = (void *)trailer;
+	iov[2].iov_len = sizeof(trailer);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 3;
+	size_t total = header_len + pixels_size + sizeof(trailer);
+	size_t sent = 0;
+	while (msg.msg_iovlen > 0)
+	{
+		size = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			close(sockfd);
+			return -1;
+		}
+		sent += size;
+		while ((msg.msg_iovlen > 0) && ((size_t)size >= msg.msg_iov->iov_len))
+		{
+			size -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0)
+		{
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + size;
+			msg.msg_iov->iov_len -= size;
+		}
+	}
+
+	// wait for the server to close: the image is on disk
+	shutdown(sockfd, SHUT_WR);
+	while ((size = recv(sockfd, ack, sizeof(ack), 0)) > 0)
+	{
+	}
+	t2 = now_ns();
+	close(sockfd);
+	if ((size < 0) || (sent != total))
+	{
+		return -1;
+	}
+
+	c->bytes += total;
+	record(c, (t1 - t0)/1000.0, (t2 - t1)/1000.0);
+	return 0;
+}
+
+void *client_thread(void * arg)
+{
+	client_t * c = (client_t *) arg;
+	unsigned long long period_ns = rate ? 1000000000ULL/rate : 0;
+	unsigned long long end_ns = start_ns + (unsigned long long)(duration*1e9);
+	unsigned long long i, release;
+	struct timespec ts;
+
+	// spread the clients over one period
+	unsigned long long offset = period_ns*c->id/MAX_CLIENTS;
+	for (i = 0; ; i++)
+	{
+		if (frames_per_client ? (i >= frames_per_client) : (now_ns() >= end_ns))
+		{
+			break;
+		}
+		if (period_ns)
+		{
+			release = start_ns + offset + i*period_ns;
+			ts.tv_sec = release/1000000000ULL;
+			ts.tv_nsec = release%1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+		if (send_frame(c) == 0)
+		{
+			c->frames++;
+		}
+		else
+		{
+			c->failed++;
+		}
+	}
+	return NULL;
+}
+
+int compare_double(const void * a, const void * b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+double percentile(double * v, size_t n, double p)
+{
+	if (n == 0)
+	{
+		return 0;
+	}
+	return v[(size_t)((n - 1)*p)];
+}
+
+/********************* Main *********************/
+
+int main(int argc, char *argv[])
+{
+	int num_clients = 1;
+	const char * host = "127.0.0.1";
+	const char * port = PORT;
+	const char * json = NULL;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:r:W:H:t:n:s:p:o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': num_clients = atoi(optarg); break;
+			case 'r': rate = atoi(optarg); break;
+			case 'W': width = atoi(optarg); break;
+			case 'H': height = atoi(optarg); break;
+			case 't': duration = atof(optarg); break;
+			case 'n': frames_per_client = strtoull(optarg, NULL, 10); break;
+			case 's': host = optarg; break;
+			case 'p': port = optarg; break;
+			case 'o': json = optarg; break;
+			default:
+				printf("usage: %s [-c clients] [-r fps per client] [-W width] [-H height]\n", argv[0]);
+				printf("          [-t seconds | -n frames per client] [-s host] [-p port] [-o file.json]\n");
+				exit(1);
+		}
+	}
+	if ((num_clients < 1) || (num_clients > MAX_CLIENTS))
+	{
+		printf("clients must be 1..%d\n", MAX_CLIENTS);
+		exit(1);
+	}
+
+	/* Server address */
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int error_code = getaddrinfo(host, port, &hints, &server);
+	if (error_code != 0)
+	{
+		printf("%s\n", gai_strerror(error_code));
+		exit(1);
+	}
+
+	/* Synthetic frame, same pixels for every send */
+	pixels_size = (size_t)width*height*3;
+	pixels = malloc(pixels_size);
+	if (pixels == NULL)
+	{
+		perror("loadgen malloc");
+		exit(1);
+	}
+	for (size_t p = 0; p < pixels_size; p++)
+	{
+		pixels[p] = (char)(p*7 + p/((size_t)width*3));
+	}
+
+	/* Run */
+	client_t * clients = calloc(num_clients, sizeof(client_t));
+	if (clients == NULL)
+	{
+		perror("loadgen calloc");
+		exit(1);
+	}
+	start_ns = now_ns();
+	for (i = 0; i < num_clients; i++)
+	{
+		clients[i].id = i;
+		error_code = pthread_create(&clients[i].thread_id, NULL, client_thread, &clients[i]);
+		if (error_code != 0)
+		{
+			printf("pthread_create: %s\n", strerror(error_code));
+			exit(1);
+		}
+	}
+	for (i = 0; i < num_clients; i++)
+	{
+		pthread_join(clients[i].thread_id, NULL);
+	}
+	double elapsed = (now_ns() - start_ns)/1e9;
+
+	/* Merge and report */
+	unsigned long long frames = 0, failed = 0, bytes = 0;
+	size_t n = 0;
+	for (i = 0; i < num_clients; i++)
+	{
+		frames += clients[i].frames;
+		failed += clients[i].failed;
+		bytes += clients[i].bytes;
+		n += clients[i].count;
+	}
+	double * connect_us = malloc((n ? n : 1)*sizeof(double));
+	double * ack_us = malloc((n ? n : 1)*sizeof(double));
+	size_t k = 0;
+	for (i = 0; i < num_clients; i++)
+	{
+		memcpy(connect_us + k, clients[i].connect_us, clients[i].count*sizeof(double));
+		memcpy(ack_us + k, clients[i].ack_us, clients[i].count*sizeof(double));
+		k += clients[i].count;
+		free(clients[i].connect_us);
+		free(clients[i].ack_us);
+	}
+	qsort(connect_us, n, sizeof(double), compare_double);
+	qsort(ack_us, n, sizeof(double), compare_double);
+
+	double fps = frames/elapsed;
+	double mbps = bytes/elapsed/(1024.0*1024.0);
+	printf("%d clients, %dx%d frames (%zu bytes), %.1f s\n", num_clients, width, height, pixels_size, elapsed);
+	printf("frames %llu, failed %llu, %.1f frames/s, %.2f MB/s\n", frames, failed, fps, mbps);
+	printf("connect us: p50 %.0f  p99 %.0f  max %.0f\n",
+			percentile(connect_us, n, 0.50), percentile(connect_us, n, 0.99), n ? connect_us[n - 1] : 0);
+	printf("ack us:     p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+			percentile(ack_us, n, 0.50), percentile(ack_us, n, 0.90), percentile(ack_us, n, 0.99),
+			percentile(ack_us, n, 0.999), n ? ack_us[n - 1] : 0);
+
+	if (json != NULL)
+	{
+		FILE * out = fopen(json, "w");
+		if (out == NULL)
+		{
+			perror(json);
+			exit(1);
+		}
+		fprintf(out, "{\n  \"clients\": %d,\n  \"width\": %d,\n  \"height\": %d,\n  \"rate_per_client\": %d,\n",
+				num_clients, width, height, rate);
+		fprintf(out, "  \"elapsed_s\": %.3f,\n  \"frames\": %llu,\n  \"failed\": %llu,\n", elapsed, frames, failed);
+		fprintf(out, "  \"frames_per_s\": %.2f,\n  \"mb_per_s\": %.3f,\n", fps, mbps);
+		fprintf(out, "  \"connect_us\": {\"p50\": %.0f, \"p99\": %.0f, \"max\": %.0f},\n",
+				percentile(connect_us, n, 0.50), percentile(connect_us, n, 0.99), n ? connect_us[n - 1] : 0);
+		fprintf(out, "  \"ack_us\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}\n}\n",
+				percentile(ack_us, n, 0.50), percentile(ack_us, n, 0.90), percentile(ack_us, n, 0.99),
+				percentile(ack_us, n, 0.999), n ? ack_us[n - 1] : 0);
+		fclose(out);
+	}
+
+	free(connect_us);
+	free(ack_us);
+	free(clients);
+	free(pixels);
+	freeaddrinfo(server);
+	return 0;
+}